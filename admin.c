@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <linux/log2.h>
+
 #include "nvmev.h"
 #include "conv_ftl.h"
 #include "zns_ftl.h"
@@ -153,13 +155,26 @@ static void __nvmev_admin_identify_ctrl(int eid, int cq_head)
 	memset(ctrl, 0x00, sizeof(*ctrl));
 
 	ctrl->nn = nvmev_vdev->nr_ns;
+	ctrl->oacs = NVME_CTRL_OACS_FORMAT;
 	ctrl->oncs = 0; //optional command
+#if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
+	ctrl->oncs |= NVME_CTRL_ONCS_COPY;
+	ctrl->ocfs = NVME_CTRL_OCFS_FORMAT0;
+#endif
 	ctrl->acl = 3; //minimum 4 required, 0's based value
 	ctrl->vwc = 0;
 	snprintf(ctrl->sn, sizeof(ctrl->sn), "CSL_Virt_SN_%02d", 1);
 	snprintf(ctrl->mn, sizeof(ctrl->mn), "CSL_Virt_MN_%02d", 1);
 	snprintf(ctrl->fr, sizeof(ctrl->fr), "CSL_%03d", 2);
 	ctrl->mdts = nvmev_vdev->mdts;
+#if (SUPPORTED_SSD_TYPE(CONV))
+	/* in 4KiB units */
+	ctrl->hmpre = HMB_PREFERRED_SIZE / KB(4);
+	ctrl->hmmin = HMB_PREFERRED_SIZE ? HMB_MIN_SIZE / KB(4) : 0;
+	ctrl->hmmaxd = HMB_PREFERRED_SIZE ? HMB_MAX_DESCS : 0;
+	if (FDP_NR_RUHS)
+		ctrl->ctratt |= NVME_CTRL_ATTR_FDPS;
+#endif
 	ctrl->sqes = 0x66;
 	ctrl->cqes = 0x44;
 
@@ -169,6 +184,90 @@ static void __nvmev_admin_identify_ctrl(int eid, int cq_head)
 	cq_entry(cq_head).status = queue->phase | NVME_SC_SUCCESS << 1;
 }
 
+#if (SUPPORTED_SSD_TYPE(CONV))
+/*
+ * FDP log pages of the endurance group: a single configuration with one
+ * reclaim group, whose reclaim units are the lines of an FTL instance.
+ */
+static void __nvmev_admin_get_fdp_log(struct nvme_get_log_page_command *cmd, void *page,
+				      uint32_t len)
+{
+	size_t size = max3(sizeof(struct nvme_fdp_config_log) + sizeof(struct nvme_fdp_config_desc) +
+				   FDP_NR_RUHS * sizeof(struct nvme_fdp_ruh_desc),
+			   sizeof(struct nvme_fdp_stats_log), sizeof(struct nvme_fdp_events_log));
+	void *buf;
+	int i;
+
+	/* the event timestamp sits at byte 4, the layout must not be padded */
+	BUILD_BUG_ON(sizeof(struct nvme_fdp_event) != 64);
+	BUILD_BUG_ON(offsetof(struct nvme_fdp_event, timestamp) != 4);
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (!buf || !FDP_NR_RUHS || cmd->lsi != FDP_ENDGID) {
+		kfree(buf);
+		__memset(page, 0, len);
+		return;
+	}
+
+	switch (cmd->lid) {
+	case NVME_LOG_FDP_CONFIGS: {
+		struct nvme_fdp_config_log *log = buf;
+		struct nvme_fdp_config_desc *desc = (void *)(log + 1);
+		struct conv_ftl *conv_ftl = NULL;
+
+		for (i = 0; i < nvmev_vdev->nr_ns && !conv_ftl; i++) {
+			if (NS_SSD_TYPE(i) == SSD_TYPE_CONV)
+				conv_ftl = nvmev_vdev->ns[i].ftls;
+		}
+
+		desc->dsze = sizeof(*desc) + FDP_NR_RUHS * sizeof(desc->ruhs[0]);
+		desc->fdpa = NVME_FDP_FDPA_VALID; /* RGIF 0: the placement id is the handle */
+		desc->nrg = 1;
+		desc->nruh = FDP_NR_RUHS;
+		desc->maxpids = FDP_NR_RUHS - 1;
+		desc->nnss = nvmev_vdev->nr_ns;
+		if (conv_ftl)
+			desc->runs = (uint64_t)conv_ftl->ssd->sp.pgs_per_line * conv_ftl->ssd->sp.pgsz;
+		for (i = 0; i < FDP_NR_RUHS; i++)
+			desc->ruhs[i].ruht = NVME_FDP_RUHT_INITIALLY_ISOLATED;
+
+		log->numfdpc = 0;
+		log->sze = sizeof(*log) + desc->dsze;
+		size = log->sze;
+		break;
+	}
+	case NVME_LOG_FDP_STATS: {
+		struct nvme_fdp_stats_log *log = buf;
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			if (NS_SSD_TYPE(i) == SSD_TYPE_CONV)
+				conv_fdp_stats(&nvmev_vdev->ns[i], log);
+		}
+		size = sizeof(*log);
+		break;
+	}
+	case NVME_LOG_FDP_EVENTS: {
+		struct nvme_fdp_events_log *log = buf;
+		struct nvmev_fdp_events *evl = &nvmev_vdev->fdp_events;
+		uint32_t first = (evl->next + NR_FDP_EVENTS - evl->nr_events) % NR_FDP_EVENTS;
+
+		/* LSP bit 0 asks for controller events, none are generated */
+		if (!(cmd->lsp & 0x1)) {
+			log->nevents = evl->nr_events;
+			for (i = 0; i < evl->nr_events; i++)
+				log->events[i] = evl->events[(first + i) % NR_FDP_EVENTS];
+		}
+		size = sizeof(*log);
+		break;
+	}
+	}
+
+	__memset(page, 0, len);
+	__memcpy(page, buf, min_t(size_t, len, size));
+	kfree(buf);
+}
+#endif
+
 static void __nvmev_admin_get_log_page(int eid, int cq_head)
 {
 	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
@@ -195,6 +294,13 @@ static void __nvmev_admin_get_log_page(int eid, int cq_head)
 		__memcpy(page, &smart_log, len);
 		break;
 	}
+#if (SUPPORTED_SSD_TYPE(CONV))
+	case NVME_LOG_FDP_CONFIGS:
+	case NVME_LOG_FDP_STATS:
+	case NVME_LOG_FDP_EVENTS:
+		__nvmev_admin_get_fdp_log(cmd, page, len);
+		break;
+#endif
 	case NVME_LOG_CMD_EFFECTS: {
 		static const struct nvme_effects_log effects_log = {
 			.acs = {
@@ -217,6 +323,9 @@ static void __nvmev_admin_get_log_page(int eid, int cq_head)
 				[nvme_cmd_zone_append] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 				[nvme_cmd_zone_mgmt_send] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP | NVME_CMD_EFFECTS_LBCC),
 				[nvme_cmd_zone_mgmt_recv] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
+#endif
+#if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
+				[nvme_cmd_copy] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP | NVME_CMD_EFFECTS_LBCC),
 #endif
 			},
 			.resv = { 0, },
@@ -251,6 +360,88 @@ static void __nvmev_admin_get_log_page(int eid, int cq_head)
 	cq_entry(cq_head).status = queue->phase | NVME_SC_SUCCESS << 1;
 }
 
+/* LBA formats advertised to the host, only those without metadata can be formatted to */
+static const struct nvme_lbaf nvmev_lbafs[] = {
+	{ .ms = 0, .ds = 9, .rp = NVME_LBAF_RP_GOOD },
+	{ .ms = 8, .ds = 9, .rp = NVME_LBAF_RP_GOOD },
+	{ .ms = 16, .ds = 9, .rp = NVME_LBAF_RP_GOOD },
+	{ .ms = 0, .ds = 12, .rp = NVME_LBAF_RP_BEST },
+	{ .ms = 8, .ds = 12, .rp = NVME_LBAF_RP_BEST },
+	{ .ms = 64, .ds = 12, .rp = NVME_LBAF_RP_BEST },
+	{ .ms = 128, .ds = 12, .rp = NVME_LBAF_RP_BEST },
+};
+
+static unsigned int __lbaf_index(uint32_t lba_shift)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(nvmev_lbafs); i++) {
+		if (nvmev_lbafs[i].ms == 0 && nvmev_lbafs[i].ds == lba_shift)
+			return i;
+	}
+	return 0;
+}
+
+/*
+ * @bytes in LBAs, for a 16 bit field. A size that does not fit is cut down to
+ * its largest power of two divisor that does, so boundaries still line up.
+ */
+static uint32_t __lba_hint(struct nvmev_ns *ns, uint64_t bytes, uint32_t max)
+{
+	uint64_t lbas = NS_BYTE_TO_LBA(ns, bytes);
+
+	if (lbas > max)
+		lbas = min_t(uint64_t, lbas & -lbas, rounddown_pow_of_two(max));
+	return lbas;
+}
+
+/*
+ * Preferred write granularity and alignment are the program unit, deallocate
+ * granularity is the unit space is reclaimed in (a line, or a zone), and a
+ * write one program unit on every die is the optimal write size. On a
+ * partitioned namespace the units are those of every partition together.
+ */
+static void __identify_io_hints(struct nvme_id_ns *id, size_t nsid)
+{
+	struct nvmev_ns *ns = &nvmev_vdev->ns[nsid];
+	struct ssdparams *spp;
+	uint64_t prog_size, reclaim_size, stripe_size;
+
+	if (NS_SSD_TYPE(nsid) == SSD_TYPE_CONV) {
+		spp = &((struct conv_ftl *)ns->ftls)->ssd->sp;
+		if (ssd_hybrid()) /* host writes are staged in SLC */
+			prog_size = (uint64_t)spp->slc_pgs_per_oneshotpg * spp->pgsz;
+		else
+			prog_size = (uint64_t)spp->pgs_per_oneshotpg * spp->pgsz;
+		reclaim_size = (uint64_t)spp->pgs_per_line * spp->pgsz;
+		/* pages go round robin over the partitions, each has its own wordlines and lines */
+		prog_size *= ns->nr_parts;
+		reclaim_size *= ns->nr_parts;
+	} else if (NS_SSD_TYPE(nsid) == SSD_TYPE_ZNS) {
+		struct zns_ftl *zns_ftl = ns->ftls;
+
+		spp = &zns_ftl->ssd->sp;
+		prog_size = spp->write_unit_size;
+		reclaim_size = zns_ftl->zp.zone_size;
+	} else {
+		return;
+	}
+
+	/* a program unit smaller than an LBA is not worth a hint */
+	if (NS_BYTE_TO_LBA(ns, prog_size) == 0)
+		return;
+
+	stripe_size = prog_size * spp->tt_luns;
+
+	id->nsfeat |= NVME_NS_FEAT_IO_OPT;
+	id->npwg = __lba_hint(ns, prog_size, U16_MAX + 1) - 1;
+	id->npwa = id->npwg;
+	id->npdg = __lba_hint(ns, reclaim_size, U16_MAX + 1) - 1;
+	id->npda = id->npdg;
+	id->nows = __lba_hint(ns, stripe_size, U16_MAX + 1) - 1;
+	id->noiob = __lba_hint(ns, stripe_size, U16_MAX);
+}
+
 static void __nvmev_admin_identify_namespace(int eid, int cq_head)
 {
 	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
@@ -262,42 +453,29 @@ static void __nvmev_admin_identify_namespace(int eid, int cq_head)
 	ns = prp_address(cmd->prp1);
 	memset(ns, 0x0, PAGE_SIZE);
 
-	ns->lbaf[0].ms = 0;
-	ns->lbaf[0].ds = 9;
-	ns->lbaf[0].rp = NVME_LBAF_RP_GOOD;
-
-	ns->lbaf[1].ms = 8;
-	ns->lbaf[1].ds = 9;
-	ns->lbaf[1].rp = NVME_LBAF_RP_GOOD;
-
-	ns->lbaf[2].ms = 16;
-	ns->lbaf[2].ds = 9;
-	ns->lbaf[2].rp = NVME_LBAF_RP_GOOD;
-
-	ns->lbaf[3].ms = 0;
-	ns->lbaf[3].ds = 12;
-	ns->lbaf[3].rp = NVME_LBAF_RP_BEST;
-
-	ns->lbaf[4].ms = 8;
-	ns->lbaf[4].ds = 12;
-	ns->lbaf[4].rp = NVME_LBAF_RP_BEST;
-
-	ns->lbaf[5].ms = 64;
-	ns->lbaf[5].ds = 12;
-	ns->lbaf[5].rp = NVME_LBAF_RP_BEST;
-
-	ns->lbaf[6].ms = 128;
-	ns->lbaf[6].ds = 12;
-	ns->lbaf[6].rp = NVME_LBAF_RP_BEST;
+	memcpy(ns->lbaf, nvmev_lbafs, sizeof(nvmev_lbafs));
+	ns->nlbaf = ARRAY_SIZE(nvmev_lbafs) - 1;
+	ns->flbas = __lbaf_index(nvmev_vdev->ns[nsid].lba_shift);
 
 	ns->nsze = (nvmev_vdev->ns[nsid].size >> ns->lbaf[ns->flbas].ds);
 
 	ns->ncap = ns->nsze;
 	ns->nuse = ns->nsze;
-	ns->nlbaf = 6;
-	ns->flbas = 0;
 	ns->dps = 0;
 
+	__identify_io_hints(ns, nsid);
+
+#if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
+	ns->mssrl = MAX_COPY_RANGE_LBAS;
+	ns->mcl = MAX_COPY_RANGE_LBAS * NR_MAX_COPY_RANGES;
+	ns->msrc = NR_MAX_COPY_RANGES - 1;
+#endif
+#if (SUPPORTED_SSD_TYPE(CONV))
+	/* every namespace shares the endurance group that holds the FDP configuration */
+	if (FDP_NR_RUHS)
+		ns->endgid = FDP_ENDGID;
+#endif
+
 	cq_entry(cq_head).command_id = sq_entry(eid).features.command_id;
 	cq_entry(cq_head).sq_id = 0;
 	cq_entry(cq_head).sq_head = eid;
@@ -417,9 +595,73 @@ static void __nvmev_admin_identify_zns_ctrl(int eid, int cq_head)
 	cq_entry(cq_head).status = queue->phase | NVME_SC_SUCCESS << 1;
 }
 
+/*
+ * Take or return the host memory buffer. Only the descriptor list is kept;
+ * the FTL picks up the new buffer on its next mapping lookup.
+ */
+static bool __nvmev_admin_set_hmb(struct nvme_features *cmd)
+{
+	struct nvmev_hmb *hmb = &nvmev_vdev->hmb;
+	uint64_t mps = KB(4); /* CAP.MPSMAX is 0, the memory page size is always 4KiB */
+	uint64_t list = ((uint64_t)cmd->dword14 << 32) | cmd->dword13;
+	uint32_t nr_descs = cmd->dword15;
+	struct nvme_host_mem_buf_desc *descs;
+	uint64_t size = 0;
+	uint32_t i;
+
+	if (!(cmd->dword11 & NVME_HOST_MEM_ENABLE)) {
+		if (hmb->enabled)
+			NVMEV_INFO("Host memory buffer of %llu bytes returned\n", hmb->size);
+
+		kfree(hmb->descs);
+		hmb->descs = NULL;
+		hmb->nr_descs = 0;
+		hmb->size = 0;
+		hmb->enabled = false;
+		hmb->gen++;
+		return true;
+	}
+
+	if (HMB_PREFERRED_SIZE == 0 || hmb->enabled)
+		return false;
+
+	/* the descriptor list is 16 byte aligned and no longer than HMMAXD */
+	if (nr_descs == 0 || nr_descs > HMB_MAX_DESCS || list == 0 ||
+	    !IS_ALIGNED(list, sizeof(*descs))) {
+		NVMEV_ERROR("Invalid host memory buffer list %#llx of %u descriptors\n", list,
+			    nr_descs);
+		return false;
+	}
+
+	descs = kmalloc_array(nr_descs, sizeof(*descs), GFP_KERNEL);
+	if (!descs)
+		return false;
+
+	memcpy(descs, prp_address(list), nr_descs * sizeof(*descs));
+	for (i = 0; i < nr_descs; i++)
+		size += (uint64_t)descs[i].size * mps;
+
+	if (size < HMB_MIN_SIZE || size != (uint64_t)cmd->dword12 * mps) {
+		NVMEV_ERROR("Invalid host memory buffer: %llu bytes in %u descriptors\n", size,
+			    nr_descs);
+		kfree(descs);
+		return false;
+	}
+
+	hmb->descs = descs;
+	hmb->nr_descs = nr_descs;
+	hmb->size = size;
+	hmb->enabled = true;
+	hmb->gen++;
+
+	NVMEV_INFO("Host memory buffer of %llu bytes in %u descriptors\n", size, nr_descs);
+	return true;
+}
+
 static void __nvmev_admin_set_features(int eid, int cq_head)
 {
 	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	int status = NVME_SC_SUCCESS;
 
 	NVMEV_DEBUG("%s: %x\n", __func__, sq_entry(eid).features.fid);
 
@@ -446,6 +688,17 @@ static void __nvmev_admin_set_features(int eid, int cq_head)
 			((nvmev_vdev->nr_cq - 1) << 16 | (nvmev_vdev->nr_sq - 1));
 		break;
 	}
+	case NVME_FEAT_HOST_MEM_BUF:
+		if (!__nvmev_admin_set_hmb(&sq_entry(eid).features))
+			status = NVME_SC_INVALID_FIELD;
+		break;
+	case NVME_FEAT_FDP:
+		/* FDP is fixed by the build, only the current state can be set */
+		if ((sq_entry(eid).features.dword11 & 0xFFFF) != FDP_ENDGID ||
+		    !!(sq_entry(eid).features.dword12 & 0x1) != !!FDP_NR_RUHS ||
+		    ((sq_entry(eid).features.dword12 >> 8) & 0xFF) != 0)
+			status = NVME_SC_INVALID_FIELD;
+		break;
 	case NVME_FEAT_IRQ_COALESCE:
 	case NVME_FEAT_IRQ_CONFIG:
 	case NVME_FEAT_WRITE_ATOMIC:
@@ -462,11 +715,90 @@ static void __nvmev_admin_set_features(int eid, int cq_head)
 	cq_entry(cq_head).command_id = sq_entry(eid).features.command_id;
 	cq_entry(cq_head).sq_id = 0;
 	cq_entry(cq_head).sq_head = eid;
-	cq_entry(cq_head).status = queue->phase | NVME_SC_SUCCESS << 1;
+	cq_entry(cq_head).status = queue->phase | status << 1;
 }
 
 static void __nvmev_admin_get_features(int eid, int cq_head)
 {
+	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	int status = NVME_SC_SUCCESS;
+
+	NVMEV_DEBUG("%s: %x\n", __func__, sq_entry(eid).features.fid);
+
+	cq_entry(cq_head).result0 = 0;
+
+	switch (sq_entry(eid).features.fid) {
+	case NVME_FEAT_NUM_QUEUES:
+		cq_entry(cq_head).result0 =
+			((nvmev_vdev->nr_cq - 1) << 16 | (nvmev_vdev->nr_sq - 1));
+		break;
+	case NVME_FEAT_HOST_MEM_BUF:
+		cq_entry(cq_head).result0 = nvmev_vdev->hmb.enabled ? NVME_HOST_MEM_ENABLE : 0;
+		break;
+	case NVME_FEAT_FDP:
+		if ((sq_entry(eid).features.dword11 & 0xFFFF) != FDP_ENDGID)
+			status = NVME_SC_INVALID_FIELD;
+		else
+			cq_entry(cq_head).result0 = FDP_NR_RUHS ? 0x1 : 0; /* FDPE, configuration 0 */
+		break;
+	default:
+		break;
+	}
+
+	cq_entry(cq_head).command_id = sq_entry(eid).features.command_id;
+	cq_entry(cq_head).sq_id = 0;
+	cq_entry(cq_head).sq_head = eid;
+	cq_entry(cq_head).status = queue->phase | status << 1;
+}
+
+/*
+ * Switch one or all namespaces to another LBA format. Protection information
+ * and secure erase are not supported, user data is left in place.
+ */
+static void __nvmev_admin_format_nvm(int eid, int cq_head)
+{
+	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	struct nvme_format_cmd *cmd = &sq_entry(eid).format;
+	unsigned int lbaf = cmd->cdw10 & 0xf;
+	unsigned int pi = (cmd->cdw10 >> 5) & 0x7;
+	unsigned int ses = (cmd->cdw10 >> 9) & 0x7;
+	unsigned int first = 0, last = nvmev_vdev->nr_ns, i;
+	int status = NVME_SC_SUCCESS;
+
+	if (cmd->nsid != 0xFFFFFFFF) {
+		first = cmd->nsid - 1;
+		last = cmd->nsid;
+	}
+
+	if (cmd->nsid == 0 || last > nvmev_vdev->nr_ns) {
+		status = NVME_SC_INVALID_NS;
+	} else if (lbaf >= ARRAY_SIZE(nvmev_lbafs) || nvmev_lbafs[lbaf].ms || pi) {
+		status = NVME_SC_INVALID_FORMAT;
+	} else if (ses) {
+		status = NVME_SC_INVALID_FIELD;
+	} else {
+		/* a broadcast format must not leave some namespaces converted */
+		for (i = first; i < last; i++) {
+			struct nvmev_ns *ns = &nvmev_vdev->ns[i];
+
+			if (ns->lba_shift != nvmev_lbafs[lbaf].ds && !ns->format) {
+				status = NVME_SC_INVALID_FORMAT;
+				break;
+			}
+		}
+
+		for (i = first; i < last && status == NVME_SC_SUCCESS; i++) {
+			struct nvmev_ns *ns = &nvmev_vdev->ns[i];
+
+			if (ns->lba_shift != nvmev_lbafs[lbaf].ds)
+				ns->format(ns, nvmev_lbafs[lbaf].ds);
+		}
+	}
+
+	cq_entry(cq_head).command_id = cmd->command_id;
+	cq_entry(cq_head).sq_id = 0;
+	cq_entry(cq_head).sq_head = eid;
+	cq_entry(cq_head).status = queue->phase | status << 1;
 }
 
 static void __nvmev_proc_admin_req(int entry_id)
@@ -535,9 +867,11 @@ static void __nvmev_proc_admin_req(int entry_id)
 		cq_entry(cq_head).result0 = 0;
 		cq_entry(cq_head).status = queue->phase | NVME_SC_ASYNC_LIMIT << 1;
 		break;
+	case nvme_admin_format_nvm:
+		__nvmev_admin_format_nvm(entry_id, cq_head);
+		break;
 	case nvme_admin_activate_fw:
 	case nvme_admin_download_fw:
-	case nvme_admin_format_nvm:
 	case nvme_admin_security_send:
 	case nvme_admin_security_recv:
 	default:
@@ -10,111 +10,113 @@
 
 static inline unsigned long long __get_wallclock(void)
 {
-	return cpu_clock(nvmev_vdev->config.cpu_nr_dispatcher);
+	return nvmev_clock();
 }
 
 void chmodel_init(struct channel_model *ch, uint64_t bandwidth /*MB/s*/)
 {
-	ch->head = 0;
-	ch->valid_len = 0;
-	ch->cur_time = 0;
-	ch->max_credits = BANDWIDTH_TO_MAX_CREDITS(bandwidth);
-	ch->command_credits = 0;
+	spin_lock_init(&ch->lock);
+	ch->nr_resv = 0;
 	ch->xfer_lat = BANDWIDTH_TO_TX_TIME(bandwidth);
 
-	MEMSET(&(ch->avail_credits[0]), ch->max_credits, NR_CREDIT_ENTRIES);
+	NVMEV_INFO("[%s] bandwidth %llu tx_time %u\n", __FUNCTION__, bandwidth, ch->xfer_lat);
+}
 
-	NVMEV_INFO("[%s] bandwidth %llu max_credits %u tx_time %u\n", __FUNCTION__, bandwidth,
-		   ch->max_credits, ch->xfer_lat);
+/* transfers booked already keep their times, later ones run at the new rate */
+void chmodel_set_xfer_lat(struct channel_model *ch, uint32_t xfer_lat)
+{
+	spin_lock(&ch->lock);
+	ch->xfer_lat = xfer_lat;
+	spin_unlock(&ch->lock);
 }
 
-uint64_t chmodel_request(struct channel_model *ch, uint64_t request_time, uint64_t length)
+/* forget the intervals that are over by @now */
+static void __expire(struct channel_model *ch, uint64_t now)
 {
-	uint64_t cur_time = __get_wallclock();
-	uint32_t pos, next_pos;
-	uint32_t remaining_credits, consumed_credits;
-	uint32_t default_delay, delay = 0;
-	uint32_t valid_length;
-	uint64_t total_latency;
-	uint32_t units_to_xfer = DIV_ROUND_UP(length, UNIT_XFER_SIZE);
-	uint32_t cur_time_offs, request_time_offs;
-
-	// Search current time index and move head to it
-	cur_time_offs = (cur_time / UNIT_TIME_INTERVAL) - (ch->cur_time / UNIT_TIME_INTERVAL);
-	cur_time_offs = (cur_time_offs < ch->valid_len) ? cur_time_offs : ch->valid_len;
-
-	if (ch->head + cur_time_offs >= NR_CREDIT_ENTRIES) {
-		MEMSET(&(ch->avail_credits[ch->head]), ch->max_credits,
-		       NR_CREDIT_ENTRIES - ch->head);
-		MEMSET(&(ch->avail_credits[0]), ch->max_credits,
-		       cur_time_offs - (NR_CREDIT_ENTRIES - ch->head));
-	} else {
-		MEMSET(&(ch->avail_credits[ch->head]), ch->max_credits, cur_time_offs);
-	}
+	uint32_t i = 0;
 
-	ch->head = (ch->head + cur_time_offs) % NR_CREDIT_ENTRIES;
-	ch->cur_time = cur_time;
-	ch->valid_len = ch->valid_len - cur_time_offs;
+	while (i < ch->nr_resv && ch->resv[i].end <= now)
+		i++;
 
-	if (ch->valid_len > NR_CREDIT_ENTRIES) {
-		NVMEV_ERROR("[%s] Invalid valid_len 0x%x\n", __FUNCTION__, ch->valid_len);
-		NVMEV_ASSERT(0);
-	}
+	if (i == 0)
+		return;
 
-	if (request_time < cur_time) {
-		NVMEV_DEBUG("[%s] Reqeust time is before the current time 0x%llx 0x%llx\n",
-			    __FUNCTION__, request_time, cur_time);
-		return request_time; // return minimum delay
-	}
+	ch->nr_resv -= i;
+	memmove(&ch->resv[0], &ch->resv[i], sizeof(ch->resv[0]) * ch->nr_resv);
+}
 
-	//Search request time index
-	request_time_offs = (request_time / UNIT_TIME_INTERVAL) - (cur_time / UNIT_TIME_INTERVAL);
+/* index of the first interval still busy after @time, looking from resv[@i] on */
+static uint32_t __find(struct channel_model *ch, uint32_t i, uint64_t time)
+{
+	while (i < ch->nr_resv && ch->resv[i].end <= time)
+		i++;
 
-	if (request_time_offs >= NR_CREDIT_ENTRIES) {
-		NVMEV_ERROR("[%s] Need to increase array size 0x%llx 0x%llx 0x%x\n", __FUNCTION__,
-			    request_time, cur_time, request_time_offs);
-		return request_time; // return minimum delay
-	}
+	return i;
+}
 
-	pos = (ch->head + request_time_offs) % NR_CREDIT_ENTRIES;
-	remaining_credits = units_to_xfer * UNIT_XFER_CREDITS;
-	remaining_credits += ch->command_credits;
-
-	default_delay = remaining_credits / ch->max_credits;
-	delay = 0;
-
-	while (1) {
-		consumed_credits = (remaining_credits <= ch->avail_credits[pos]) ?
-					   remaining_credits :
-					   ch->avail_credits[pos];
-		ch->avail_credits[pos] -= consumed_credits;
-		remaining_credits -= consumed_credits;
-
-		if (remaining_credits) {
-			next_pos = (pos + 1) % NR_CREDIT_ENTRIES;
-			// If array is full
-			if (next_pos != ch->head) {
-				delay++;
-				pos = next_pos;
-			} else {
-				NVMEV_ERROR("[%s] No free entry 0x%llx 0x%llx 0x%x\n", __FUNCTION__,
-					    request_time, cur_time, request_time_offs);
-				break;
-			}
-		} else
-			break;
+/*
+ * Mark [@start, @end) busy. It lies in the gap in front of resv[@i]. When
+ * the list is full the neighbour grows over the gap instead, which only
+ * makes the channel look busier than it is.
+ */
+static void __reserve(struct channel_model *ch, uint32_t i, uint64_t start, uint64_t end)
+{
+	struct ch_reservation *prev = (i > 0) ? &ch->resv[i - 1] : NULL;
+	struct ch_reservation *next = (i < ch->nr_resv) ? &ch->resv[i] : NULL;
+
+	if (prev && prev->end == start) {
+		prev->end = end;
+		if (next && next->start == end) {
+			prev->end = next->end;
+			ch->nr_resv--;
+			memmove(next, next + 1, sizeof(*next) * (ch->nr_resv - i));
+		}
+	} else if (next && next->start == end) {
+		next->start = start;
+	} else if (ch->nr_resv < NR_CH_RESERVATIONS) {
+		memmove(&ch->resv[i + 1], &ch->resv[i], sizeof(ch->resv[0]) * (ch->nr_resv - i));
+		ch->resv[i].start = start;
+		ch->resv[i].end = end;
+		ch->nr_resv++;
+	} else if (prev) {
+		prev->end = end;
+	} else {
+		next->start = start;
 	}
+}
 
-	valid_length = (pos >= ch->head) ? (pos - ch->head + 1) :
-					   (NR_CREDIT_ENTRIES - (ch->head - pos - 1));
-
-	if (valid_length > ch->valid_len)
-		ch->valid_len = valid_length;
-
-	// check if array is small..
-	delay = (delay > default_delay) ? (delay - default_delay) : 0;
-
-	total_latency = (ch->xfer_lat * units_to_xfer) + (delay * UNIT_TIME_INTERVAL);
+/* returns when a transfer of @length bytes requested at @request_time completes */
+uint64_t chmodel_request(struct channel_model *ch, uint64_t request_time, uint64_t length)
+{
+	uint64_t remaining = ch->xfer_lat * DIV_ROUND_UP(length, UNIT_XFER_SIZE);
+	uint64_t time = request_time;
+	uint64_t now = __get_wallclock();
+	uint32_t i;
+
+	spin_lock(&ch->lock);
+	__expire(ch, now);
+
+	i = __find(ch, 0, time);
+	while (remaining) {
+		struct ch_reservation *next = (i < ch->nr_resv) ? &ch->resv[i] : NULL;
+		uint64_t len;
+
+		if (next && next->start <= time) {
+			/* busy: skip to the end of the interval */
+			time = next->end;
+			i++;
+			continue;
+		}
+
+		/* idle until the next interval, or for good */
+		len = next ? min(remaining, next->start - time) : remaining;
+		__reserve(ch, i, time, time + len);
+		time += len;
+		remaining -= len;
+		/* the piece ended up in resv[i - 1] or resv[i] */
+		i = __find(ch, i ? i - 1 : 0, time);
+	}
+	spin_unlock(&ch->lock);
 
-	return request_time + total_latency;
+	return time;
 }
@@ -3,44 +3,35 @@
 #ifndef _CHANNEL_MODEL_H
 #define _CHANNEL_MODEL_H
 
+#include <linux/spinlock.h>
+
 /* Macros for channel model */
-#define NR_CREDIT_ENTRIES (1024 * 96)
-#define UNIT_TIME_INTERVAL (4000ULL) //ns
+#define NR_CH_RESERVATIONS (64) /* busy intervals tracked per channel */
 #define UNIT_XFER_SIZE (128ULL) //bytes
-#define UNIT_XFER_CREDITS (1) //credits needed to transfer data(UNIT_XFER_SIZE)
-
-#define SIZE_OF_CREDIT_T 1
-
-#if (SIZE_OF_CREDIT_T == 1)
-typedef uint8_t credit_t;
-#define MEMSET(dest, value, length) memset(dest, value, length)
-
-#elif (SIZE_OF_CREDIT_T == 2)
-typedef uint16_t credit_t;
-#define MEMSET(dest, value, length) memset16(dest, value, length)
 
-#elif (SIZE_OF_CREDIT_T == 4)
-typedef uint32_t credit_t;
-#define MEMSET(dest, value, length) memset32(dest, value, length)
-#else
-#error "Invalid credit size"
-#endif
+/* the channel is busy over [start, end) */
+struct ch_reservation {
+	uint64_t start;
+	uint64_t end;
+};
 
+/*
+ * A channel transfers one request at a time at full bandwidth. Busy time is
+ * kept as a sorted list of disjoint intervals, adjacent ones are merged, so
+ * back-to-back transfers take a single entry. A request fills the idle gaps
+ * after its request time, in pieces if it has to. The list is shared by every
+ * submitter that issues to the channel, so it's only touched under @lock.
+ */
 struct channel_model {
-	uint64_t cur_time;
-	uint32_t head;
-	uint32_t valid_len;
-	uint32_t max_credits;
-	uint32_t command_credits;
-	uint32_t xfer_lat; /*XKB NAND CH transfer time in nanoseconds*/
-
-	credit_t avail_credits[NR_CREDIT_ENTRIES];
+	spinlock_t lock;
+	uint32_t xfer_lat; /*UNIT_XFER_SIZE transfer time in nanoseconds*/
+	uint32_t nr_resv;
+	struct ch_reservation resv[NR_CH_RESERVATIONS];
 };
 
 #define BANDWIDTH_TO_TX_TIME(MB_S) (((UNIT_XFER_SIZE)*NS_PER_SEC(1)) / (MB(MB_S)))
-#define BANDWIDTH_TO_MAX_CREDITS(MB_S) \
-	(MB(MB_S) * UNIT_TIME_INTERVAL / NS_PER_SEC(1) / UNIT_XFER_SIZE * UNIT_XFER_CREDITS)
 
 uint64_t chmodel_request(struct channel_model *ch, uint64_t request_time, uint64_t length);
 void chmodel_init(struct channel_model *ch, uint64_t bandwidth /*MB/s*/);
+void chmodel_set_xfer_lat(struct channel_model *ch, uint32_t xfer_lat);
 #endif
@@ -2,6 +2,8 @@
 
 #include <linux/ktime.h>
 #include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/hash.h>
 
 #include "nvmev.h"
 #include "conv_ftl.h"
@@ -9,6 +11,14 @@
 void enqueue_writeback_io_req(int sqid, unsigned long long nsecs_target,
 			      struct buffer *write_buffer, unsigned int buffs_to_release);
 
+extern bool hotcold_separation;
+
+/* hybrid SLC/QLC hotness tracking, at the end of this file */
+static void init_hotness_tracking(struct conv_ftl *conv_ftl);
+static void remove_hotness_tracking(struct conv_ftl *conv_ftl);
+static void update_page_hotness(struct conv_ftl *conv_ftl, uint64_t lpn, uint32_t access_type);
+static void check_and_perform_migrations(struct conv_ftl *conv_ftl);
+
 static inline bool last_pg_in_wordline(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
@@ -133,6 +143,8 @@ static void init_lines(struct conv_ftl *conv_ftl)
 			.id = i,
 			.ipc = 0,
 			.vpc = 0,
+			.erase_cnt = 0,
+			.ruh = -1,
 			.pos = 0,
 			.entry = LIST_HEAD_INIT(lm->lines[i].entry),
 		};
@@ -145,6 +157,7 @@ static void init_lines(struct conv_ftl *conv_ftl)
 	NVMEV_ASSERT(lm->free_line_cnt == lm->tt_lines);
 	lm->victim_line_cnt = 0;
 	lm->full_line_cnt = 0;
+	lm->reclaiming = NULL;
 }
 
 //66f1
@@ -177,6 +190,8 @@ static void init_lines_DA(struct conv_ftl *conv_ftl)
 				.id = i,
 				.ipc = 0,
 				.vpc = 0,
+				.erase_cnt = 0,
+				.ruh = -1,
 				.pos = 0,
 				.entry = LIST_HEAD_INIT(lm->lines[i].entry),
 			};
@@ -229,7 +244,13 @@ static inline void check_addr(int a, int max)
 static struct line *get_next_free_line(struct conv_ftl *conv_ftl)
 {
 	struct line_mgmt *lm = &conv_ftl->lm;
-	struct line *curline = list_first_entry_or_null(&lm->free_line_list, struct line, entry);
+	struct line *curline;
+
+	/* the list is sorted by erase count, static WL takes the most worn line */
+	if (conv_ftl->in_wl && !list_empty(&lm->free_line_list))
+		curline = list_last_entry(&lm->free_line_list, struct line, entry);
+	else
+		curline = list_first_entry_or_null(&lm->free_line_list, struct line, entry);
 
 	if (!curline) {
 		NVMEV_ERROR("No free line left in VIRT !!!!\n");
@@ -263,9 +284,9 @@ static struct line *get_next_free_line_DA(struct conv_ftl *conv_ftl, uint32_t lu
 static struct write_pointer *__get_wp(struct conv_ftl *ftl, uint32_t io_type)
 {
 	if (io_type == USER_IO) {
-		return &ftl->wp;
+		return &ftl->ruhs[ftl->cur_ruh].wp;
 	} else if (io_type == GC_IO) {
-		return &ftl->gc_wp;
+		return ftl->in_wl ? &ftl->wl_wp : &ftl->gc_wp;
 	}
 
 	NVMEV_ASSERT(0);
@@ -285,6 +306,17 @@ static struct write_pointer *__get_wp_DA(struct conv_ftl *ftl, uint32_t io_type,
 }
 //66f1
 
+/* user lines are reclaim units of the current handle, GC lines mix every handle */
+static void set_line_ruh(struct conv_ftl *conv_ftl, struct line *line, uint32_t io_type)
+{
+	if (io_type == USER_IO) {
+		line->ruh = conv_ftl->cur_ruh;
+		conv_ftl->ruhs[line->ruh].ru_cnt++;
+	} else {
+		line->ruh = -1;
+	}
+}
+
 static void prepare_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 {
 	struct write_pointer *wp = __get_wp(conv_ftl, io_type);
@@ -292,6 +324,7 @@ static void prepare_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 
 	NVMEV_ASSERT(wp);
 	NVMEV_ASSERT(curline);
+	set_line_ruh(conv_ftl, curline, io_type);
 
 	/* wp->curline is always our next-to-write super-block */
 	*wp = (struct write_pointer) {
@@ -356,6 +389,13 @@ static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 		goto out;
 
 	wpp->pg -= spp->pgs_per_oneshotpg;
+	/* stripe oneshot pages over the planes of a LUN first for multi-plane program */
+	check_addr(wpp->pl, spp->pls_per_lun);
+	wpp->pl++;
+	if (wpp->pl != spp->pls_per_lun)
+		goto out;
+
+	wpp->pl = 0;
 	check_addr(wpp->ch, spp->nchs);
 	wpp->ch++;
 	if (wpp->ch != spp->nchs)
@@ -394,6 +434,7 @@ static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 	check_addr(wpp->blk, spp->blks_per_pl);
 	wpp->curline = get_next_free_line(conv_ftl);
 	NVMEV_DEBUG("wpp: got new clean line %d\n", wpp->curline->id);
+	set_line_ruh(conv_ftl, wpp->curline, io_type);
 
 	wpp->blk = wpp->curline->id;
 	check_addr(wpp->blk, spp->blks_per_pl);
@@ -402,7 +443,6 @@ static void advance_write_pointer(struct conv_ftl *conv_ftl, uint32_t io_type)
 	NVMEV_ASSERT(wpp->pg == 0);
 	NVMEV_ASSERT(wpp->lun == 0);
 	NVMEV_ASSERT(wpp->ch == 0);
-	/* TODO: assume # of pl_per_lun is 1, fix later */
 	NVMEV_ASSERT(wpp->pl == 0);
 out:
 	NVMEV_DEBUG("advanced wpp: ch:%d, lun:%d, pl:%d, blk:%d, pg:%d (curline %d)\n", wpp->ch,
@@ -416,11 +456,20 @@ static void advance_write_pointer_DA(struct conv_ftl *conv_ftl, uint32_t io_type
 	struct ssdparams *spp = &conv_ftl->ssd->sp;	
 	struct line_mgmt *lm = NULL;
 	struct write_pointer *wpp = NULL;
-
-#if (BASE_SSD == HYBRID_SSD)
-	/* For hybrid SSD, limit DA strategy to SLC channels only */
-	uint32_t max_slc_luns = spp->slc_channels * spp->slc_luns_per_ch;
-#endif
+	uint32_t pgs_per_blk, pgs_per_oneshotpg, blks_per_pl, nr_luns;
+
+	if (ssd_hybrid()) {
+		/* For hybrid SSD, limit DA strategy to SLC channels only */
+		pgs_per_blk = spp->slc_pgs_per_blk;
+		pgs_per_oneshotpg = spp->slc_pgs_per_oneshotpg;
+		blks_per_pl = spp->slc_blks_per_pl;
+		nr_luns = spp->slc_channels * spp->slc_luns_per_ch;
+	} else {
+		pgs_per_blk = spp->pgs_per_blk;
+		pgs_per_oneshotpg = spp->pgs_per_oneshotpg;
+		blks_per_pl = spp->blks_per_pl;
+		nr_luns = spp->nchs * spp->luns_per_ch;
+	}
 
 	lm = conv_ftl->lunlm+conv_ftl->lunpointer;
 	wpp = __get_wp_DA(conv_ftl, io_type, conv_ftl->lunpointer);
@@ -429,34 +478,25 @@ static void advance_write_pointer_DA(struct conv_ftl *conv_ftl, uint32_t io_type
 		    wpp->pl, wpp->blk, wpp->pg, conv_ftl->lunpointer);
 
 	
-#if (BASE_SSD == HYBRID_SSD)
-	/* Use SLC-specific parameters for page checking */
-	check_addr(wpp->pg, spp->slc_pgs_per_blk);
-#else
-	check_addr(wpp->pg, spp->pgs_per_blk);
-#endif
+	check_addr(wpp->pg, pgs_per_blk);
 	wpp->pg++; //map page 4k
-#if (BASE_SSD == HYBRID_SSD)
-	if ((wpp->pg % spp->slc_pgs_per_oneshotpg) != 0)
-#else
-	if ((wpp->pg % spp->pgs_per_oneshotpg) != 0)
-#endif
+	if ((wpp->pg % pgs_per_oneshotpg) != 0)
 	{
 		goto out;
 	}
-	NVMEV_DEBUG("page : %u, oneshotpg limit %d\n", spp->pgsz, spp->pgs_per_oneshotpg);
+	NVMEV_DEBUG("page : %u, oneshotpg limit %d\n", spp->pgsz, pgs_per_oneshotpg);
+
+	/* fill the same wordline on the other planes of this LUN before moving on */
+	wpp->pl++;
+	if (wpp->pl != spp->pls_per_lun) {
+		wpp->pg -= pgs_per_oneshotpg;
+		goto out;
+	}
+	wpp->pl = 0;
 
-#if (BASE_SSD == HYBRID_SSD)
-	if (wpp->pg == spp->slc_pgs_per_blk)
-#else
-	if (wpp->pg == spp->pgs_per_blk)
-#endif
+	if (wpp->pg == pgs_per_blk)
 	{//move to next blk
-#if (BASE_SSD == HYBRID_SSD)
-		NVMEV_DEBUG("SLC block limit, slc_pgs_per_blk = %d\n", spp->slc_pgs_per_blk);
-#else
-		NVMEV_DEBUG("block limit, pgs_per_blk = %d\n", spp->pgs_per_blk);
-#endif
+		NVMEV_DEBUG("block limit, pgs_per_blk = %d\n", pgs_per_blk);
 
 		if (wpp->curline->vpc == spp->pgs_per_lun_line) {
 			/* all pgs are still valid, move to full line list */
@@ -476,32 +516,19 @@ static void advance_write_pointer_DA(struct conv_ftl *conv_ftl, uint32_t io_type
 			lm->victim_line_cnt++;
 		}
 		/* current line is used up, pick another empty line */
-#if (BASE_SSD == HYBRID_SSD)
-		check_addr(wpp->blk, spp->slc_blks_per_pl);
-#else
-		check_addr(wpp->blk, spp->blks_per_pl);
-#endif
+		check_addr(wpp->blk, blks_per_pl);
 		wpp->curline = get_next_free_line_DA(conv_ftl, conv_ftl->lunpointer);
 		NVMEV_DEBUG("wpp: got new clean line %d\n", wpp->curline->id);
 		//NVMEV_ERROR("wpp: got new clean line %d\n", wpp->curline->id);
 
 		wpp->blk = wpp->curline->id;
-#if (BASE_SSD == HYBRID_SSD)
-		check_addr(wpp->blk, spp->slc_blks_per_pl);
-#else
-		check_addr(wpp->blk, spp->blks_per_pl);
-#endif
+		check_addr(wpp->blk, blks_per_pl);
 		wpp->pg =0;
 	}
 
 	//ch die interleaving - Modified for hybrid SSD
 	glun++;
-#if (BASE_SSD == HYBRID_SSD)
-	/* For hybrid SSD, only cycle through SLC LUNs */
-	if (glun != max_slc_luns)
-#else
-	if (glun != conv_ftl->ssd->sp.nchs * conv_ftl->ssd->sp.luns_per_ch)
-#endif
+	if (glun != nr_luns)
 	{
 		conv_ftl->lunpointer = glun; //next write lun 
 		lm = conv_ftl->lunlm+conv_ftl->lunpointer;
@@ -525,7 +552,6 @@ out:
 /* New function: QLC-specific write pointer advancement using traditional round-robin */
 static void advance_write_pointer_QLC(struct conv_ftl *conv_ftl, uint32_t io_type)
 {
-#if (BASE_SSD == HYBRID_SSD)
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct write_pointer *wpp = __get_wp(conv_ftl, io_type);
 
@@ -567,7 +593,6 @@ static void advance_write_pointer_QLC(struct conv_ftl *conv_ftl, uint32_t io_typ
 out:
 	NVMEV_DEBUG("QLC advanced wpp: ch:%d, lun:%d, pl:%d, blk:%d, pg:%d\n", wpp->ch, wpp->lun,
 		    wpp->pl, wpp->blk, wpp->pg);
-#endif
 }
 //66f1
 
@@ -578,19 +603,19 @@ static struct ppa get_new_page(struct conv_ftl *conv_ftl, uint32_t io_type)
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 
 	ppa.ppa = 0;
-#if (BASE_SSD == HYBRID_SSD)
-	/* For hybrid storage, this function is used for QLC migration */
-	/* QLC channels start after SLC channels (channels 2-7) */
-	ppa.g.ch = spp->slc_channels + (wp->ch % spp->qlc_channels);
-	ppa.g.lun = wp->lun % spp->qlc_luns_per_ch;
-	
-	/* Ensure we're in QLC channel range */
-	NVMEV_ASSERT(ppa.g.ch >= spp->slc_channels);
-	NVMEV_ASSERT(ppa.g.ch < (spp->slc_channels + spp->qlc_channels));
-#else
-	ppa.g.ch = wp->ch;
-	ppa.g.lun = wp->lun;
-#endif
+	if (ssd_hybrid()) {
+		/* For hybrid storage, this function is used for QLC migration */
+		/* QLC channels start after SLC channels (channels 2-7) */
+		ppa.g.ch = spp->slc_channels + (wp->ch % spp->qlc_channels);
+		ppa.g.lun = wp->lun % spp->qlc_luns_per_ch;
+
+		/* Ensure we're in QLC channel range */
+		NVMEV_ASSERT(ppa.g.ch >= spp->slc_channels);
+		NVMEV_ASSERT(ppa.g.ch < (spp->slc_channels + spp->qlc_channels));
+	} else {
+		ppa.g.ch = wp->ch;
+		ppa.g.lun = wp->lun;
+	}
 	ppa.g.pl = wp->pl;
 	ppa.g.blk = wp->blk;
 	ppa.g.pg = wp->pg;
@@ -605,23 +630,21 @@ static struct ppa get_new_page_DA(struct conv_ftl *conv_ftl, uint32_t io_type)
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 
 	ppa.ppa = 0;
-#if (BASE_SSD == HYBRID_SSD)
-	/* For hybrid SSD, DA strategy is used for SLC only (channels 0-1) */
-	ppa.g.ch = wp->ch % spp->slc_channels;  /* Ensure SLC channels only */
-	ppa.g.lun = wp->lun % spp->slc_luns_per_ch;
-	
-	/* Ensure we're in SLC channel range */
-	NVMEV_ASSERT(ppa.g.ch < spp->slc_channels);
-#else
-	ppa.g.ch = wp->ch;
-	ppa.g.lun = wp->lun;
-#endif
+	if (ssd_hybrid()) {
+		/* For hybrid SSD, DA strategy is used for SLC only (channels 0-1) */
+		ppa.g.ch = wp->ch % spp->slc_channels;  /* Ensure SLC channels only */
+		ppa.g.lun = wp->lun % spp->slc_luns_per_ch;
+
+		/* Ensure we're in SLC channel range */
+		NVMEV_ASSERT(ppa.g.ch < spp->slc_channels);
+	} else {
+		ppa.g.ch = wp->ch;
+		ppa.g.lun = wp->lun;
+	}
 	ppa.g.pg = wp->pg;
 	ppa.g.blk = wp->blk;
 	ppa.g.pl = wp->pl;
 
-	NVMEV_ASSERT(ppa.g.pl == 0);
-
 	return ppa;
 }
 
@@ -642,6 +665,78 @@ static void remove_maptbl(struct conv_ftl *conv_ftl)
 	vfree(conv_ftl->maptbl);
 }
 
+static void init_cmt(struct conv_ftl *conv_ftl)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct cmt *cmt = &conv_ftl->cmt;
+	uint64_t i;
+
+	cmt->nr_tpages = conv_ftl->cp.cmt_tpages;
+	cmt->nr_cached = 0;
+	cmt->hmb_tpages = 0;
+	cmt->nr_hmb = 0;
+	cmt->hmb_gen = 0;
+	cmt->hits = 0;
+	cmt->hmb_hits = 0;
+	cmt->misses = 0;
+	INIT_LIST_HEAD(&cmt->lru_list);
+	INIT_LIST_HEAD(&cmt->hmb_lru_list);
+
+	/* a device asking for a host memory buffer keeps its map there, not in DRAM */
+	if (cmt->nr_tpages == 0 && HMB_PREFERRED_SIZE == 0) {
+		cmt->entries = NULL;
+		cmt->gtd = NULL;
+		return;
+	}
+
+	cmt->ents_per_tpage = spp->pgsz / DFTL_MAP_ENTRY_SIZE;
+	cmt->tt_tpages = DIV_ROUND_UP(spp->tt_pgs, cmt->ents_per_tpage);
+	cmt->entries = vmalloc(sizeof(struct cmt_entry) * cmt->tt_tpages);
+	cmt->gtd = vmalloc(sizeof(struct ppa) * cmt->tt_tpages);
+	NVMEV_ASSERT(cmt->entries && cmt->gtd);
+
+	for (i = 0; i < cmt->tt_tpages; i++) {
+		cmt->entries[i].cached = false;
+		cmt->entries[i].dirty = false;
+		cmt->entries[i].in_hmb = false;
+		INIT_LIST_HEAD(&cmt->entries[i].lru);
+		cmt->gtd[i].ppa = UNMAPPED_PPA;
+	}
+
+	NVMEV_INFO("[%s] %u of %llu translation pages cached\n", __func__, cmt->nr_tpages,
+		   cmt->tt_tpages);
+}
+
+static void remove_cmt(struct conv_ftl *conv_ftl)
+{
+	struct cmt *cmt = &conv_ftl->cmt;
+
+	if (cmt->entries)
+		vfree(cmt->entries);
+	if (cmt->gtd)
+		vfree(cmt->gtd);
+}
+
+static void init_hotcold(struct conv_ftl *conv_ftl)
+{
+	struct hotcold_sketch *hcs = &conv_ftl->hcs;
+	size_t size;
+
+	hcs->width_bits = ilog2(HOTCOLD_SKETCH_WIDTH);
+	size = HOTCOLD_SKETCH_DEPTH * (1UL << hcs->width_bits);
+	hcs->counters = vmalloc(size);
+	NVMEV_ASSERT(hcs->counters);
+	memset(hcs->counters, 0, size);
+	hcs->nr_writes = 0;
+	hcs->hot_pgs = 0;
+	hcs->cold_pgs = 0;
+}
+
+static void remove_hotcold(struct conv_ftl *conv_ftl)
+{
+	vfree(conv_ftl->hcs.counters);
+}
+
 static void init_rmap(struct conv_ftl *conv_ftl)
 {
 	int i;
@@ -661,9 +756,21 @@ static void remove_rmap(struct conv_ftl *conv_ftl)
 static void conv_init_ftl(struct conv_ftl *conv_ftl, struct convparams *cpp, struct ssd *ssd)
 {
 	struct ssdparams *spp = &ssd->sp;
+	uint32_t i;
 
 	conv_ftl->ssd = ssd;
 	conv_ftl->cp = *cpp;
+	memset(&conv_ftl->stats, 0, sizeof(conv_ftl->stats));
+	conv_ftl->wl_erase_ticks = 0;
+
+	for (i = 0; i < READ_AHEAD_HISTORY; i++) {
+		conv_ftl->ra_streams[i].next_lpn = INVALID_LPN;
+		conv_ftl->ra_streams[i].pf_lpn = 0;
+		conv_ftl->ra_streams[i].seq_cnt = 0;
+	}
+	conv_ftl->ra_victim = 0;
+	conv_ftl->gc_wl.nsecs_ready = 0;
+	conv_ftl->gc_wl.nr_xfer_pgs = 0;
 
 	/* initialize maptbl */
 	init_maptbl(conv_ftl);
@@ -671,15 +778,17 @@ static void conv_init_ftl(struct conv_ftl *conv_ftl, struct convparams *cpp, str
 	/* initialize rmap */
 	init_rmap(conv_ftl);
 
-	/* initialize write pointer */
-	conv_ftl->wp = (struct write_pointer) {
-		.curline = NULL,
-		.ch = 0,
-		.lun = 0,
-		.pg = 0,
-		.blk = 0,
-		.pl = 0,
-	};
+	/* initialize cached mapping table */
+	init_cmt(conv_ftl);
+
+	init_hotcold(conv_ftl);
+
+	/* initialize write pointers, one per reclaim unit handle and one for cold data */
+	conv_ftl->ruhs = kcalloc(cpp->nr_ruhs + 1, sizeof(struct fdp_ruh), GFP_KERNEL);
+	NVMEV_ASSERT(conv_ftl->ruhs);
+	for (i = 0; i <= cpp->nr_ruhs; i++)
+		INIT_LIST_HEAD(&conv_ftl->ruhs[i].wb_pending);
+	conv_ftl->cur_ruh = 0;
 
 	conv_ftl->gc_wp = (struct write_pointer) {
 		.curline = NULL,
@@ -689,6 +798,8 @@ static void conv_init_ftl(struct conv_ftl *conv_ftl, struct convparams *cpp, str
 		.blk = 0,
 		.pl = 0,
 	};
+	conv_ftl->wl_wp = conv_ftl->gc_wp;
+	conv_ftl->in_wl = false;
 
 	/* initialize line management */
 	init_lines(conv_ftl);
@@ -696,17 +807,23 @@ static void conv_init_ftl(struct conv_ftl *conv_ftl, struct convparams *cpp, str
 	/* initialize write flow control */
 	init_write_flow_control(conv_ftl);
 
-#if (BASE_SSD == HYBRID_SSD)
-	/* Initialize hotness tracking */
-	init_hotness_tracking(conv_ftl);
-	
-	/* Initialize DA strategy for hybrid storage */
-	init_lines_DA(conv_ftl);
-	conv_ftl->lunpointer = 0;
-#endif
+	read_cache_init(&conv_ftl->rcache, cpp->read_cache_flashpgs, cpp->read_cache_policy);
 
-	/* prepare write pointer */
-	prepare_write_pointer(conv_ftl, USER_IO);
+	if (ssd_hybrid()) {
+		/* Initialize hotness tracking */
+		init_hotness_tracking(conv_ftl);
+
+		/* Initialize DA strategy for hybrid storage */
+		init_lines_DA(conv_ftl);
+		conv_ftl->lunpointer = 0;
+	}
+
+	/* prepare write pointer, the cold stream is opened on its first page */
+	for (i = 0; i < cpp->nr_ruhs; i++) {
+		conv_ftl->cur_ruh = i;
+		prepare_write_pointer(conv_ftl, USER_IO);
+	}
+	conv_ftl->cur_ruh = 0;
 	prepare_write_pointer(conv_ftl, GC_IO);
 }
 
@@ -714,23 +831,41 @@ static void conv_remove_ftl(struct conv_ftl *conv_ftl)
 {
 	remove_maptbl(conv_ftl);
 	remove_rmap(conv_ftl);
+	remove_cmt(conv_ftl);
+	remove_hotcold(conv_ftl);
 	remove_lines(conv_ftl);
+	kfree(conv_ftl->ruhs);
+	read_cache_remove(&conv_ftl->rcache);
 
-#if (BASE_SSD == HYBRID_SSD)
-	/* Remove hotness tracking */
-	remove_hotness_tracking(conv_ftl);
-	
-	/* Remove DA strategy resources */
-	remove_lines_DA(conv_ftl);
-#endif
+	if (ssd_hybrid()) {
+		/* Remove hotness tracking */
+		remove_hotness_tracking(conv_ftl);
+
+		/* Remove DA strategy resources */
+		remove_lines_DA(conv_ftl);
+	}
 }
 
-static void conv_init_params(struct convparams *cpp)
+static void conv_init_params(struct convparams *cpp, struct ssdparams *spp)
 {
 	cpp->op_area_pcent = OP_AREA_PERCENT;
-	cpp->gc_thres_lines = 2; /* Need only two lines.(host write, gc)*/
-	cpp->gc_thres_lines_high = 2; /* Need only two lines.(host write, gc)*/
+	cpp->nr_ruhs = FDP_NR_RUHS ? FDP_NR_RUHS : 1;
+	/* one open line per reclaim unit handle plus gc, the cold stream adds one once open */
+	cpp->gc_thres_lines = cpp->nr_ruhs + 1;
+	cpp->gc_thres_lines_high = cpp->nr_ruhs + 1;
 	cpp->enable_gc_delay = 1;
+	cpp->gc_copyback = GC_COPYBACK;
+	cpp->wl_thres_erase_cnt = WL_ERASE_CNT_THRESHOLD;
+	cpp->wl_check_interval = WL_CHECK_INTERVAL;
+	cpp->read_cache_flashpgs =
+		READ_CACHE_SIZE / (spp->pgs_per_flashpg * spp->pgsz) / SSD_PARTITIONS;
+	cpp->read_cache_policy = READ_CACHE_POLICY;
+	cpp->ra_depth = READ_AHEAD_DEPTH;
+	cpp->ra_trigger = READ_AHEAD_TRIGGER;
+	cpp->cmt_tpages = DFTL_CMT_SIZE / (spp->pgsz * SSD_PARTITIONS);
+	cpp->wb_high_wm = WB_HIGH_WATERMARK;
+	cpp->wb_low_wm = WB_LOW_WATERMARK;
+	cpp->subpage_merge = SUBPAGE_MERGE;
 	cpp->pba_pcent = (int)((1 + cpp->op_area_pcent) * 100);
 }
 
@@ -742,26 +877,29 @@ void conv_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *
 	struct conv_ftl *conv_ftls;
 	struct ssd *ssd;
 	uint32_t i;
+	int ret;
 	const uint32_t nr_parts = SSD_PARTITIONS;
 
 	ssd_init_params(&spp, size, nr_parts);
-	conv_init_params(&cpp);
+	ssd_set_lba_size(&spp, 1 << LBA_BITS);
+	conv_init_params(&cpp, &spp);
 
 	conv_ftls = kmalloc(sizeof(struct conv_ftl) * nr_parts, GFP_KERNEL);
 
 	for (i = 0; i < nr_parts; i++) {
 //66f1
-		conv_ftls[i].lunlm = kmalloc(sizeof(struct line_mgmt) * NAND_CHANNELS * LUNS_PER_NAND_CH, GFP_KERNEL);
-		conv_ftls[i].lunwp = kmalloc(sizeof(struct write_pointer) * NAND_CHANNELS * LUNS_PER_NAND_CH, GFP_KERNEL);
+		conv_ftls[i].lunlm = kmalloc(sizeof(struct line_mgmt) * spp.tt_luns, GFP_KERNEL);
+		conv_ftls[i].lunwp = kmalloc(sizeof(struct write_pointer) * spp.tt_luns, GFP_KERNEL);
 //66f1
 		ssd = kmalloc(sizeof(struct ssd), GFP_KERNEL);
-		ssd_init(ssd, &spp, cpu_nr_dispatcher);
+		ret = ssd_init(ssd, &spp, cpu_nr_dispatcher);
+		NVMEV_ASSERT(ret == 0);
 		conv_init_ftl(&conv_ftls[i], &cpp, ssd);
 	}
 
 	/* PCIe, Write buffer are shared by all instances*/
 	for (i = 1; i < nr_parts; i++) {
-		kfree(conv_ftls[i].ssd->pcie->perf_model);
+		ssd_remove_pcie(conv_ftls[i].ssd->pcie);
 		kfree(conv_ftls[i].ssd->pcie);
 		kfree(conv_ftls[i].ssd->write_buffer);
 
@@ -769,14 +907,19 @@ void conv_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *
 		conv_ftls[i].ssd->write_buffer = conv_ftls[0].ssd->write_buffer;
 	}
 
+	/* the write-back cache is namespace wide too, and keyed by namespace LPN */
+	buffer_init_cache(conv_ftls[0].ssd->write_buffer, spp.write_buffer_size / spp.pgsz);
+
 	ns->id = id;
 	ns->csi = NVME_CSI_NVM;
 	ns->nr_parts = nr_parts;
 	ns->ftls = (void *)conv_ftls;
 	ns->size = (uint64_t)((size * 100) / cpp.pba_pcent);
 	ns->mapped = mapped_addr;
+	ns->lba_shift = LBA_BITS;
 	/*register io command handler*/
 	ns->proc_io_cmd = conv_proc_nvme_io_cmd;
+	ns->format = conv_format;
 
 	NVMEV_INFO("FTL physical space: %lld, logical space: %lld (physical/logical * 100 = %d)\n",
 		   size, ns->size, cpp.pba_pcent);
@@ -790,6 +933,8 @@ void conv_remove_namespace(struct nvmev_ns *ns)
 	const uint32_t nr_parts = SSD_PARTITIONS;
 	uint32_t i;
 
+	buffer_remove_cache(conv_ftls[0].ssd->write_buffer);
+
 	/* PCIe, Write buffer are shared by all instances*/
 	for (i = 1; i < nr_parts; i++) {
 		/*
@@ -849,6 +994,19 @@ static inline bool mapped_ppa(struct ppa *ppa)
 	return !(ppa->ppa == UNMAPPED_PPA);
 }
 
+/* read cache key: the flash page a ppa belongs to */
+static inline uint64_t flashpg_key(struct conv_ftl *conv_ftl, struct ppa *ppa)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+
+	return ((uint64_t)ppa->h.blk_in_ssd << PAGE_BITS) | (ppa->g.pg / spp->pgs_per_flashpg);
+}
+
+static inline uint32_t flashpg_mask(struct conv_ftl *conv_ftl, struct ppa *ppa)
+{
+	return 1U << (ppa->g.pg % conv_ftl->ssd->sp.pgs_per_flashpg);
+}
+
 static inline uint32_t get_glun(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {	
 	return (ppa->g.lun * conv_ftl->ssd->sp.nchs + ppa->g.ch);
@@ -885,6 +1043,7 @@ static void mark_page_invalid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	pg = get_pg(conv_ftl->ssd, ppa);
 	NVMEV_ASSERT(pg->status == PG_VALID);
 	pg->status = PG_INVALID;
+	read_cache_invalidate(&conv_ftl->rcache, flashpg_key(conv_ftl, ppa));
 
 	/* update corresponding block status */
 	blk = get_blk(conv_ftl->ssd, ppa);
@@ -910,7 +1069,8 @@ static void mark_page_invalid(struct conv_ftl *conv_ftl, struct ppa *ppa)
 		line->vpc--;
 	}
 
-	if (was_full_line) {
+	/* a line being reclaimed is off the lists and freed once relocation is done */
+	if (was_full_line && line != lm->reclaiming) {
 		/* move line: "full" -> "victim" */
 		list_del_init(&line->entry);
 		lm->full_line_cnt--;
@@ -986,10 +1146,20 @@ static void mark_block_free(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	for (i = 0; i < spp->pgs_per_blk; i++) {
 		/* reset page status */
 		pg = &blk->pg[i];
-		NVMEV_ASSERT(pg->nsecs == spp->secs_per_pg);
+		NVMEV_ASSERT(pg->nsecs == spp->pgsz >> 9);
 		pg->status = PG_FREE;
 	}
 
+	/* the block is erased, drop whatever the read cache holds from it */
+	if (read_cache_enabled(&conv_ftl->rcache)) {
+		struct ppa fp = *ppa;
+
+		for (i = 0; i < spp->flashpgs_per_blk; i++) {
+			fp.g.pg = i * spp->pgs_per_flashpg;
+			read_cache_invalidate(&conv_ftl->rcache, flashpg_key(conv_ftl, &fp));
+		}
+	}
+
 	/* reset block status */
 	NVMEV_ASSERT(blk->npgs == spp->pgs_per_blk);
 	blk->ipc = 0;
@@ -997,6 +1167,269 @@ static void mark_block_free(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	blk->erase_cnt++;
 }
 
+/*
+ * Account one page placed through the GC write pointer. Its wordline is
+ * programmed once full, as soon as the data of all its pages is in: pages
+ * moved with copyback are already in the page register of the target plane,
+ * the rest cross the channel. Returns the program completion time, or
+ * @nsecs_ready while the wordline is still open.
+ */
+static uint64_t gc_program_page(struct conv_ftl *conv_ftl, struct ppa *ppa, uint64_t nsecs_ready,
+				bool copyback)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct gc_wordline *wl = &conv_ftl->gc_wl;
+	struct nand_cmd gcw = {
+		.type = GC_IO,
+		.cmd = NAND_WRITE,
+		.interleave_pci_dma = false,
+		.ppa = ppa,
+	};
+
+	wl->nsecs_ready = max(wl->nsecs_ready, nsecs_ready);
+	if (!copyback)
+		wl->nr_xfer_pgs++;
+
+	if (!last_pg_in_wordline(conv_ftl, ppa))
+		return nsecs_ready;
+
+	gcw.stime = wl->nsecs_ready;
+	gcw.xfer_size = spp->pgsz * wl->nr_xfer_pgs;
+	wl->nsecs_ready = 0;
+	wl->nr_xfer_pgs = 0;
+
+	return ssd_advance_nand(conv_ftl->ssd, &gcw);
+}
+
+/* write a translation page to flash through the GC write pointer */
+static uint64_t writeback_tpage(struct conv_ftl *conv_ftl, uint64_t tvpn, uint64_t nsecs_start)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct cmt *cmt = &conv_ftl->cmt;
+	struct ppa old_ppa = cmt->gtd[tvpn];
+	struct ppa new_ppa;
+
+	if (mapped_ppa(&old_ppa)) {
+		mark_page_invalid(conv_ftl, &old_ppa);
+		set_rmap_ent(conv_ftl, INVALID_LPN, &old_ppa);
+	}
+
+	if (ssd_hybrid()) {
+		/* the GC write pointer is QLC only, map updates are staged in SLC like data */
+		conv_ftl->lunpointer = tvpn % (spp->slc_channels * spp->slc_luns_per_ch);
+		new_ppa = get_new_page_DA(conv_ftl, USER_IO);
+	} else {
+		new_ppa = get_new_page(conv_ftl, GC_IO);
+	}
+	cmt->gtd[tvpn] = new_ppa;
+	set_rmap_ent(conv_ftl, TPAGE_LPN_FLAG | tvpn, &new_ppa);
+	mark_page_valid(conv_ftl, &new_ppa);
+	conv_ftl->stats.map_wr_pgs++;
+
+	if (ssd_hybrid()) {
+		struct nand_cmd mwr = {
+			.type = GC_IO,
+			.cmd = NAND_WRITE,
+			.stime = nsecs_start,
+			.xfer_size = spp->pgsz * spp->slc_pgs_per_oneshotpg,
+			.interleave_pci_dma = false,
+			.ppa = &new_ppa,
+		};
+
+		advance_write_pointer_DA(conv_ftl, USER_IO);
+		if ((new_ppa.g.pg % spp->slc_pgs_per_oneshotpg) != (spp->slc_pgs_per_oneshotpg - 1))
+			return nsecs_start;
+		return ssd_advance_nand(conv_ftl->ssd, &mwr);
+	}
+
+	advance_write_pointer(conv_ftl, GC_IO);
+	return gc_program_page(conv_ftl, &new_ppa, nsecs_start, false);
+}
+
+/* the controller reads host memory with a request TLP answered by a completion with data */
+static uint64_t hmb_read(struct conv_ftl *conv_ftl, uint64_t nsecs_start, uint64_t len)
+{
+	return ssd_advance_pcie(conv_ftl->ssd, nsecs_start, len, PCIE_H2D);
+}
+
+static uint64_t hmb_write(struct conv_ftl *conv_ftl, uint64_t nsecs_start, uint64_t len)
+{
+	return ssd_advance_pcie(conv_ftl->ssd, nsecs_start, len, PCIE_D2H);
+}
+
+static void __cmt_drop(struct cmt *cmt, struct cmt_entry *entry)
+{
+	list_del_init(&entry->lru);
+	if (entry->in_hmb)
+		cmt->nr_hmb--;
+	else
+		cmt->nr_cached--;
+	entry->cached = false;
+	entry->dirty = false;
+	entry->in_hmb = false;
+}
+
+/* evict the least recently used translation page of the HMB tier, fetching it back if dirty */
+static uint64_t hmb_evict(struct conv_ftl *conv_ftl, uint64_t nsecs_start)
+{
+	struct cmt *cmt = &conv_ftl->cmt;
+	struct cmt_entry *victim = list_last_entry(&cmt->hmb_lru_list, struct cmt_entry, lru);
+	uint64_t completed_time = nsecs_start;
+
+	if (victim->dirty) {
+		completed_time = hmb_read(conv_ftl, nsecs_start, conv_ftl->ssd->sp.pgsz);
+		writeback_tpage(conv_ftl, victim - cmt->entries, completed_time);
+	}
+	__cmt_drop(cmt, victim);
+
+	return completed_time;
+}
+
+/*
+ * Follow the host memory buffer the host handed over, or took back, since the
+ * last access. The buffer is shared evenly by every FTL instance. Dirty
+ * translation pages in a returned buffer are written back to flash.
+ */
+static uint64_t sync_hmb(struct conv_ftl *conv_ftl, uint64_t nsecs_start)
+{
+	struct nvmev_hmb *hmb = &nvmev_vdev->hmb;
+	struct cmt *cmt = &conv_ftl->cmt;
+	uint64_t completed_time = nsecs_start;
+
+	if (cmt->hmb_gen == hmb->gen)
+		return nsecs_start;
+
+	while (cmt->nr_hmb > 0)
+		completed_time = max(completed_time, hmb_evict(conv_ftl, nsecs_start));
+
+	cmt->hmb_gen = hmb->gen;
+	cmt->hmb_tpages = 0;
+	if (hmb->enabled)
+		cmt->hmb_tpages = min_t(uint64_t, cmt->tt_tpages,
+					div_u64(hmb->size, conv_ftl->ssd->sp.pgsz *
+								   nvmev_vdev->nr_ns * SSD_PARTITIONS));
+
+	NVMEV_INFO("[%s] %u translation pages in the host memory buffer\n", __func__,
+		   cmt->hmb_tpages);
+
+	return completed_time;
+}
+
+/* make room in controller DRAM, demoting the victim to the HMB tier if there is one */
+static uint64_t cmt_evict(struct conv_ftl *conv_ftl, uint64_t nsecs_start)
+{
+	struct cmt *cmt = &conv_ftl->cmt;
+	struct cmt_entry *victim = list_last_entry(&cmt->lru_list, struct cmt_entry, lru);
+	uint64_t tvpn = victim - cmt->entries;
+	uint64_t completed_time = nsecs_start;
+	bool dirty = victim->dirty;
+
+	if (cmt->hmb_tpages == 0) {
+		if (dirty)
+			writeback_tpage(conv_ftl, tvpn, nsecs_start);
+		__cmt_drop(cmt, victim);
+		return completed_time;
+	}
+
+	if (cmt->nr_hmb >= cmt->hmb_tpages)
+		completed_time = hmb_evict(conv_ftl, nsecs_start);
+
+	__cmt_drop(cmt, victim);
+	list_add(&victim->lru, &cmt->hmb_lru_list);
+	victim->cached = true;
+	victim->dirty = dirty;
+	victim->in_hmb = true;
+	cmt->nr_hmb++;
+
+	return hmb_write(conv_ftl, completed_time, conv_ftl->ssd->sp.pgsz);
+}
+
+/*
+ * Make the translation page holding @lpn resident in the cached mapping table
+ * and return when its mapping is available. Translation pages live in
+ * controller DRAM and, once the host provides a memory buffer, in a second
+ * LRU tier there that costs a PCIe round trip per lookup. A miss reads the
+ * translation page from flash into DRAM, or straight into the buffer when the
+ * controller has no DRAM for the map. Without a CMT the whole map is resident
+ * and lookups are free.
+ */
+static uint64_t cmt_access(struct conv_ftl *conv_ftl, uint64_t lpn, bool update,
+			   uint64_t nsecs_start)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct cmt *cmt = &conv_ftl->cmt;
+	struct cmt_entry *entry;
+	uint64_t tvpn;
+	uint64_t completed_time;
+
+	if (!cmt->entries)
+		return nsecs_start;
+
+	completed_time = sync_hmb(conv_ftl, nsecs_start);
+
+	tvpn = lpn / cmt->ents_per_tpage;
+	entry = &cmt->entries[tvpn];
+
+	if (entry->cached && !entry->in_hmb) {
+		cmt->hits++;
+		list_move(&entry->lru, &cmt->lru_list);
+		entry->dirty |= update;
+		return completed_time;
+	}
+
+	if (entry->cached) {
+		cmt->hmb_hits++;
+		list_move(&entry->lru, &cmt->hmb_lru_list);
+		entry->dirty |= update;
+		completed_time = hmb_read(conv_ftl, completed_time, DFTL_MAP_ENTRY_SIZE);
+		if (update)
+			completed_time = hmb_write(conv_ftl, completed_time, DFTL_MAP_ENTRY_SIZE);
+		return completed_time;
+	}
+
+	cmt->misses++;
+
+	/* a translation page never written back holds no mappings to read */
+	if (mapped_ppa(&cmt->gtd[tvpn])) {
+		struct nand_cmd tpr = {
+			.type = USER_IO,
+			.cmd = NAND_READ,
+			.stime = completed_time,
+			.xfer_size = spp->pgsz,
+			.interleave_pci_dma = false,
+			.ppa = &cmt->gtd[tvpn],
+		};
+		completed_time = ssd_advance_nand(conv_ftl->ssd, &tpr);
+		conv_ftl->stats.map_rd_pgs++;
+	}
+
+	if (cmt->nr_tpages > 0) {
+		if (cmt->nr_cached >= cmt->nr_tpages)
+			cmt_evict(conv_ftl, completed_time);
+
+		list_add(&entry->lru, &cmt->lru_list);
+		cmt->nr_cached++;
+	} else if (cmt->hmb_tpages > 0) {
+		if (cmt->nr_hmb >= cmt->hmb_tpages)
+			hmb_evict(conv_ftl, completed_time);
+
+		list_add(&entry->lru, &cmt->hmb_lru_list);
+		entry->in_hmb = true;
+		cmt->nr_hmb++;
+		completed_time = hmb_write(conv_ftl, completed_time, spp->pgsz);
+	} else {
+		/* nowhere to keep it, an update is written straight back */
+		if (update)
+			writeback_tpage(conv_ftl, tvpn, completed_time);
+		return completed_time;
+	}
+
+	entry->cached = true;
+	entry->dirty = update;
+
+	return completed_time;
+}
+
 static void gc_read_page(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
@@ -1015,18 +1448,25 @@ static void gc_read_page(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	}
 }
 
-/* move valid page data (already in DRAM) from victim line to a new page */
-static uint64_t gc_write_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
+/* move the mapping of a valid page of the victim line to a new page, returns the new page */
+static struct ppa gc_relocate_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
 {
-	struct ssdparams *spp = &conv_ftl->ssd->sp;
-	struct convparams *cpp = &conv_ftl->cp;
 	struct ppa new_ppa;
 	uint64_t lpn = get_rmap_ent(conv_ftl, old_ppa);
 
-	NVMEV_ASSERT(valid_lpn(conv_ftl, lpn));
+	/* bring in the translation page first, its eviction may use the GC write pointer */
+	if (!IS_TPAGE_LPN(lpn))
+		cmt_access(conv_ftl, lpn, true, 0);
+
 	new_ppa = get_new_page(conv_ftl, GC_IO);
-	/* update maptbl */
-	set_maptbl_ent(conv_ftl, lpn, &new_ppa);
+	if (IS_TPAGE_LPN(lpn)) {
+		/* relocated translation page, the directory follows it */
+		conv_ftl->cmt.gtd[lpn & ~TPAGE_LPN_FLAG] = new_ppa;
+	} else {
+		NVMEV_ASSERT(valid_lpn(conv_ftl, lpn));
+		/* update maptbl */
+		set_maptbl_ent(conv_ftl, lpn, &new_ppa);
+	}
 	/* update rmap */
 	set_rmap_ent(conv_ftl, lpn, &new_ppa);
 
@@ -1035,32 +1475,7 @@ static uint64_t gc_write_page(struct conv_ftl *conv_ftl, struct ppa *old_ppa)
 	/* need to advance the write pointer here */
 	advance_write_pointer(conv_ftl, GC_IO);
 
-	if (cpp->enable_gc_delay) {
-		struct nand_cmd gcw = {
-			.type = GC_IO,
-			.cmd = NAND_NOP,
-			.stime = 0,
-			.interleave_pci_dma = false,
-			.ppa = &new_ppa,
-		};
-		if (last_pg_in_wordline(conv_ftl, &new_ppa)) {
-			gcw.cmd = NAND_WRITE;
-			gcw.xfer_size = spp->pgsz * spp->pgs_per_oneshotpg;
-		}
-
-		ssd_advance_nand(conv_ftl->ssd, &gcw);
-	}
-
-	/* advance per-ch gc_endtime as well */
-#if 0
-	new_ch = get_ch(conv_ftl, &new_ppa);
-	new_ch->gc_endtime = new_ch->next_ch_avail_time;
-
-	new_lun = get_lun(conv_ftl, &new_ppa);
-	new_lun->gc_endtime = new_lun->next_lun_avail_time;
-#endif
-
-	return 0;
+	return new_ppa;
 }
 
 static struct line *select_victim_line(struct conv_ftl *conv_ftl, bool force)
@@ -1100,9 +1515,12 @@ static void clean_one_block(struct conv_ftl *conv_ftl, struct ppa *ppa)
 		/* there shouldn't be any free page in victim blocks */
 		NVMEV_ASSERT(pg_iter->status != PG_FREE);
 		if (pg_iter->status == PG_VALID) {
+			struct ppa new_ppa;
+
 			gc_read_page(conv_ftl, ppa);
-			/* delay the maptbl update until "write" happens */
-			gc_write_page(conv_ftl, ppa);
+			new_ppa = gc_relocate_page(conv_ftl, ppa);
+			if (conv_ftl->cp.enable_gc_delay)
+				gc_program_page(conv_ftl, &new_ppa, 0, false);
 			cnt++;
 		}
 	}
@@ -1110,140 +1528,245 @@ static void clean_one_block(struct conv_ftl *conv_ftl, struct ppa *ppa)
 	NVMEV_ASSERT(get_blk(conv_ftl->ssd, ppa)->vpc == cnt);
 }
 
-/* here ppa identifies the block we want to clean */
-static void clean_one_flashpg(struct conv_ftl *conv_ftl, struct ppa *ppa)
+static inline bool same_plane(struct ppa *ppa1, struct ppa *ppa2)
+{
+	return ppa1->g.ch == ppa2->g.ch && ppa1->g.lun == ppa2->g.lun && ppa1->g.pl == ppa2->g.pl;
+}
+
+/*
+ * Move the valid pages of one flash page. Their new places are known before
+ * the read is issued, so pages staying on the same plane can use copyback and
+ * skip the channel both ways. Returns when the data has been sensed.
+ */
+static uint64_t clean_one_flashpg(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	struct convparams *cpp = &conv_ftl->cp;
 	struct nand_page *pg_iter = NULL;
-	int cnt = 0, i = 0;
+	struct ppa new_ppas[NAND_MAX_FLASHPG_SIZE / KB(4)];
+	bool copyback[NAND_MAX_FLASHPG_SIZE / KB(4)];
+	int cnt = 0, nr_copyback = 0, i = 0;
 	uint64_t completed_time = 0;
 	struct ppa ppa_copy = *ppa;
+	struct nand_cmd gcr = {
+		.type = GC_IO,
+		.cmd = NAND_READ,
+		.stime = 0,
+		.interleave_pci_dma = false,
+		.ppa = ppa,
+	};
+
+	NVMEV_ASSERT(spp->pgs_per_flashpg <= ARRAY_SIZE(new_ppas));
 
 	for (i = 0; i < spp->pgs_per_flashpg; i++) {
 		pg_iter = get_pg(conv_ftl->ssd, &ppa_copy);
 		/* there shouldn't be any free page in victim blocks */
 		NVMEV_ASSERT(pg_iter->status != PG_FREE);
-		if (pg_iter->status == PG_VALID)
+		if (pg_iter->status == PG_VALID) {
+			new_ppas[cnt] = gc_relocate_page(conv_ftl, &ppa_copy);
+			copyback[cnt] = cpp->gc_copyback && same_plane(&ppa_copy, &new_ppas[cnt]);
+			nr_copyback += copyback[cnt];
 			cnt++;
+		}
 
 		ppa_copy.g.pg++;
 	}
 
-	ppa_copy = *ppa;
-
-	if (cnt <= 0)
-		return;
+	if (cnt <= 0 || !cpp->enable_gc_delay)
+		return 0;
 
-	if (cpp->enable_gc_delay) {
-		struct nand_cmd gcr = {
-			.type = GC_IO,
-			.cmd = NAND_READ,
-			.stime = 0,
-			.xfer_size = spp->pgsz * cnt,
-			.interleave_pci_dma = false,
-			.ppa = &ppa_copy,
-		};
-		completed_time = ssd_advance_nand(conv_ftl->ssd, &gcr);
-	}
+	conv_ftl->stats.gc_copyback_pgs += nr_copyback;
 
-	for (i = 0; i < spp->pgs_per_flashpg; i++) {
-		pg_iter = get_pg(conv_ftl->ssd, &ppa_copy);
+	/* copyback pages stay in the page register */
+	gcr.xfer_size = spp->pgsz * (cnt - nr_copyback);
+	completed_time = ssd_advance_nand(conv_ftl->ssd, &gcr);
 
-		/* there shouldn't be any free page in victim blocks */
-		if (pg_iter->status == PG_VALID) {
-			/* delay the maptbl update until "write" happens */
-			gc_write_page(conv_ftl, &ppa_copy);
-		}
+	/* programs wait for the data only, not for the rest of the victim */
+	for (i = 0; i < cnt; i++)
+		gc_program_page(conv_ftl, &new_ppas[i], completed_time, copyback[i]);
 
-		ppa_copy.g.pg++;
-	}
+	return completed_time;
 }
 
 static void mark_line_free(struct conv_ftl *conv_ftl, struct ppa *ppa)
 {
 	struct line_mgmt *lm = &conv_ftl->lm;
 	struct line *line = get_line(conv_ftl, ppa);
+	struct line *iter;
+
 	line->ipc = 0;
 	line->vpc = 0;
-	/* move this line to free line list */
-	list_add_tail(&line->entry, &lm->free_line_list);
+	line->erase_cnt++;
+	line->ruh = -1;
+
+	/*
+	 * move this line to free line list, which is kept sorted by erase count
+	 * so that get_next_free_line() hands out the least worn line first
+	 */
+	list_for_each_entry(iter, &lm->free_line_list, entry) {
+		if (iter->erase_cnt > line->erase_cnt)
+			break;
+	}
+	list_add_tail(&line->entry, &iter->entry);
 	lm->free_line_cnt++;
 }
 
-static int do_gc(struct conv_ftl *conv_ftl, bool force)
+/* relocate the valid pages of a line that is off every line list and erase it */
+static void reclaim_line(struct conv_ftl *conv_ftl, struct line *victim_line, bool for_wl)
 {
-	struct line *victim_line = NULL;
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct convparams *cpp = &conv_ftl->cp;
 	struct ppa ppa;
-	int flashpg;
+	int ch, lun, pl, flashpg;
 
-	victim_line = select_victim_line(conv_ftl, force);
-	if (!victim_line) {
-		return -1;
+	if (for_wl) {
+		conv_ftl->stats.wl_pgs += victim_line->vpc;
+		conv_ftl->stats.wl_lines++;
+	} else {
+		conv_ftl->stats.gc_pgs += victim_line->vpc;
+		conv_ftl->stats.gc_lines++;
+		if (victim_line->ruh >= 0) {
+			conv_ftl->ruhs[victim_line->ruh].gc_pgs += victim_line->vpc;
+			conv_ftl->ruhs[victim_line->ruh].gc_lines++;
+		}
 	}
 
+	ppa.ppa = 0;
 	ppa.g.blk = victim_line->id;
-	NVMEV_DEBUG("GC-ing line:%d,ipc=%d(%d),victim=%d,full=%d,free=%d\n", ppa.g.blk,
-		    victim_line->ipc, victim_line->vpc, conv_ftl->lm.victim_line_cnt,
-		    conv_ftl->lm.full_line_cnt, conv_ftl->lm.free_line_cnt);
-
-	conv_ftl->wfc.credits_to_refill = victim_line->ipc;
-
-	/* copy back valid data */
-	for (flashpg = 0; flashpg < spp->flashpgs_per_blk; flashpg++) {
-		int ch, lun;
-
-		ppa.g.pg = flashpg * spp->pgs_per_flashpg;
-		for (ch = 0; ch < spp->nchs; ch++) {
-			for (lun = 0; lun < spp->luns_per_ch; lun++) {
-				struct nand_lun *lunp;
-
-				ppa.g.ch = ch;
-				ppa.g.lun = lun;
-				ppa.g.pl = 0;
-				lunp = get_lun(conv_ftl->ssd, &ppa);
-				clean_one_flashpg(conv_ftl, &ppa);
-
-				if (flashpg == (spp->flashpgs_per_blk - 1)) {
-					struct convparams *cpp = &conv_ftl->cp;
-
-					mark_block_free(conv_ftl, &ppa);
-
-					if (cpp->enable_gc_delay) {
-						struct nand_cmd gce = {
-							.type = GC_IO,
-							.cmd = NAND_ERASE,
-							.stime = 0,
-							.interleave_pci_dma = false,
-							.ppa = &ppa,
-						};
-						ssd_advance_nand(conv_ftl->ssd, &gce);
-					}
+	conv_ftl->lm.reclaiming = victim_line;
+
+	/*
+	 * copy back valid data die by die: the reads of a die go back to back
+	 * from now on, every die in parallel, while the programs of what was
+	 * read land on whichever dies the GC write pointer stripes to
+	 */
+	for (ch = 0; ch < spp->nchs; ch++) {
+		for (lun = 0; lun < spp->luns_per_ch; lun++) {
+			struct nand_lun *lunp;
+			uint64_t nsecs_erased = 0;
+
+			ppa.g.ch = ch;
+			ppa.g.lun = lun;
+			lunp = get_lun(conv_ftl->ssd, &ppa);
+
+			for (flashpg = 0; flashpg < spp->flashpgs_per_blk; flashpg++) {
+				ppa.g.pg = flashpg * spp->pgs_per_flashpg;
+				for (pl = 0; pl < spp->pls_per_lun; pl++) {
+					ppa.g.pl = pl;
+					clean_one_flashpg(conv_ftl, &ppa);
+				}
+			}
 
-					lunp->gc_endtime = lunp->next_lun_avail_time;
+			for (pl = 0; pl < spp->pls_per_lun; pl++) {
+				ppa.g.pl = pl;
+				mark_block_free(conv_ftl, &ppa);
+
+				if (cpp->enable_gc_delay) {
+					struct nand_cmd gce = {
+						.type = GC_IO,
+						.cmd = NAND_ERASE,
+						.stime = 0,
+						.interleave_pci_dma = false,
+						.ppa = &ppa,
+					};
+					nsecs_erased = max(nsecs_erased,
+							   ssd_advance_nand(conv_ftl->ssd, &gce));
 				}
 			}
+
+			/* the erases may still wait in the die queue */
+			lunp->gc_endtime = max(READ_ONCE(lunp->next_lun_avail_time), nsecs_erased);
 		}
 	}
 
 	/* update line status */
+	conv_ftl->lm.reclaiming = NULL;
 	mark_line_free(conv_ftl, &ppa);
-
-	return 0;
 }
 
-static void forground_gc(struct conv_ftl *conv_ftl)
+/*
+ * Static wear leveling: lines on the full list hold data that has never been
+ * overwritten since it was programmed. When the least worn of them lags the
+ * most worn line by more than the threshold, move its data away so that the
+ * line returns to the free pool and takes hot writes.
+ */
+static void check_static_wl(struct conv_ftl *conv_ftl)
 {
-	if (should_gc_high(conv_ftl)) {
-		NVMEV_DEBUG("should_gc_high passed");
-		NVMEV_ERROR("should_gc_high passed, FGGC");
-		/* perform GC here until !should_gc(conv_ftl) */
-		do_gc(conv_ftl, true);
-	}
-}
-
-static bool is_same_flash_page(struct conv_ftl *conv_ftl, struct ppa ppa1, struct ppa ppa2)
+	struct convparams *cpp = &conv_ftl->cp;
+	struct line_mgmt *lm = &conv_ftl->lm;
+	struct line *line, *cold_line = NULL;
+	int max_erase_cnt = 0;
+	int i;
+
+	if (cpp->wl_thres_erase_cnt == 0)
+		return;
+
+	if (++conv_ftl->wl_erase_ticks < cpp->wl_check_interval)
+		return;
+	conv_ftl->wl_erase_ticks = 0;
+
+	/* relocation needs a free line of its own */
+	if (lm->free_line_cnt <= cpp->gc_thres_lines)
+		return;
+
+	for (i = 0; i < lm->tt_lines; i++)
+		max_erase_cnt = max(max_erase_cnt, lm->lines[i].erase_cnt);
+
+	list_for_each_entry(line, &lm->full_line_list, entry) {
+		if (!cold_line || line->erase_cnt < cold_line->erase_cnt)
+			cold_line = line;
+	}
+
+	if (!cold_line || (max_erase_cnt - cold_line->erase_cnt) <= cpp->wl_thres_erase_cnt)
+		return;
+
+	NVMEV_DEBUG("WL-ing line:%d,erase_cnt=%d,max=%d\n", cold_line->id, cold_line->erase_cnt,
+		    max_erase_cnt);
+
+	list_del_init(&cold_line->entry);
+	lm->full_line_cnt--;
+
+	/* cold data goes to worn lines, not to the fresh line GC is filling */
+	conv_ftl->in_wl = true;
+	if (!conv_ftl->wl_wp.curline)
+		prepare_write_pointer(conv_ftl, GC_IO);
+	reclaim_line(conv_ftl, cold_line, true);
+	conv_ftl->in_wl = false;
+}
+
+static int do_gc(struct conv_ftl *conv_ftl, bool force)
+{
+	struct line *victim_line = NULL;
+
+	victim_line = select_victim_line(conv_ftl, force);
+	if (!victim_line) {
+		return -1;
+	}
+
+	NVMEV_DEBUG("GC-ing line:%d,ipc=%d(%d),victim=%d,full=%d,free=%d\n", victim_line->id,
+		    victim_line->ipc, victim_line->vpc, conv_ftl->lm.victim_line_cnt,
+		    conv_ftl->lm.full_line_cnt, conv_ftl->lm.free_line_cnt);
+
+	conv_ftl->wfc.credits_to_refill = victim_line->ipc;
+
+	reclaim_line(conv_ftl, victim_line, false);
+
+	check_static_wl(conv_ftl);
+
+	return 0;
+}
+
+static void forground_gc(struct conv_ftl *conv_ftl)
+{
+	if (should_gc_high(conv_ftl)) {
+		NVMEV_DEBUG("should_gc_high passed");
+		NVMEV_ERROR("should_gc_high passed, FGGC");
+		/* perform GC here until !should_gc(conv_ftl) */
+		do_gc(conv_ftl, true);
+	}
+}
+
+static bool is_same_flash_page(struct conv_ftl *conv_ftl, struct ppa ppa1, struct ppa ppa2)
 {
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
 	uint32_t ppa1_page = ppa1.g.pg / spp->pgs_per_flashpg;
@@ -1252,6 +1775,120 @@ static bool is_same_flash_page(struct conv_ftl *conv_ftl, struct ppa ppa1, struc
 	return (ppa1.h.blk_in_ssd == ppa2.h.blk_in_ssd) && (ppa1_page == ppa2_page);
 }
 
+static inline uint32_t full_sec_mask(struct ssdparams *spp)
+{
+	return spp->secs_per_pg >= 32 ? U32_MAX : (1U << spp->secs_per_pg) - 1;
+}
+
+/* sectors of mapping page @lpn covered by [@lba, @lba + @nr_lba) */
+static uint32_t covered_sec_mask(struct ssdparams *spp, uint64_t lpn, uint64_t lba,
+				 uint64_t nr_lba)
+{
+	uint64_t first = max(lba, lpn * spp->secs_per_pg);
+	uint64_t last = min(lba + nr_lba, (lpn + 1) * spp->secs_per_pg);
+	uint32_t nr_secs = last - first;
+	uint32_t mask = nr_secs >= 32 ? U32_MAX : (1U << nr_secs) - 1;
+
+	return mask << (first - lpn * spp->secs_per_pg);
+}
+
+/* read the pages in pg_mask of one flash page, from the controller read cache if possible */
+static uint64_t read_flashpg(struct conv_ftl *conv_ftl, struct nand_cmd *srd, uint32_t pg_mask)
+{
+	uint64_t key = flashpg_key(conv_ftl, srd->ppa);
+	struct read_cache_entry *e;
+	uint64_t completed_time;
+
+	/* a prefetch may still be on its way in */
+	e = read_cache_lookup(&conv_ftl->rcache, key, pg_mask);
+	if (e)
+		return ssd_advance_pcie(conv_ftl->ssd, max(srd->stime, e->nsecs_ready),
+					srd->xfer_size, PCIE_D2H);
+
+	completed_time = ssd_advance_nand(conv_ftl->ssd, srd);
+	read_cache_insert(&conv_ftl->rcache, key, pg_mask);
+
+	return completed_time;
+}
+
+/*
+ * Sense the whole flash page holding @lpn into the read cache, if its LUN has
+ * nothing to do at @nsecs_start. Host I/O is never queued behind a prefetch.
+ */
+static void prefetch_page(struct conv_ftl *conv_ftl, uint64_t lpn, uint64_t nsecs_start)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct ppa ppa = get_maptbl_ent(conv_ftl, lpn);
+	uint32_t pg_mask = (1U << spp->pgs_per_flashpg) - 1;
+	uint64_t key;
+	struct nand_cmd srd = {
+		.type = USER_IO,
+		.cmd = NAND_READ,
+		.stime = nsecs_start,
+		.xfer_size = spp->pgsz * spp->pgs_per_flashpg,
+		.interleave_pci_dma = false,
+		.ppa = &ppa,
+	};
+
+	if (!mapped_ppa(&ppa) || !valid_ppa(conv_ftl, &ppa))
+		return;
+
+	key = flashpg_key(conv_ftl, &ppa);
+	if (read_cache_contains(&conv_ftl->rcache, key, flashpg_mask(conv_ftl, &ppa)))
+		return;
+
+	if (READ_ONCE(get_lun(conv_ftl->ssd, &ppa)->next_lun_avail_time) > nsecs_start)
+		return;
+
+	read_cache_prefetch(&conv_ftl->rcache, key, pg_mask, ssd_advance_nand(conv_ftl->ssd, &srd));
+}
+
+/*
+ * Track the read streams of the namespace and keep ra_depth pages prefetched
+ * ahead of the ones that went sequential.
+ */
+static void read_ahead(struct nvmev_ns *ns, uint64_t start_lpn, uint64_t end_lpn,
+		       uint64_t nsecs_start)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl = &conv_ftls[0];
+	struct convparams *cpp = &conv_ftl->cp;
+	uint64_t max_lpn = conv_ftl->ssd->sp.tt_pgs * ns->nr_parts - 1;
+	struct ra_stream *s = NULL;
+	uint64_t lpn, pf_end;
+	uint32_t i;
+
+	if (cpp->ra_depth == 0 || !read_cache_enabled(&conv_ftl->rcache))
+		return;
+
+	for (i = 0; i < READ_AHEAD_HISTORY && !s; i++) {
+		if (conv_ftl->ra_streams[i].next_lpn == start_lpn)
+			s = &conv_ftl->ra_streams[i];
+	}
+
+	if (s) {
+		s->seq_cnt++;
+	} else {
+		s = &conv_ftl->ra_streams[conv_ftl->ra_victim];
+		conv_ftl->ra_victim = (conv_ftl->ra_victim + 1) % READ_AHEAD_HISTORY;
+		s->seq_cnt = 0;
+		s->pf_lpn = end_lpn;
+	}
+	s->next_lpn = end_lpn + 1;
+
+	if (s->seq_cnt < cpp->ra_trigger)
+		return;
+
+	pf_end = min(end_lpn + cpp->ra_depth, max_lpn);
+	for (lpn = max(s->pf_lpn, end_lpn) + 1; lpn <= pf_end; lpn++) {
+		/* the write-back cache is keyed by namespace LPN */
+		if (buffer_lookup(conv_ftl->ssd->write_buffer, lpn))
+			continue;
+		prefetch_page(&conv_ftls[lpn % ns->nr_parts], lpn / ns->nr_parts, nsecs_start);
+	}
+	s->pf_lpn = max(s->pf_lpn, pf_end);
+}
+
 static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
 	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
@@ -1268,7 +1905,11 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 	uint64_t nsecs_start = req->nsecs_start;
 	uint64_t nsecs_completed, nsecs_latest = nsecs_start;
 	uint32_t xfer_size, i;
+	uint64_t nsecs_map;
+	uint32_t pg_mask;
+	uint32_t nr_buffered = 0;
 	uint32_t nr_parts = ns->nr_parts;
+	uint32_t full = full_sec_mask(spp);
 
 	struct ppa prev_ppa;
 	struct nand_cmd srd = {
@@ -1286,23 +1927,41 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 		return false;
 	}
 
-	if (LBA_TO_BYTE(nr_lba) <= (KB(4) * nr_parts)) {
-		srd.stime += spp->fw_4kb_rd_lat;
+	if (NS_LBA_TO_BYTE(ns, nr_lba) <= (KB(4) * nr_parts)) {
+		srd.stime += ssd_lat(conv_ftl->ssd, fw_4kb_rd_lat);
 	} else {
-		srd.stime += spp->fw_rd_lat;
+		srd.stime += ssd_lat(conv_ftl->ssd, fw_rd_lat);
+	}
+	nsecs_map = srd.stime;
+
+	/* the translation pages must be resident before the data can be located */
+	for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
+		conv_ftl = &conv_ftls[lpn % nr_parts];
+		nsecs_map = max(nsecs_map, cmt_access(conv_ftl, lpn / nr_parts, false, srd.stime));
 	}
+	srd.stime = nsecs_map;
 
 	for (i = 0; (i < nr_parts) && (start_lpn <= end_lpn); i++, start_lpn++) {
 		conv_ftl = &conv_ftls[start_lpn % nr_parts];
 		xfer_size = 0;
+		pg_mask = 0;
 		prev_ppa = get_maptbl_ent(conv_ftl, start_lpn / nr_parts);
 
 		/* normal IO read path */
 		for (lpn = start_lpn; lpn <= end_lpn; lpn += nr_parts) {
 			uint64_t local_lpn;
 			struct ppa cur_ppa;
+			struct wb_entry *wbe;
 
 			local_lpn = lpn / nr_parts;
+
+			/* still in the write-back cache, no flash access needed */
+			wbe = buffer_lookup(conv_ftl->ssd->write_buffer, lpn);
+			if (wbe && (wbe->sec_mask & full) == full) {
+				nr_buffered++;
+				continue;
+			}
+
 			cur_ppa = get_maptbl_ent(conv_ftl, local_lpn);
 			if (!mapped_ppa(&cur_ppa) || !valid_ppa(conv_ftl, &cur_ppa)) {
 				NVMEV_DEBUG("lpn 0x%llx not mapped to valid ppa\n", local_lpn);
@@ -1316,17 +1975,19 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 			if (mapped_ppa(&prev_ppa) &&
 			    is_same_flash_page(conv_ftl, cur_ppa, prev_ppa)) {
 				xfer_size += spp->pgsz;
+				pg_mask |= flashpg_mask(conv_ftl, &cur_ppa);
 				continue;
 			}
 
 			if (xfer_size > 0) {
 				srd.xfer_size = xfer_size;
 				srd.ppa = &prev_ppa;
-				nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &srd);
+				nsecs_completed = read_flashpg(conv_ftl, &srd, pg_mask);
 				nsecs_latest = max(nsecs_completed, nsecs_latest);
 			}
 
 			xfer_size = spp->pgsz;
+			pg_mask = flashpg_mask(conv_ftl, &cur_ppa);
 			prev_ppa = cur_ppa;
 		}
 
@@ -1334,115 +1995,641 @@ static bool conv_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 		if (xfer_size > 0) {
 			srd.xfer_size = xfer_size;
 			srd.ppa = &prev_ppa;
-			nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &srd);
+			nsecs_completed = read_flashpg(conv_ftl, &srd, pg_mask);
 			nsecs_latest = max(nsecs_completed, nsecs_latest);
 		}
 	}
 
+	if (nr_buffered > 0) {
+		nsecs_completed = ssd_advance_pcie(conv_ftls[0].ssd, srd.stime,
+						   nr_buffered * spp->pgsz, PCIE_D2H);
+		nsecs_latest = max(nsecs_completed, nsecs_latest);
+	}
+
+	read_ahead(ns, lba / spp->secs_per_pg, end_lpn, srd.stime);
+
 	ret->nsecs_target = nsecs_latest;
 	ret->status = NVME_SC_SUCCESS;
 	return true;
 }
 
-static bool conv_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+/*
+ * Write one mapping page to flash through the user write pointer. The NAND
+ * program is issued once its wordline is filled; returns its completion time,
+ * or 0 if the wordline is still open.
+ */
+static uint64_t write_one_page(struct conv_ftl *conv_ftl, uint64_t lpn, uint64_t nsecs_start)
 {
-	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
-	struct conv_ftl *conv_ftl = &conv_ftls[0];
 	struct ssdparams *spp = &conv_ftl->ssd->sp;
-	struct buffer *wbuf = conv_ftl->ssd->write_buffer;
-
-	struct nvme_command *cmd = req->cmd;
-	struct nvme_rw_command *rw = (struct nvme_rw_command *)cmd;
-	uint64_t lba = rw->slba;
-	uint64_t nsecs_start = __get_wallclock();
-	uint64_t nsecs_completed;
-	uint64_t lpn;
-	uint64_t remaining_lpns;
-	uint64_t cur_lpn;
-	uint64_t nsecs_used = 0;
-	uint64_t completed_time = nsecs_start;
+	uint64_t completed_time = 0;
+	uint32_t pgs_per_oneshotpg;
 	struct ppa ppa;
 	struct nand_cmd swr = {
 		.type = USER_IO,
 		.cmd = NAND_WRITE,
 		.stime = nsecs_start,
-		.interleave_pci_dma = true,
+		.interleave_pci_dma = false,
 		.ppa = &ppa,
 	};
 
-	NVMEV_DEBUG("%s: write request. req->status = %d, req->nsecs_start = %llu, "
-		    "req->nsecs_budget = %llu\n",
-		    __func__, req->status, req->nsecs_start, req->nsecs_budget);
+	/* the mapping update needs the translation page resident */
+	swr.stime = cmt_access(conv_ftl, lpn, true, nsecs_start);
 
-	NVMEV_DEBUG("%s: lba = %llu, length = %d\n", __func__, lba, rw->length);
+	/* invalidate the old copy */
+	ppa = get_maptbl_ent(conv_ftl, lpn);
+	if (mapped_ppa(&ppa)) {
+		mark_page_invalid(conv_ftl, &ppa);
+		set_rmap_ent(conv_ftl, INVALID_LPN, &ppa);
+	}
 
-	/* write buffer is full, schedule writeback */
-	if (buffer_allocate(wbuf, (rw->length + 1) << 9) == 0) {
-		enqueue_writeback_io_req(req->sqid, completed_time, wbuf, 0);
-		ret->nsecs_target = completed_time;
-		return true;
+	if (ssd_hybrid()) {
+		/* new writes always land in SLC, spread over the SLC LUNs by lpn */
+		conv_ftl->lunpointer = lpn % (spp->slc_channels * spp->slc_luns_per_ch);
+		ppa = get_new_page_DA(conv_ftl, USER_IO);
+		pgs_per_oneshotpg = spp->slc_pgs_per_oneshotpg;
+	} else {
+		ppa = get_new_page(conv_ftl, USER_IO);
+		pgs_per_oneshotpg = spp->pgs_per_oneshotpg;
 	}
 
-	/* write buffer is not full, schedule write */
-	lpn = lba / spp->secs_per_pg;
-	remaining_lpns = ((rw->length + 1) << 9) / spp->pgsz;
+	/* update maptbl */
+	set_maptbl_ent(conv_ftl, lpn, &ppa);
+	/* update rmap */
+	set_rmap_ent(conv_ftl, lpn, &ppa);
 
-	NVMEV_DEBUG("%s: lpn = %llu, remaining_lpns = %llu\n", __func__, lpn, remaining_lpns);
+	mark_page_valid(conv_ftl, &ppa);
+	conv_ftl->stats.user_pgs++;
+	conv_ftl->ruhs[conv_ftl->cur_ruh].host_pgs++;
 
-	while (remaining_lpns > 0) {
-		cur_lpn = lpn;
-		check_and_refill_write_credit(conv_ftl);
+	/* update write pointer */
+	if (ssd_hybrid())
+		advance_write_pointer_DA(conv_ftl, USER_IO);
+	else
+		advance_write_pointer(conv_ftl, USER_IO);
 
-#if (BASE_SSD == HYBRID_SSD)
-		/* For hybrid storage, all new writes go to SLC initially */
-		/* Update page hotness on write */
-		update_page_hotness(conv_ftl, cur_lpn, ACCESS_WRITE);
-		
-		/* Check for migrations */
-		check_and_perform_migrations(conv_ftl);
-		
-		/* For new writes, always use SLC initially with DA strategy and lunpointer */
-		/* Only SLC writes use lunpointer, QLC uses pure traditional strategy */
-		conv_ftl->lunpointer = cur_lpn % (spp->slc_channels * spp->slc_luns_per_ch);
-		
-		/* Use DA strategy to get SLC page */
-		ppa = get_new_page_DA(conv_ftl, USER_IO);
-#else
+	if ((ppa.g.pg % pgs_per_oneshotpg) == (pgs_per_oneshotpg - 1)) {
+		swr.xfer_size = spp->pgsz * pgs_per_oneshotpg;
+		completed_time = ssd_advance_nand(conv_ftl->ssd, &swr);
+	}
+
+	consume_write_credit(conv_ftl);
+	check_and_refill_write_credit(conv_ftl);
+
+	return completed_time;
+}
+
+/*
+ * Read the old copy of a partially written page so the rest of it can be
+ * merged in. Nothing to read if the page was never written, and the flash
+ * page may still be in the read cache.
+ */
+static uint64_t rmw_read(struct conv_ftl *conv_ftl, uint64_t lpn, uint64_t nsecs_start)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct ppa ppa = get_maptbl_ent(conv_ftl, lpn);
+	struct read_cache_entry *e;
+	struct nand_cmd srd = {
+		.type = USER_IO,
+		.cmd = NAND_READ,
+		.stime = nsecs_start,
+		.xfer_size = spp->pgsz,
+		.interleave_pci_dma = false,
+		.ppa = &ppa,
+	};
+
+	if (!mapped_ppa(&ppa) || !valid_ppa(conv_ftl, &ppa))
+		return nsecs_start;
+
+	conv_ftl->stats.rmw_reads++;
+
+	e = read_cache_lookup(&conv_ftl->rcache, flashpg_key(conv_ftl, &ppa),
+			      flashpg_mask(conv_ftl, &ppa));
+	if (e)
+		return max(nsecs_start, e->nsecs_ready);
+
+	return ssd_advance_nand(conv_ftl->ssd, &srd);
+}
+
+/*
+ * Program the oneshot pages the user write pointers are in the middle of, so
+ * that everything flushed so far is durable. The wordline is charged again
+ * once it fills up.
+ */
+static uint64_t program_open_wordline(struct conv_ftl *conv_ftl, uint64_t nsecs_start)
+{
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	uint64_t nsecs_completed, nsecs_latest = nsecs_start;
+	uint32_t i;
+
+	/* SLC oneshot pages take a single mapping page and never stay open */
+	if (ssd_hybrid())
+		return nsecs_start;
+
+	for (i = 0; i <= conv_ftl->cp.nr_ruhs; i++) {
+		struct ppa ppa;
+		uint32_t nr_open;
+		struct nand_cmd swr = {
+			.type = USER_IO,
+			.cmd = NAND_WRITE,
+			.stime = nsecs_start,
+			.interleave_pci_dma = false,
+			.ppa = &ppa,
+		};
+
+		if (!conv_ftl->ruhs[i].wp.curline)
+			continue;
+
+		conv_ftl->cur_ruh = i;
 		ppa = get_new_page(conv_ftl, USER_IO);
-#endif
+		nr_open = ppa.g.pg % spp->pgs_per_oneshotpg;
+		if (nr_open == 0)
+			continue;
+
+		swr.xfer_size = spp->pgsz * nr_open;
+		nsecs_completed = ssd_advance_nand(conv_ftl->ssd, &swr);
+		buffer_clean_pending(conv_ftl->ssd->write_buffer, &conv_ftl->ruhs[i].wb_pending,
+				     nsecs_completed);
+		nsecs_latest = max(nsecs_latest, nsecs_completed);
+	}
 
-		swr.stime = completed_time;
-		swr.xfer_size = spp->pgsz;
+	return nsecs_latest;
+}
 
-		/* advance ssd status by one page write */
-		completed_time = ssd_advance_nand(conv_ftl->ssd, &swr);
-		completed_time = ssd_advance_write_buffer(conv_ftl->ssd, completed_time, spp->pgsz);
+/* oldest dirty page of partition @part written back through @ruh */
+static struct wb_entry *oldest_dirty(struct buffer *wbuf, uint32_t part, uint32_t nr_parts,
+				     uint32_t ruh)
+{
+	struct wb_entry *e;
 
-		/* update maptbl */
-		set_maptbl_ent(conv_ftl, cur_lpn, &ppa);
-		/* update rmap */
-		set_rmap_ent(conv_ftl, cur_lpn, &ppa);
+	list_for_each_entry(e, &wbuf->dirty_list, list) {
+		if (e->lpn % nr_parts == part && e->ruh == ruh)
+			return e;
+	}
+	return NULL;
+}
 
-#if (BASE_SSD == HYBRID_SSD)
-		/* For hybrid storage, use DA strategy for SLC writes with lunpointer */
-		/* SLC uses DA strategy, QLC uses pure traditional strategy */
-		advance_write_pointer_DA(conv_ftl, USER_IO);
-#else
-		/* update write pointer */
-		advance_write_pointer(conv_ftl, USER_IO);
-#endif
+/*
+ * Write back one oneshot page worth of dirty data. The oldest dirty page is
+ * taken first and its dirty successors in the same partition join it, the
+ * rest of the oneshot is filled with the next oldest dirty pages of that
+ * partition and handle. The cache is shared by the partitions, and the
+ * namespace LPNs of a partition are nr_parts apart.
+ *
+ * Pages that end up in a wordline still open keep their slot until it is
+ * programmed. When nothing is dirty but slots are still wanted, the open
+ * wordlines are programmed to free them.
+ */
+static uint64_t flush_oneshot(struct nvmev_ns *ns, uint64_t nsecs_start)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct ssdparams *spp = &conv_ftls[0].ssd->sp;
+	struct buffer *wbuf = conv_ftls[0].ssd->write_buffer;
+	struct wb_entry *batch[NAND_MAX_ONESHOTPG_SIZE / KB(4)];
+	struct conv_ftl *conv_ftl;
+	struct wb_entry *e;
+	uint64_t nsecs_completed, nsecs_latest = nsecs_start;
+	uint64_t nsecs_ready = nsecs_start;
+	uint32_t nr_parts = ns->nr_parts;
+	uint32_t nr_batch = 0, max_batch, part, ruh, i;
+
+	e = list_first_entry_or_null(&wbuf->dirty_list, struct wb_entry, list);
+	if (!e) {
+		for (i = 0; i < nr_parts; i++)
+			nsecs_latest = max(nsecs_latest,
+					   program_open_wordline(&conv_ftls[i], nsecs_start));
+		return nsecs_latest;
+	}
+
+	if (ssd_hybrid())
+		max_batch = spp->slc_pgs_per_oneshotpg;
+	else
+		max_batch = spp->pgs_per_oneshotpg;
+	max_batch = min_t(uint32_t, max_batch, ARRAY_SIZE(batch));
+
+	part = e->lpn % nr_parts;
+	ruh = e->ruh;
+	conv_ftl = &conv_ftls[part];
+
+	while (e && nr_batch < max_batch) {
+		batch[nr_batch++] = e;
+		list_del_init(&e->list);
+		e = buffer_lookup(wbuf, e->lpn + nr_parts);
+		/* entries already in the batch are off the dirty list */
+		if (!e || !e->dirty || list_empty(&e->list) || e->ruh != ruh)
+			e = oldest_dirty(wbuf, part, nr_parts, ruh);
+	}
+
+	conv_ftl->cur_ruh = ruh;
+	for (i = 0; i < nr_batch; i++) {
+		uint64_t local_lpn = batch[i]->lpn / nr_parts;
+		uint32_t full = full_sec_mask(spp);
 
-		/* update per-io status */
-		--remaining_lpns;
-		++lpn;
+		/* pages still partial at write-back need their old data first */
+		if ((batch[i]->sec_mask & full) != full)
+			nsecs_ready = max(nsecs_ready, rmw_read(conv_ftl, local_lpn, nsecs_start));
 	}
 
-	/* GC if needed */
-	if (should_gc(conv_ftl)) {
-		do_gc(conv_ftl, false);
+	for (i = 0; i < nr_batch; i++) {
+		struct list_head *pending = &conv_ftl->ruhs[ruh].wb_pending;
+
+		buffer_mark_pending(wbuf, batch[i], pending);
+
+		nsecs_completed = write_one_page(conv_ftl, batch[i]->lpn / nr_parts, nsecs_ready);
+		if (nsecs_completed) {
+			/* the wordline is programmed, with every page pending on it */
+			buffer_clean_pending(wbuf, pending, nsecs_completed);
+			nsecs_latest = max(nsecs_completed, nsecs_latest);
+		}
+	}
+
+	return nsecs_latest;
+}
+
+/*
+ * The cold stream takes a line only once hot/cold separation sends it a page,
+ * GC then keeps a free line more in reserve for it.
+ */
+static void open_cold_stream(struct conv_ftl *conv_ftl)
+{
+	uint32_t ruh = conv_ftl->cur_ruh;
+
+	conv_ftl->cur_ruh = conv_ftl->cp.nr_ruhs;
+	prepare_write_pointer(conv_ftl, USER_IO);
+	conv_ftl->cur_ruh = ruh;
+
+	conv_ftl->cp.gc_thres_lines++;
+	conv_ftl->cp.gc_thres_lines_high++;
+}
+
+/* flush dirty pages until at most @nr_dirty of them are left */
+static uint64_t flush_write_buffer(struct nvmev_ns *ns, uint32_t nr_dirty, uint64_t nsecs_start)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct buffer *wbuf = conv_ftls[0].ssd->write_buffer;
+	uint64_t nsecs_completed, nsecs_latest = nsecs_start;
+
+	while (wbuf->nr_dirty > nr_dirty) {
+		nsecs_completed = flush_oneshot(ns, nsecs_start);
+		nsecs_latest = max(nsecs_completed, nsecs_latest);
+	}
+
+	return nsecs_latest;
+}
+
+/*
+ * Multiply-add-shift hash of each sketch row. Offsetting one multiplicative
+ * hash by a constant only rotates its buckets, so the rows would collide on
+ * the same LPNs; every row gets a multiplier and an addend of its own.
+ */
+static const uint64_t hotcold_hash_seeds[][2] = {
+	{ 0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL },
+	{ 0x94d049bb133111ebULL, 0xc2b2ae3d27d4eb4fULL },
+	{ 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL },
+	{ 0xff51afd7ed558ccdULL, 0x85ebca77c2b2ae63ULL },
+};
+
+static inline size_t hotcold_hash(struct hotcold_sketch *hcs, int d, uint64_t lpn)
+{
+	return (hotcold_hash_seeds[d][0] * lpn + hotcold_hash_seeds[d][1]) >> (64 - hcs->width_bits);
+}
+
+/*
+ * Count a host write of @lpn in the sketch and tell whether the LPN is hot,
+ * i.e. written at least HOTCOLD_HOT_THRESHOLD times lately. Halving every
+ * counter each decay interval lets pages that cooled down become cold again.
+ */
+static bool hotcold_update(struct conv_ftl *conv_ftl, uint64_t lpn)
+{
+	struct hotcold_sketch *hcs = &conv_ftl->hcs;
+	size_t width = 1UL << hcs->width_bits;
+	uint8_t est = U8_MAX;
+	size_t i;
+	int d;
+
+	BUILD_BUG_ON(ARRAY_SIZE(hotcold_hash_seeds) < HOTCOLD_SKETCH_DEPTH);
+
+	for (d = 0; d < HOTCOLD_SKETCH_DEPTH; d++) {
+		uint8_t *c = &hcs->counters[d * width + hotcold_hash(hcs, d, lpn)];
+
+		if (*c < U8_MAX)
+			(*c)++;
+		est = min(est, *c);
+	}
+
+	if (++hcs->nr_writes >= HOTCOLD_DECAY_INTERVAL) {
+		for (i = 0; i < HOTCOLD_SKETCH_DEPTH * width; i++)
+			hcs->counters[i] >>= 1;
+		hcs->nr_writes = 0;
+	}
+
+	if (est >= HOTCOLD_HOT_THRESHOLD) {
+		hcs->hot_pgs++;
+		return true;
+	}
+
+	hcs->cold_pgs++;
+	return false;
+}
+
+/* record a host event in the FDP events log */
+static void fdp_log_event(struct nvmev_ns *ns, uint8_t type, uint16_t pid)
+{
+	struct nvmev_fdp_events *evl = &nvmev_vdev->fdp_events;
+	struct nvme_fdp_event *ev = &evl->events[evl->next];
+
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->fdpef = NVME_FDP_EVENT_PIV | NVME_FDP_EVENT_NSIDV;
+	ev->pid = pid;
+	ev->timestamp = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+	ev->nsid = ns->id + 1;
+
+	evl->next = (evl->next + 1) % NR_FDP_EVENTS;
+	if (evl->nr_events < NR_FDP_EVENTS)
+		evl->nr_events++;
+}
+
+/*
+ * Reclaim unit handle a write goes through. With a single reclaim group the
+ * placement identifier in DSPEC is the handle itself; an invalid one falls
+ * back to handle 0 and is reported as a host event.
+ */
+static uint32_t get_write_ruh(struct nvmev_ns *ns, struct nvme_rw_command *cmd)
+{
+	uint16_t pid;
+
+	if (FDP_NR_RUHS == 0 || (cmd->control & NVME_RW_DTYPE_MASK) != NVME_RW_DTYPE_DPLCMT)
+		return 0;
+
+	pid = cmd->dsmgmt >> 16;
+	if (pid >= FDP_NR_RUHS) {
+		fdp_log_event(ns, NVME_FDP_EVENT_INVALID_PID, pid);
+		return 0;
+	}
+
+	return pid;
+}
+
+static bool conv_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct conv_ftl *conv_ftl = &conv_ftls[0];
+	/* spp are shared by all instances*/
+	struct ssdparams *spp = &conv_ftl->ssd->sp;
+	struct convparams *cpp = &conv_ftl->cp;
+
+	struct nvme_command *cmd = req->cmd;
+	uint64_t lba = cmd->rw.slba;
+	uint64_t nr_lba = (cmd->rw.length + 1);
+	uint64_t start_lpn = lba / spp->secs_per_pg;
+	uint64_t end_lpn = (lba + nr_lba - 1) / spp->secs_per_pg;
+	uint64_t lpn;
+	uint64_t nsecs_start = req->nsecs_start;
+	uint64_t nsecs_avail, nsecs_accepted = nsecs_start;
+	uint64_t nsecs_completed, nsecs_latest;
+	uint64_t nsecs_write_buffer, nsecs_ready;
+	uint32_t nr_parts = ns->nr_parts;
+	uint32_t ruh = get_write_ruh(ns, &cmd->rw);
+	uint32_t full = full_sec_mask(spp), sec_mask;
+	struct buffer *wbuf;
+	uint32_t i;
+
+	NVMEV_DEBUG("conv_write: start_lpn=%lld, len=%lld, end_lpn=%lld", start_lpn, nr_lba,
+		    end_lpn);
+	if ((end_lpn / nr_parts) >= spp->tt_pgs) {
+		NVMEV_ERROR("conv_write: lpn passed FTL range(start_lpn=%lld,tt_pgs=%ld)\n",
+			    start_lpn, spp->tt_pgs);
+		return false;
+	}
+
+	/* stage the data in the write-back cache, overwrites of dirty pages are absorbed */
+	for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
+		uint64_t local_lpn;
+		uint32_t page_ruh = ruh;
+		struct wb_entry *e;
+
+		conv_ftl = &conv_ftls[lpn % nr_parts];
+		wbuf = conv_ftl->ssd->write_buffer;
+		local_lpn = lpn / nr_parts;
+
+		if (ssd_hybrid()) {
+			/* For hybrid storage, all new writes go to SLC initially */
+			/* Update page hotness on write */
+			update_page_hotness(conv_ftl, local_lpn, ACCESS_WRITE);
+
+			/* Check for migrations */
+			check_and_perform_migrations(conv_ftl);
+		} else if (hotcold_separation &&
+			   (cmd->rw.control & NVME_RW_DTYPE_MASK) != NVME_RW_DTYPE_DPLCMT &&
+			   !hotcold_update(conv_ftl, local_lpn)) {
+			/* without a placement hint, cold pages go to their own stream */
+			page_ruh = conv_ftl->cp.nr_ruhs;
+			if (!conv_ftl->ruhs[page_ruh].wp.curline)
+				open_cold_stream(conv_ftl);
+		}
+		conv_ftl->stats.host_pgs++;
+
+		sec_mask = covered_sec_mask(spp, lpn, lba, nr_lba);
+		if (sec_mask != full)
+			conv_ftl->stats.partial_pgs++;
+
+		if (wbuf->nr_slots == 0) {
+			/* no cache: write through, merging a partial page right away */
+			nsecs_ready = nsecs_start;
+			if (sec_mask != full)
+				nsecs_ready = rmw_read(conv_ftl, local_lpn, nsecs_start);
+			conv_ftl->cur_ruh = page_ruh;
+			nsecs_completed = write_one_page(conv_ftl, local_lpn, nsecs_ready);
+			nsecs_accepted = max(nsecs_completed, nsecs_accepted);
+			continue;
+		}
+
+		/* every slot is dirty: make room in the foreground */
+		while (!(e = buffer_get_slot(wbuf, lpn, &nsecs_avail)))
+			flush_oneshot(ns, nsecs_start);
+		e->ruh = page_ruh;
+
+		/* a reused slot is free once its data has been programmed */
+		nsecs_accepted = max(nsecs_avail, nsecs_accepted);
+
+		if ((e->sec_mask & full) == full || sec_mask == full) {
+			e->sec_mask = U32_MAX;
+		} else if (cpp->subpage_merge) {
+			/* leave the old page read to write-back, later writes may fill the page */
+			e->sec_mask |= sec_mask;
+			if ((e->sec_mask & full) == full)
+				conv_ftl->stats.rmw_merged++;
+		} else {
+			nsecs_completed = rmw_read(conv_ftl, local_lpn, nsecs_start);
+			nsecs_accepted = max(nsecs_completed, nsecs_accepted);
+			e->sec_mask = U32_MAX;
+		}
+	}
+
+	nsecs_write_buffer = ssd_advance_write_buffer(conv_ftls[0].ssd, nsecs_accepted,
+						      NS_LBA_TO_BYTE(ns, nr_lba));
+	nsecs_latest = nsecs_write_buffer;
+
+	wbuf = conv_ftls[0].ssd->write_buffer;
+	if ((cmd->rw.control & NVME_RW_FUA) || (spp->write_early_completion == 0)) {
+		/* the data must be on flash before completion */
+		nsecs_latest = flush_write_buffer(ns, 0, nsecs_write_buffer);
+		for (i = 0; i < nr_parts; i++) {
+			nsecs_completed = program_open_wordline(&conv_ftls[i], nsecs_write_buffer);
+			nsecs_latest = max(nsecs_completed, nsecs_latest);
+		}
+	} else if (wbuf->nr_dirty * 100 >= wbuf->nr_slots * cpp->wb_high_wm) {
+		/* background write-back down to the low watermark */
+		flush_write_buffer(ns, wbuf->nr_slots * cpp->wb_low_wm / 100, nsecs_write_buffer);
+	}
+
+	for (i = 0; i < nr_parts; i++) {
+		/* GC if needed */
+		if (should_gc(&conv_ftls[i]))
+			do_gc(&conv_ftls[i], false);
+	}
+
+	ret->nsecs_target = nsecs_latest;
+	ret->status = NVME_SC_SUCCESS;
+	return true;
+}
+
+static uint64_t copy_one_page(struct conv_ftl *src_ftl, uint64_t src_lpn,
+			      struct conv_ftl *dst_ftl, uint64_t dst_lpn, uint64_t nsecs_start)
+{
+	struct ssdparams *spp = &dst_ftl->ssd->sp;
+	struct ppa src_ppa = get_maptbl_ent(src_ftl, src_lpn);
+	struct ppa old_ppa = get_maptbl_ent(dst_ftl, dst_lpn);
+	struct ppa new_ppa;
+	uint64_t nsecs_completed;
+
+	nsecs_start = cmt_access(src_ftl, src_lpn, false, nsecs_start);
+	nsecs_completed = cmt_access(dst_ftl, dst_lpn, true, nsecs_start);
+
+	/* destination is overwritten either way */
+	if (mapped_ppa(&old_ppa)) {
+		mark_page_invalid(dst_ftl, &old_ppa);
+		set_rmap_ent(dst_ftl, INVALID_LPN, &old_ppa);
+		old_ppa.ppa = UNMAPPED_PPA;
+		set_maptbl_ent(dst_ftl, dst_lpn, &old_ppa);
+	}
+
+	/* copying unwritten blocks leaves the destination unwritten as well */
+	if (!mapped_ppa(&src_ppa) || !valid_ppa(src_ftl, &src_ppa))
+		return nsecs_completed;
+
+	if (src_ftl->cp.enable_gc_delay) {
+		struct nand_cmd cpr = {
+			.type = GC_IO,
+			.cmd = NAND_READ,
+			.stime = nsecs_start,
+			.xfer_size = spp->pgsz,
+			.interleave_pci_dma = false,
+			.ppa = &src_ppa,
+		};
+		nsecs_completed = ssd_advance_nand(src_ftl->ssd, &cpr);
+	}
+
+	new_ppa = get_new_page(dst_ftl, GC_IO);
+	set_maptbl_ent(dst_ftl, dst_lpn, &new_ppa);
+	set_rmap_ent(dst_ftl, dst_lpn, &new_ppa);
+
+	mark_page_valid(dst_ftl, &new_ppa);
+	advance_write_pointer(dst_ftl, GC_IO);
+
+	if (dst_ftl->cp.enable_gc_delay)
+		nsecs_completed = gc_program_page(dst_ftl, &new_ppa, nsecs_completed, false);
+
+	return nsecs_completed;
+}
+
+/*
+ * Simple Copy: the source ranges are read from NAND into the controller DRAM
+ * and programmed through the GC write pointer. No data crosses PCIe.
+ */
+static bool conv_copy(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct ssdparams *spp = &conv_ftls[0].ssd->sp;
+	struct nvme_copy_command *cmd = &req->cmd->copy;
+	struct nvme_copy_range range;
+	uint32_t nr_parts = ns->nr_parts;
+	uint64_t nsecs_start = req->nsecs_start + ssd_lat(conv_ftls[0].ssd, fw_rd_lat);
+	uint64_t nsecs_completed, nsecs_latest = nsecs_start;
+	uint64_t dst_lba = cmd->sdlba;
+	uint64_t prev_dst_lpn = U64_MAX;
+	uint64_t nr_lba = 0;
+	uint32_t i;
+
+	if ((cmd->desc_fmt & 0xf) != 0 || cmd->nr_range >= NR_MAX_COPY_RANGES) {
+		ret->status = NVME_SC_INVALID_FIELD;
+		ret->nsecs_target = req->nsecs_start;
+		return true;
+	}
+
+	for (i = 0; i <= cmd->nr_range; i++) {
+		nvmev_get_copy_range(cmd, i, &range);
+		nr_lba += range.nlb + 1;
+
+		if (((range.slba + range.nlb) / spp->secs_per_pg / nr_parts) >= spp->tt_pgs) {
+			NVMEV_ERROR("%s: source range passed FTL range(slba=%lld,nlb=%d)\n",
+				    __func__, range.slba, range.nlb + 1);
+			ret->status = NVME_SC_LBA_RANGE;
+			ret->nsecs_target = req->nsecs_start;
+			return true;
+		}
+	}
+
+	if ((cmd->sdlba / spp->secs_per_pg / nr_parts) >= spp->tt_pgs ||
+	    ((cmd->sdlba + nr_lba - 1) / spp->secs_per_pg / nr_parts) >= spp->tt_pgs) {
+		NVMEV_ERROR("%s: destination passed FTL range(sdlba=%lld,nlb=%lld)\n", __func__,
+			    cmd->sdlba, nr_lba);
+		ret->status = NVME_SC_LBA_RANGE;
+		ret->nsecs_target = req->nsecs_start;
+		return true;
+	}
+
+	/* sources may only be in the write-back cache, and destinations are replaced */
+	nsecs_start = flush_write_buffer(ns, 0, nsecs_start);
+
+	/*
+	 * Ranges are packed back to back from sdlba on, so walk the destination
+	 * pages and take each from the source page holding its first LBA. A page
+	 * shared by two ranges is copied once.
+	 */
+	for (i = 0; i <= cmd->nr_range; i++) {
+		uint64_t start_lpn, end_lpn, dst_lpn;
+
+		nvmev_get_copy_range(cmd, i, &range);
+		start_lpn = dst_lba / spp->secs_per_pg;
+		end_lpn = (dst_lba + range.nlb) / spp->secs_per_pg;
+
+		for (dst_lpn = start_lpn; dst_lpn <= end_lpn; dst_lpn++) {
+			uint64_t first_lba = max(dst_lpn * spp->secs_per_pg, dst_lba);
+			uint64_t lpn = (range.slba + first_lba - dst_lba) / spp->secs_per_pg;
+			struct conv_ftl *src_ftl = &conv_ftls[lpn % nr_parts];
+			struct conv_ftl *dst_ftl = &conv_ftls[dst_lpn % nr_parts];
+
+			if (dst_lpn == prev_dst_lpn)
+				continue;
+			prev_dst_lpn = dst_lpn;
+
+			buffer_drop(dst_ftl->ssd->write_buffer, dst_lpn);
+			nsecs_completed = copy_one_page(src_ftl, lpn / nr_parts, dst_ftl,
+							dst_lpn / nr_parts, nsecs_start);
+			nsecs_latest = max(nsecs_completed, nsecs_latest);
+		}
+
+		dst_lba += range.nlb + 1;
+	}
+
+	for (i = 0; i < nr_parts; i++) {
+		if (should_gc(&conv_ftls[i]))
+			do_gc(&conv_ftls[i], false);
 	}
 
-	ret->nsecs_target = completed_time;
+	ret->status = NVME_SC_SUCCESS;
+	ret->nsecs_target = nsecs_latest;
 	return true;
 }
 
@@ -1452,9 +2639,13 @@ static void conv_flush(struct nvmev_ns *ns, struct nvmev_request *req, struct nv
 	uint32_t i;
 	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
 
-	start = local_clock();
+	start = nvmev_clock();
 	latest = start;
+
+	/* write back everything still dirty in the write-back cache */
+	flush_write_buffer(ns, 0, start);
 	for (i = 0; i < ns->nr_parts; i++) {
+		program_open_wordline(&conv_ftls[i], start);
 		latest = max(latest, ssd_next_idle_time(conv_ftls[i].ssd));
 	}
 
@@ -1465,6 +2656,105 @@ static void conv_flush(struct nvmev_ns *ns, struct nvmev_request *req, struct nv
 	return;
 }
 
+/*
+ * Switch the namespace to another LBA data size. Mapping is per page and the
+ * data stays at the same byte offsets, so only cached partial pages, whose
+ * sector masks are in the old unit, have to reach the flash first.
+ */
+void conv_format(struct nvmev_ns *ns, uint32_t lba_shift)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	uint64_t now = nvmev_clock();
+	uint32_t i;
+
+	flush_write_buffer(ns, 0, now);
+	for (i = 0; i < ns->nr_parts; i++)
+		ssd_set_lba_size(&conv_ftls[i].ssd->sp, 1 << lba_shift);
+
+	ns->lba_shift = lba_shift;
+	NVMEV_INFO("[%s] ns%u LBA size %u\n", __func__, ns->id, 1U << lba_shift);
+}
+
+void conv_print_stats(struct nvmev_ns *ns, struct seq_file *m)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	struct buffer *wbuf = conv_ftls[0].ssd->write_buffer;
+	uint32_t i;
+
+	/* the write-back cache is shared by the partitions */
+	seq_printf(m, "ns%u: write_cache absorbed %llu dirty %u/%u\n", ns->id, wbuf->absorbed,
+		   wbuf->nr_dirty, wbuf->nr_slots);
+
+	for (i = 0; i < ns->nr_parts; i++) {
+		struct conv_ftl *conv_ftl = &conv_ftls[i];
+		struct conv_stats *st = &conv_ftl->stats;
+		struct line_mgmt *lm = &conv_ftl->lm;
+		uint64_t nand_pgs = st->user_pgs + st->gc_pgs + st->wl_pgs + st->map_wr_pgs;
+		uint64_t waf = st->host_pgs ? div64_u64(nand_pgs * 100, st->host_pgs) : 100;
+		uint64_t erase_sum = 0;
+		int erase_min = INT_MAX, erase_max = 0;
+		int j;
+
+		for (j = 0; j < lm->tt_lines; j++) {
+			erase_min = min(erase_min, lm->lines[j].erase_cnt);
+			erase_max = max(erase_max, lm->lines[j].erase_cnt);
+			erase_sum += lm->lines[j].erase_cnt;
+		}
+
+		seq_printf(m, "ns%u.%u: host_pgs %llu nand_pgs %llu gc_pgs %llu wl_pgs %llu waf %llu.%02llu\n",
+			   ns->id, i, st->host_pgs, nand_pgs, st->gc_pgs, st->wl_pgs, waf / 100,
+			   waf % 100);
+		seq_printf(m, "ns%u.%u: gc_lines %llu gc_copyback_pgs %llu wl_lines %llu erase_cnt min %d max %d avg %llu\n",
+			   ns->id, i, st->gc_lines, st->gc_copyback_pgs, st->wl_lines, erase_min, erase_max,
+			   div64_u64(erase_sum, lm->tt_lines));
+		seq_printf(m, "ns%u.%u: cmt hits %llu misses %llu map_rd_pgs %llu map_wr_pgs %llu cached %u/%u\n",
+			   ns->id, i, conv_ftl->cmt.hits, conv_ftl->cmt.misses, st->map_rd_pgs,
+			   st->map_wr_pgs, conv_ftl->cmt.nr_cached, conv_ftl->cmt.nr_tpages);
+		seq_printf(m, "ns%u.%u: cmt_hmb hits %llu cached %u/%u\n", ns->id, i,
+			   conv_ftl->cmt.hmb_hits, conv_ftl->cmt.nr_hmb, conv_ftl->cmt.hmb_tpages);
+		seq_printf(m, "ns%u.%u: subpage partial_pgs %llu rmw_reads %llu rmw_merged %llu\n",
+			   ns->id, i, st->partial_pgs, st->rmw_reads, st->rmw_merged);
+		seq_printf(m, "ns%u.%u: read_cache hits %llu misses %llu invalidations %llu used %u/%u\n",
+			   ns->id, i, conv_ftl->rcache.hits, conv_ftl->rcache.misses,
+			   conv_ftl->rcache.invalidations, conv_ftl->rcache.nr_used,
+			   conv_ftl->rcache.nr_entries);
+		seq_printf(m, "ns%u.%u: read_ahead prefetches %llu hits %llu wasted %llu\n", ns->id,
+			   i, conv_ftl->rcache.prefetches, conv_ftl->rcache.prefetch_hits,
+			   conv_ftl->rcache.prefetch_wasted);
+
+		seq_printf(m, "ns%u.%u: hotcold %s hot_pgs %llu cold_pgs %llu cold host_pgs %llu gc_pgs %llu\n",
+			   ns->id, i, hotcold_separation ? "on" : "off", conv_ftl->hcs.hot_pgs,
+			   conv_ftl->hcs.cold_pgs, conv_ftl->ruhs[conv_ftl->cp.nr_ruhs].host_pgs,
+			   conv_ftl->ruhs[conv_ftl->cp.nr_ruhs].gc_pgs);
+
+		for (j = 0; j < FDP_NR_RUHS; j++) {
+			struct fdp_ruh *ruh = &conv_ftl->ruhs[j];
+
+			seq_printf(m, "ns%u.%u: ruh%d host_pgs %llu gc_pgs %llu gc_lines %llu rus %llu\n",
+				   ns->id, i, j, ruh->host_pgs, ruh->gc_pgs, ruh->gc_lines,
+				   ruh->ru_cnt);
+		}
+	}
+}
+
+/* add the namespace to the FDP statistics log, which counts bytes */
+void conv_fdp_stats(struct nvmev_ns *ns, struct nvme_fdp_stats_log *log)
+{
+	struct conv_ftl *conv_ftls = (struct conv_ftl *)ns->ftls;
+	uint32_t i;
+
+	for (i = 0; i < ns->nr_parts; i++) {
+		struct conv_ftl *conv_ftl = &conv_ftls[i];
+		struct ssdparams *spp = &conv_ftl->ssd->sp;
+		struct conv_stats *st = &conv_ftl->stats;
+		uint64_t nand_pgs = st->user_pgs + st->gc_pgs + st->wl_pgs + st->map_wr_pgs;
+
+		log->hbmw[0] += st->host_pgs * spp->pgsz;
+		log->mbmw[0] += nand_pgs * spp->pgsz;
+		log->mbe[0] += (st->gc_lines + st->wl_lines) * spp->pgs_per_line * spp->pgsz;
+	}
+}
+
 bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
 {
 	struct nvme_command *cmd = req->cmd;
@@ -1483,6 +2773,10 @@ bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struc
 	case nvme_cmd_flush:
 		conv_flush(ns, req, ret);
 		break;
+	case nvme_cmd_copy:
+		if (!conv_copy(ns, req, ret))
+			return false;
+		break;
 	default:
 		NVMEV_ERROR("%s: unimplemented command: %s(%d)\n", __func__,
 			   nvme_opcode_string(cmd->common.opcode), cmd->common.opcode);
@@ -1493,7 +2787,6 @@ bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struc
 }
 
 /* Hotness tracking and migration functions */
-#if (BASE_SSD == HYBRID_SSD)
 
 /* Initialize hotness tracking table */
 static void init_hotness_tracking(struct conv_ftl *conv_ftl)
@@ -1710,4 +3003,3 @@ static void check_and_perform_migrations(struct conv_ftl *conv_ftl)
 	}
 }
 
-#endif /* BASE_SSD == HYBRID_SSD */
@@ -7,11 +7,24 @@
 #include "pqueue/pqueue.h"
 #include "ssd_config.h"
 #include "ssd.h"
+#include "read_cache.h"
 
 struct convparams {
 	uint32_t gc_thres_lines;
 	uint32_t gc_thres_lines_high;
 	bool enable_gc_delay;
+	bool gc_copyback; /* GC moves pages that stay on their plane without the channel */
+	uint32_t wl_thres_erase_cnt; /* erase count spread that triggers static WL */
+	uint32_t wl_check_interval; /* # of line erases between static WL checks */
+	uint32_t read_cache_flashpgs; /* # of flash pages in the read cache */
+	int read_cache_policy;
+	uint32_t ra_depth; /* mapping pages prefetched ahead of a sequential stream */
+	uint32_t ra_trigger; /* sequential reads in a row that start prefetching */
+	uint32_t cmt_tpages; /* # of cached translation pages, 0 keeps the whole map resident */
+	uint32_t wb_high_wm; /* write-back starts at this % of dirty slots */
+	uint32_t wb_low_wm; /* write-back stops at this % of dirty slots */
+	uint32_t nr_ruhs; /* reclaim unit handles, each with its own user write pointer */
+	bool subpage_merge; /* merge partial pages in the write cache before the RMW read */
 
 	double op_area_pcent;
 	int pba_pcent; /* (physical space / logical space) * 100*/
@@ -21,6 +34,8 @@ struct line {
 	int id; /* line id, the same as corresponding block id */
 	int ipc; /* invalid page count in this line */
 	int vpc; /* valid page count in this line */
+	int erase_cnt; /* # of times this line has been erased */
+	int ruh; /* reclaim unit handle that wrote the line, -1 if written by GC */
 	struct list_head entry;
 	/* position in the priority queue for victim lines */
 	size_t pos;
@@ -48,6 +63,8 @@ struct line_mgmt {
 	uint32_t free_line_cnt;
 	uint32_t victim_line_cnt;
 	uint32_t full_line_cnt;
+
+	struct line *reclaiming; /* line being relocated, it is on no list */
 };
 
 struct write_flow_control {
@@ -55,30 +72,123 @@ struct write_flow_control {
 	uint32_t credits_to_refill;
 };
 
+/* rmap tag of a translation page, the rest of the value is its tvpn */
+#define TPAGE_LPN_FLAG (1ULL << 63)
+#define IS_TPAGE_LPN(lpn) (((lpn) != INVALID_LPN) && ((lpn) & TPAGE_LPN_FLAG))
+
+struct cmt_entry {
+	struct list_head lru;
+	bool cached;
+	bool dirty;
+	bool in_hmb; /* cached in the host memory buffer rather than controller DRAM */
+};
+
+/* cached mapping table of a demand-paged (DFTL) map */
+struct cmt {
+	uint32_t nr_tpages; /* capacity in translation pages */
+	uint32_t nr_cached;
+	uint32_t ents_per_tpage;
+	uint64_t tt_tpages;
+	struct cmt_entry *entries; /* indexed by tvpn */
+	struct ppa *gtd; /* global translation directory: flash location of each tpage */
+	struct list_head lru_list; /* most recently used first */
+
+	/* second tier in the host memory buffer, empty while the host holds none */
+	uint32_t hmb_tpages;
+	uint32_t nr_hmb;
+	uint32_t hmb_gen; /* nvmev_hmb generation hmb_tpages was sized for */
+	struct list_head hmb_lru_list;
+
+	uint64_t hits;
+	uint64_t hmb_hits;
+	uint64_t misses;
+};
+
+/* FDP reclaim unit handle; its reclaim units are lines */
+struct fdp_ruh {
+	struct write_pointer wp;
+	uint64_t host_pgs; /* host pages programmed through this handle */
+	uint64_t gc_pgs; /* valid pages GC moved out of its reclaim units */
+	uint64_t gc_lines; /* its reclaim units reclaimed by GC */
+	uint64_t ru_cnt; /* reclaim units opened */
+	struct list_head wb_pending; /* cached pages in the open wordline, see buffer_mark_pending() */
+};
+
+#define HOTCOLD_SKETCH_DEPTH (4)
+
+/* count-min sketch of recent host writes per LPN, halved every decay interval */
+struct hotcold_sketch {
+	uint8_t *counters; /* HOTCOLD_SKETCH_DEPTH rows of 2^width_bits counters */
+	uint32_t width_bits;
+	uint32_t nr_writes; /* since the last decay */
+	uint64_t hot_pgs; /* host pages classified hot */
+	uint64_t cold_pgs; /* host pages classified cold */
+};
+
+/* wordline the GC write pointer is filling */
+struct gc_wordline {
+	uint64_t nsecs_ready; /* when the data of every page placed so far is available */
+	uint32_t nr_xfer_pgs; /* pages of it that cross the channel */
+};
+
+/* a read stream seen recently, in namespace LPNs */
+struct ra_stream {
+	uint64_t next_lpn; /* where the stream continues if it is sequential */
+	uint64_t pf_lpn; /* last page prefetched for the stream */
+	uint32_t seq_cnt; /* reads in a row that continued the stream */
+};
+
+struct conv_stats {
+	uint64_t host_pgs; /* pages written by the host */
+	uint64_t user_pgs; /* host pages programmed to flash */
+	uint64_t gc_pgs; /* valid pages relocated by GC */
+	uint64_t gc_copyback_pgs; /* relocated with on-die copyback */
+	uint64_t wl_pgs; /* valid pages relocated by static wear leveling */
+	uint64_t gc_lines; /* lines reclaimed by GC */
+	uint64_t wl_lines; /* lines reclaimed by static wear leveling */
+	uint64_t map_rd_pgs; /* translation pages read on CMT misses */
+	uint64_t map_wr_pgs; /* dirty translation pages written back */
+	uint64_t partial_pgs; /* host page writes covering only part of a mapping page */
+	uint64_t rmw_reads; /* old pages read to merge a partial write */
+	uint64_t rmw_merged; /* partial pages completed in the write cache, no RMW read needed */
+};
+
 struct conv_ftl {
 	struct ssd *ssd;
 
 	struct convparams cp;
 	struct ppa *maptbl; /* page level mapping table */
 	uint64_t *rmap; /* reverse mapptbl, assume it's stored in OOB */
-	struct write_pointer wp;
+	/* user write pointers, one per reclaim unit handle plus the device cold stream */
+	struct fdp_ruh *ruhs;
+	uint32_t cur_ruh; /* handle the next user page is written through */
 	struct write_pointer gc_wp;
+	/* destination of static WL, opened on the most worn free line */
+	struct write_pointer wl_wp;
+	bool in_wl; /* GC_IO writes go through wl_wp */
+	struct gc_wordline gc_wl;
 	struct line_mgmt lm;
 	struct write_flow_control wfc;
+	struct conv_stats stats;
+	struct read_cache rcache; /* controller DRAM read cache */
+	struct cmt cmt; /* cached mapping table, if the map is demand paged */
+	struct hotcold_sketch hcs; /* write frequency of LPNs for hot/cold separation */
+	/* sequential stream detector, only that of the first instance is used */
+	struct ra_stream ra_streams[READ_AHEAD_HISTORY];
+	uint32_t ra_victim; /* stream replaced by the next non-sequential read */
+	uint32_t wl_erase_ticks; /* line erases since the last static WL check */
 	//66f1
 	struct line_mgmt *lunlm;
 	struct write_pointer *lunwp;
 	uint32_t lunpointer;
 	//66f1
 
-#if (BASE_SSD == HYBRID_SSD)
-	/* Hybrid storage migration management */
+	/* Hybrid storage migration management, with ssd_hybrid() only */
 	struct migration_mgmt migration_mgmt;
 	uint64_t total_slc_pages;  /* Total pages in SLC */
 	uint64_t used_slc_pages;   /* Used pages in SLC */
 	uint64_t total_qlc_pages;  /* Total pages in QLC */
 	uint64_t used_qlc_pages;   /* Used pages in QLC */
-#endif
 };
 
 void conv_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *mapped_addr,
@@ -88,5 +198,12 @@ void conv_remove_namespace(struct nvmev_ns *ns);
 
 bool conv_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req,
 			   struct nvmev_result *ret);
+void conv_format(struct nvmev_ns *ns, uint32_t lba_shift);
+
+struct seq_file;
+void conv_print_stats(struct nvmev_ns *ns, struct seq_file *m);
+
+struct nvme_fdp_stats_log;
+void conv_fdp_stats(struct nvmev_ns *ns, struct nvme_fdp_stats_log *log);
 
 #endif
@@ -34,7 +34,66 @@ static inline unsigned int __get_io_worker(int sqid)
 
 static inline unsigned long long __get_wallclock(void)
 {
-	return cpu_clock(nvmev_vdev->config.cpu_nr_dispatcher);
+	return nvmev_clock();
+}
+
+/* Source range entries may straddle the page boundary of PRP1 */
+void nvmev_get_copy_range(struct nvme_copy_command *cmd, unsigned int idx,
+			  struct nvme_copy_range *range)
+{
+	size_t offs = (cmd->prp1 & PAGE_OFFSET_MASK) + idx * sizeof(*range);
+	size_t remaining = sizeof(*range);
+	u8 *dst = (u8 *)range;
+
+	while (remaining) {
+		u64 paddr = (offs < PAGE_SIZE) ? cmd->prp1 : cmd->prp2;
+		size_t mem_offs = offs & PAGE_OFFSET_MASK;
+		size_t io_size = min_t(size_t, remaining, PAGE_SIZE - mem_offs);
+		void *vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
+
+		memcpy(dst, vaddr + mem_offs, io_size);
+		kunmap_atomic(vaddr);
+
+		remaining -= io_size;
+		offs += io_size;
+		dst += io_size;
+	}
+}
+
+/* Copy is done inside the device, there's no data to move from/to the host */
+static unsigned int __do_perform_copy(int sqid, int sq_entry)
+{
+	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
+	struct nvme_copy_command *cmd = &sq_entry(sq_entry).copy;
+	struct nvmev_ns *ns = &nvmev_vdev->ns[cmd->nsid - 1];
+	void *mapped = ns->mapped;
+	struct nvme_copy_range range;
+	size_t dst_offset = NS_LBA_TO_BYTE(ns, cmd->sdlba);
+	size_t length = 0;
+	unsigned int i;
+
+	if (cmd->desc_fmt & 0xf || cmd->nr_range >= NR_MAX_COPY_RANGES)
+		return 0;
+
+	for (i = 0; i <= cmd->nr_range; i++) {
+		size_t range_size;
+
+		nvmev_get_copy_range(cmd, i, &range);
+		range_size = NS_LBA_TO_BYTE(ns, range.nlb + 1);
+
+		/* the FTL has failed such a copy already, just keep off the memory */
+		if (range.slba >= NS_BYTE_TO_LBA(ns, ns->size) ||
+		    NS_LBA_TO_BYTE(ns, range.slba) + range_size > ns->size ||
+		    dst_offset + range_size > ns->size)
+			break;
+
+		memmove(mapped + dst_offset, mapped + NS_LBA_TO_BYTE(ns, range.slba), range_size);
+
+		dst_offset += range_size;
+		length += range_size;
+	}
+
+	return length;
 }
 
 static unsigned int __do_perform_io(int sqid, int sq_entry)
@@ -48,8 +107,11 @@ static unsigned int __do_perform_io(int sqid, int sq_entry)
 	u64 *paddr_list = NULL;
 	size_t nsid = sq_entry(sq_entry).rw.nsid - 1; // 0-based
 
-	offset = sq_entry(sq_entry).rw.slba << 9;
-	length = (sq_entry(sq_entry).rw.length + 1) << 9;
+	if (sq_entry(sq_entry).rw.opcode == nvme_cmd_copy)
+		return __do_perform_copy(sqid, sq_entry);
+
+	offset = NS_LBA_TO_BYTE(&nvmev_vdev->ns[nsid], sq_entry(sq_entry).rw.slba);
+	length = NS_LBA_TO_BYTE(&nvmev_vdev->ns[nsid], sq_entry(sq_entry).rw.length + 1);
 	remaining = length;
 
 	while (remaining) {
@@ -115,9 +177,13 @@ static unsigned int __do_perform_io_using_dma(int sqid, int sq_entry)
 	u64 *tmp_paddr_list = NULL;
 	size_t io_size;
 	size_t mem_offs = 0;
+	size_t nsid = sq_entry(sq_entry).rw.nsid - 1; // 0-based
+
+	if (sq_entry(sq_entry).rw.opcode == nvme_cmd_copy)
+		return __do_perform_copy(sqid, sq_entry);
 
-	offset = sq_entry(sq_entry).rw.slba << 9;
-	length = (sq_entry(sq_entry).rw.length + 1) << 9;
+	offset = NS_LBA_TO_BYTE(&nvmev_vdev->ns[nsid], sq_entry(sq_entry).rw.slba);
+	length = NS_LBA_TO_BYTE(&nvmev_vdev->ns[nsid], sq_entry(sq_entry).rw.length + 1);
 	remaining = length;
 
 	memset(paddr_list, 0, sizeof(paddr_list));
@@ -198,6 +264,25 @@ static unsigned int __do_perform_io_using_dma(int sqid, int sq_entry)
 	return length;
 }
 
+/*
+ * Only the worker writes pi->nsecs_next. Enqueuers lower nsecs_enqueued once
+ * the entry is linked, the worker folds it into nsecs_next before a scan.
+ */
+static void __publish_target(struct nvmev_proc_info *pi, unsigned long long nsecs_target)
+{
+	unsigned long long old;
+
+	mb(); /* the entry is on the list before its target shows */
+	old = READ_ONCE(pi->nsecs_enqueued);
+	while (old > nsecs_target) {
+		unsigned long long cur = cmpxchg64(&pi->nsecs_enqueued, old, nsecs_target);
+
+		if (cur == old)
+			break;
+		old = cur;
+	}
+}
+
 static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long long nsecs_start,
 			     struct nvmev_result *ret)
 {
@@ -229,7 +314,7 @@ static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long lon
 	pi->proc_table[entry].sq_entry = sq_entry;
 	pi->proc_table[entry].command_id = sq_entry(sq_entry).common.command_id;
 	pi->proc_table[entry].nsecs_start = nsecs_start;
-	pi->proc_table[entry].nsecs_enqueue = local_clock();
+	pi->proc_table[entry].nsecs_enqueue = __get_wallclock();
 	pi->proc_table[entry].nsecs_target = ret->nsecs_target;
 	pi->proc_table[entry].status = ret->status;
 	pi->proc_table[entry].is_completed = false;
@@ -273,6 +358,7 @@ static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long lon
 			pi->proc_table[curr].next = entry;
 		}
 	}
+	__publish_target(pi, ret->nsecs_target);
 }
 
 void enqueue_writeback_io_req(int sqid, unsigned long long nsecs_target,
@@ -295,12 +381,12 @@ void enqueue_writeback_io_req(int sqid, unsigned long long nsecs_target,
 	BUG_ON(pi->free_seq >= NR_MAX_PARALLEL_IO);
 
 	NVMEV_DEBUG("%s/%u, writeback sq %d %llu + %llu\n", pi->thread_name, entry,
-		    sqid, local_clock(), nsecs_target - local_clock());
+		    sqid, __get_wallclock(), nsecs_target - __get_wallclock());
 
 	/////////////////////////////////
 	pi->proc_table[entry].sqid = sqid;
-	pi->proc_table[entry].nsecs_start = local_clock();
-	pi->proc_table[entry].nsecs_enqueue = local_clock();
+	pi->proc_table[entry].nsecs_start = __get_wallclock();
+	pi->proc_table[entry].nsecs_enqueue = __get_wallclock();
 	pi->proc_table[entry].nsecs_target = nsecs_target;
 	pi->proc_table[entry].is_completed = false;
 	pi->proc_table[entry].is_copied = true;
@@ -345,6 +431,7 @@ void enqueue_writeback_io_req(int sqid, unsigned long long nsecs_target,
 			pi->proc_table[curr].next = entry;
 		}
 	}
+	__publish_target(pi, nsecs_target);
 }
 
 static void __reclaim_completed_reqs(void)
@@ -403,11 +490,8 @@ static size_t __nvmev_proc_io(int sqid, int sq_entry, size_t *io_size)
 	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
 	unsigned long long nsecs_start = __get_wallclock();
 	struct nvme_command *cmd = &sq_entry(sq_entry);
-#if (BASE_SSD == KV_PROTOTYPE)
-	uint32_t nsid = 0; // Some KVSSD programs give 0 as nsid for KV IO
-#else
-	uint32_t nsid = cmd->common.nsid - 1;
-#endif
+	// Some KVSSD programs give 0 as nsid for KV IO
+	uint32_t nsid = nvmev_kv() ? 0 : cmd->common.nsid - 1;
 	struct nvmev_ns *ns = &nvmev_vdev->ns[nsid];
 
 	struct nvmev_request req = {
@@ -433,7 +517,11 @@ static size_t __nvmev_proc_io(int sqid, int sq_entry, size_t *io_size)
 
 	if (!ns->proc_io_cmd(ns, &req, &ret))
 		return false;
-	*io_size = (sq_entry(sq_entry).rw.length + 1) << 9;
+	/* Copy moves data inside the device only */
+	if (cmd->common.opcode == nvme_cmd_copy)
+		*io_size = 0;
+	else
+		*io_size = NS_LBA_TO_BYTE(ns, sq_entry(sq_entry).rw.length + 1);
 
 #ifdef PERF_DEBUG
 	prev_clock2 = local_clock();
@@ -548,6 +636,34 @@ static void __fill_cq_result(struct nvmev_proc_table *proc_entry)
 	spin_unlock(&cq->entry_lock);
 }
 
+/*
+ * Virtual time: when none of the workers has a completion due, there's
+ * nothing for the device to do but wait. Jump the clock to the earliest
+ * pending target instead, completions then post in target order at once.
+ * Commands still in the SQs or in the middle of a worker's scan may be due
+ * earlier, so the clock only jumps once the dispatcher has drained every SQ
+ * and no other worker is scanning.
+ */
+static void __skip_idle_time(struct nvmev_proc_info *pi, unsigned long long nsecs_next)
+{
+	unsigned int i;
+
+	WRITE_ONCE(pi->nsecs_next, nsecs_next);
+	if (!smp_load_acquire(&nvmev_clocksource.sqs_drained) ||
+	    atomic_read(&nvmev_clocksource.nr_scanning))
+		return;
+
+	for (i = 0; i < nvmev_vdev->config.nr_io_cpu; i++) {
+		struct nvmev_proc_info *other = &nvmev_vdev->proc_info[i];
+
+		nsecs_next = min(nsecs_next, READ_ONCE(other->nsecs_next));
+		nsecs_next = min(nsecs_next, READ_ONCE(other->nsecs_enqueued));
+	}
+
+	if (nsecs_next != ULLONG_MAX)
+		nvmev_clock_skip(nsecs_next);
+}
+
 static int nvmev_kthread_io(void *data)
 {
 	struct nvmev_proc_info *pi = (struct nvmev_proc_info *)data;
@@ -564,16 +680,25 @@ static int nvmev_kthread_io(void *data)
 		   cpu_to_node(smp_processor_id()));
 
 	while (!kthread_should_stop()) {
-		unsigned long long curr_nsecs_wall = __get_wallclock();
-		unsigned long long curr_nsecs_local = local_clock();
-		long long delta = curr_nsecs_wall - curr_nsecs_local;
-
-		volatile unsigned int curr = pi->io_seq;
+		volatile unsigned int curr;
+		unsigned long long nsecs_next = ULLONG_MAX;
 		int qidx;
 
+		if (nvmev_clocksource.virt) {
+			/* entries enqueued so far are seen by the scan below */
+			unsigned long long nsecs_enqueued;
+
+			atomic_inc(&nvmev_clocksource.nr_scanning);
+			nsecs_enqueued = xchg(&pi->nsecs_enqueued, ULLONG_MAX);
+
+			WRITE_ONCE(pi->nsecs_next, min(pi->nsecs_next, nsecs_enqueued));
+			mb();
+		}
+		curr = pi->io_seq;
+
 		while (curr != -1) {
 			struct nvmev_proc_table *pe = &pi->proc_table[curr];
-			unsigned long long curr_nsecs = local_clock() + delta;
+			unsigned long long curr_nsecs = __get_wallclock();
 			pi->proc_io_nsecs = curr_nsecs;
 
 			if (pe->is_completed == true) {
@@ -584,29 +709,32 @@ static int nvmev_kthread_io(void *data)
 			if (pe->is_copied == false) {
 #ifdef PERF_DEBUG
 				unsigned long long memcpy_time;
-				pe->nsecs_copy_start = local_clock() + delta;
+				pe->nsecs_copy_start = __get_wallclock();
 #endif
 				if (pe->writeback_cmd) {
 					;
+				} else if (pe->status != NVME_SC_SUCCESS && !nvmev_kv()) {
+					/* the command failed in the FTL, it moves no data */
+					;
 				} else if (io_using_dma) {
 					__do_perform_io_using_dma(pe->sqid, pe->sq_entry);
 				} else {
-#if (BASE_SSD == KV_PROTOTYPE)
-					struct nvmev_submission_queue *sq =
-						nvmev_vdev->sqes[pe->sqid];
-					ns = &nvmev_vdev->ns[0];
-					if (ns->identify_io_cmd(ns, sq_entry(pe->sq_entry))) {
-						pe->result0 = ns->perform_io_cmd(
-							ns, &sq_entry(pe->sq_entry), &(pe->status));
-					} else {
-						__do_perform_io(pe->sqid, pe->sq_entry);
+					if (nvmev_kv()) {
+						struct nvmev_submission_queue *sq =
+							nvmev_vdev->sqes[pe->sqid];
+						ns = &nvmev_vdev->ns[0];
+						if (ns->identify_io_cmd(ns, sq_entry(pe->sq_entry))) {
+							pe->result0 = ns->perform_io_cmd(
+								ns, &sq_entry(pe->sq_entry), &(pe->status));
+						} else {
+							__do_perform_io(pe->sqid, pe->sq_entry);
+						}
 					}
-#endif
 					__do_perform_io(pe->sqid, pe->sq_entry);
 				}
 
 #ifdef PERF_DEBUG
-				pe->nsecs_copy_done = local_clock() + delta;
+				pe->nsecs_copy_done = __get_wallclock();
 				memcpy_time = pe->nsecs_copy_done - pe->nsecs_copy_start;
 #endif
 				pe->is_copied = true;
@@ -629,7 +757,7 @@ static int nvmev_kthread_io(void *data)
 					    pe->sqid, pe->cqid, pe->sq_entry);
 
 #ifdef PERF_DEBUG
-				pe->nsecs_cq_filled = local_clock() + delta;
+				pe->nsecs_cq_filled = __get_wallclock();
 				trace_printk("%llu %llu %llu %llu %llu %llu\n", pe->nsecs_start,
 					     pe->nsecs_enqueue - pe->nsecs_start,
 					     pe->nsecs_copy_start - pe->nsecs_start,
@@ -639,11 +767,18 @@ static int nvmev_kthread_io(void *data)
 #endif
 				mb(); /* Reclaimer shall see after here */
 				pe->is_completed = true;
+			} else {
+				nsecs_next = min(nsecs_next, pe->nsecs_target);
 			}
 
 			curr = pe->next;
 		}
 
+		if (nvmev_clocksource.virt) {
+			atomic_dec(&nvmev_clocksource.nr_scanning);
+			__skip_idle_time(pi, nsecs_next);
+		}
+
 		for (qidx = 1; qidx <= nvmev_vdev->nr_cq; qidx++) {
 			struct nvmev_completion_queue *cq = nvmev_vdev->cqes[qidx];
 
@@ -706,6 +841,8 @@ void NVMEV_IO_PROC_INIT(struct nvmev_dev *nvmev_vdev)
 		pi->free_seq_end = NR_MAX_PARALLEL_IO - 1;
 		pi->io_seq = -1;
 		pi->io_seq_end = -1;
+		pi->nsecs_next = ULLONG_MAX;
+		pi->nsecs_enqueued = ULLONG_MAX;
 
 		snprintf(pi->thread_name, sizeof(pi->thread_name), "nvmev_io_worker_%d", proc_idx);
 
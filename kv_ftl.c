@@ -21,7 +21,7 @@ static const struct allocator_ops bitmap_ops = {
 
 static inline unsigned long long __get_wallclock(void)
 {
-	return cpu_clock(nvmev_vdev->config.cpu_nr_dispatcher);
+	return nvmev_clock();
 }
 
 static size_t __cmd_io_size(struct nvme_rw_command *cmd)
@@ -1053,6 +1053,8 @@ void kv_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *ma
 	ns->ftls = (void *)kv_ftl;
 	ns->size = size;
 	ns->mapped = mapped_addr;
+	ns->lba_shift = 9;
+	ns->format = NULL;
 	/*register io command handler*/
 	ns->proc_io_cmd = kv_proc_nvme_io_cmd;
 	/*register CSS specific io command functions*/
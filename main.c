@@ -55,6 +55,7 @@
  ****************************************************************/
 
 struct nvmev_dev *nvmev_vdev = NULL;
+struct nvmev_clocksource nvmev_clocksource;
 
 static unsigned long memmap_start = 0;
 static unsigned long memmap_size = 0;
@@ -72,8 +73,120 @@ static unsigned int io_unit_shift = 12;
 
 static char *cpus;
 static unsigned int debug = 0;
+static bool virtual_time = false;
+static char *profile;
+static char *ns_types;
 
 int io_using_dma = false;
+bool hotcold_separation = false;
+
+int nvmev_ns_ssd_type[NVMEV_MAX_NAMESPACES] = { NS_SSD_TYPE_0, NS_SSD_TYPE_1 };
+static unsigned int nr_namespaces = NR_NAMESPACES;
+
+#if (BASE_SSD == HYBRID_SSD)
+DEFINE_STATIC_KEY_TRUE(nvmev_hybrid_key);
+#else
+DEFINE_STATIC_KEY_FALSE(nvmev_hybrid_key);
+#endif
+DEFINE_STATIC_KEY_FALSE(nvmev_kv_key);
+
+const struct nand_profile *nvmev_nand_profile;
+
+static const struct nand_profile nand_970pro = {
+	.cell_mode = CELL_MODE_TLC,
+	.nchs = 8,
+	.luns_per_ch = 2,
+	.pls_per_lun = 1,
+	.flashpg_size = KB(32),
+	.oneshotpg_size = KB(32),
+	.blks_per_pl = 8192,
+	.ch_bandwidth = 800,
+	.write_buffer_size = 8 * 2 * KB(32) * 2,
+
+	.pg_4kb_rd_lat = { 35760 - 6000, 35760, 35760 + 6000, 35760 + 6000 },
+	.pg_rd_lat = { 36013 - 6000, 36013, 36013 + 6000, 36013 + 6000 },
+	.pg_wr_lat = 185000,
+	.blk_er_lat = 0,
+	.max_ch_xfer_size = KB(16),
+	.fw_4kb_rd_lat = 21500,
+	.fw_rd_lat = 30490,
+	.fw_wbuf_lat0 = 4000,
+	.fw_wbuf_lat1 = 460,
+	.fw_ch_xfer_lat = 0,
+};
+
+static const struct nand_profile nand_zn540 = {
+	.cell_mode = CELL_MODE_TLC,
+	.nchs = 8,
+	.luns_per_ch = 4,
+	.pls_per_lun = 1,
+	.flashpg_size = KB(32),
+	.oneshotpg_size = KB(32) * 3,
+	.blk_size = GB(2) / (8 * 4), /* a zone spans every die */
+	.zone_size = GB(2),
+	.dies_per_zone = 8 * 4,
+	.ch_bandwidth = 450,
+	.write_buffer_size = 8 * 4 * KB(32) * 3 * 2,
+
+	.pg_4kb_rd_lat = { 35760 - 6000, 35760, 35760 + 6000, 35760 + 6000 },
+	.pg_rd_lat = { 36013 - 6000, 36013, 36013 + 6000, 36013 + 6000 },
+	.pg_wr_lat = 185000 + 5000,
+	.blk_er_lat = 0,
+	.max_ch_xfer_size = KB(32),
+	.fw_4kb_rd_lat = 21500,
+	.fw_rd_lat = 30490,
+	.fw_wbuf_lat0 = 4000,
+	.fw_wbuf_lat1 = 460,
+	.fw_ch_xfer_lat = 0,
+};
+
+/* QLC array, SLC blocks and the split take the HYBRID_* settings */
+static const struct nand_profile nand_hybrid = {
+	.cell_mode = CELL_MODE_QLC,
+	.nchs = HYBRID_SLC_CHANNELS + HYBRID_QLC_CHANNELS,
+	.luns_per_ch = HYBRID_LUNS_PER_CH,
+	.pls_per_lun = 1,
+	.flashpg_size = KB(4) * HYBRID_QLC_PGS_PER_ONESHOTPG,
+	.oneshotpg_size = KB(4) * HYBRID_QLC_PGS_PER_ONESHOTPG,
+	.blks_per_pl = HYBRID_QLC_BLKS_PER_PL,
+	.ch_bandwidth = 800,
+	.write_buffer_size = (HYBRID_SLC_CHANNELS + HYBRID_QLC_CHANNELS) * HYBRID_LUNS_PER_CH *
+			     KB(4) * HYBRID_QLC_PGS_PER_ONESHOTPG * 2,
+
+	.pg_4kb_rd_lat = { HYBRID_QLC_LSB_READ_LATENCY, HYBRID_QLC_CSB_READ_LATENCY,
+			   HYBRID_QLC_MSB_READ_LATENCY, HYBRID_QLC_TSB_READ_LATENCY },
+	.pg_rd_lat = { HYBRID_QLC_LSB_READ_LATENCY, HYBRID_QLC_CSB_READ_LATENCY,
+		       HYBRID_QLC_MSB_READ_LATENCY, HYBRID_QLC_TSB_READ_LATENCY },
+	.pg_wr_lat = HYBRID_QLC_WRITE_LATENCY,
+	.blk_er_lat = HYBRID_QLC_ERASE_LATENCY,
+	.max_ch_xfer_size = KB(16),
+	.fw_4kb_rd_lat = 21500,
+	.fw_rd_lat = 30490,
+	.fw_wbuf_lat0 = 4000,
+	.fw_wbuf_lat1 = 460,
+	.fw_ch_xfer_lat = 0,
+};
+
+/* device profiles, a module built with CONFIG_NVMEVIRT_ALL can be loaded as any of them */
+static const struct {
+	const char *name;
+	int ssd_type; /* of namespaces ns_types leaves out */
+	bool hybrid;
+	const struct nand_profile *nand; /* NULL for FTLs without a NAND model */
+} nvmev_profiles[] = {
+	{ "optane", SSD_TYPE_NVM, false, NULL },
+	{ "970pro", SSD_TYPE_CONV, false, &nand_970pro },
+	{ "zn540", SSD_TYPE_ZNS, false, &nand_zn540 },
+	{ "kv", SSD_TYPE_KV, false, NULL },
+	{ "hybrid", SSD_TYPE_CONV, true, &nand_hybrid },
+};
+
+static const char *const ssd_type_names[] = {
+	[SSD_TYPE_NVM] = "nvm",
+	[SSD_TYPE_CONV] = "conv",
+	[SSD_TYPE_ZNS] = "zns",
+	[SSD_TYPE_KV] = "kv",
+};
 
 static int set_parse_mem_param(const char *val, const struct kernel_param *kp)
 {
@@ -110,6 +223,14 @@ MODULE_PARM_DESC(io_unit_shift, "Size of each I/O unit (2^)");
 module_param(cpus, charp, 0444);
 MODULE_PARM_DESC(cpus, "CPU list for process, completion(int.) threads, Seperated by Comma(,)");
 module_param(debug, uint, 0644);
+module_param(hotcold_separation, bool, 0644);
+MODULE_PARM_DESC(hotcold_separation, "Separate hot and cold user writes without host hints (conv FTL)");
+module_param(virtual_time, bool, 0444);
+MODULE_PARM_DESC(virtual_time, "Skip device idle time instead of waiting it out, for aging runs");
+module_param(profile, charp, 0444);
+MODULE_PARM_DESC(profile, "Device profile: optane, 970pro, zn540, kv or hybrid (default: BASE_SSD)");
+module_param(ns_types, charp, 0444);
+MODULE_PARM_DESC(ns_types, "FTL of each namespace: nvm, conv, zns or kv, Seperated by Comma(,)");
 
 static void nvmev_proc_dbs(void)
 {
@@ -117,6 +238,7 @@ static void nvmev_proc_dbs(void)
 	int dbs_idx;
 	int new_db;
 	int old_db;
+	bool drained = true;
 
 	// Admin queue
 	new_db = nvmev_vdev->dbs[0];
@@ -138,10 +260,20 @@ static void nvmev_proc_dbs(void)
 		new_db = nvmev_vdev->dbs[dbs_idx];
 		old_db = nvmev_vdev->old_dbs[dbs_idx];
 		if (new_db != old_db) {
+			if (nvmev_clocksource.virt) {
+				/* no clock skip while the new entries are on their way to the workers */
+				WRITE_ONCE(nvmev_clocksource.sqs_drained, false);
+				smp_mb();
+			}
 			nvmev_vdev->old_dbs[dbs_idx] = nvmev_proc_io_sq(qid, new_db, old_db);
 		}
+		drained &= (nvmev_vdev->old_dbs[dbs_idx] == new_db);
 	}
 
+	/* whatever was fetched has its target published by now, see __publish_target() */
+	if (nvmev_clocksource.virt && drained)
+		smp_store_release(&nvmev_clocksource.sqs_drained, true);
+
 	// Completion queues
 	for (qid = 1; qid <= nvmev_vdev->nr_cq; qid++) {
 		if (nvmev_vdev->cqes[qid] == NULL)
@@ -254,6 +386,89 @@ static int __validate_configs(void)
 	return 0;
 }
 
+/* FTLs linked into this module */
+static bool __ssd_type_built(int type)
+{
+	return NVMEV_ALL_FTLS || type == NS_SSD_TYPE_0 || type == NS_SSD_TYPE_1;
+}
+
+static int __select_profile(void)
+{
+	bool hybrid = (BASE_SSD == HYBRID_SSD), kv = false;
+	char *name;
+	int i, type;
+
+	if (profile) {
+		for (i = 0; i < ARRAY_SIZE(nvmev_profiles); i++) {
+			if (strcmp(profile, nvmev_profiles[i].name) == 0)
+				break;
+		}
+		if (i == ARRAY_SIZE(nvmev_profiles)) {
+			NVMEV_ERROR("[profile] unknown profile %s\n", profile);
+			return -EINVAL;
+		}
+		hybrid = nvmev_profiles[i].hybrid;
+		nvmev_nand_profile = nvmev_profiles[i].nand;
+		for (type = 0; type < NVMEV_MAX_NAMESPACES; type++)
+			nvmev_ns_ssd_type[type] = nvmev_profiles[i].ssd_type;
+	}
+
+	if (ns_types) {
+		/* strsep() cuts up its input, keep the parameter intact for sysfs */
+		char *types = kstrdup(ns_types, GFP_KERNEL);
+		char *cur = types;
+		int ret = 0;
+
+		if (!types)
+			return -ENOMEM;
+
+		nr_namespaces = 0;
+		while ((name = strsep(&cur, ",")) != NULL) {
+			if (nr_namespaces == NVMEV_MAX_NAMESPACES) {
+				NVMEV_ERROR("[ns_types] at most %d namespaces\n", NVMEV_MAX_NAMESPACES);
+				ret = -EINVAL;
+				break;
+			}
+			type = match_string(ssd_type_names, ARRAY_SIZE(ssd_type_names), name);
+			if (type < 0) {
+				NVMEV_ERROR("[ns_types] unknown FTL %s\n", name);
+				ret = -EINVAL;
+				break;
+			}
+			nvmev_ns_ssd_type[nr_namespaces++] = type;
+		}
+		kfree(types);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < nr_namespaces; i++) {
+		if (!__ssd_type_built(nvmev_ns_ssd_type[i])) {
+			NVMEV_ERROR("%s FTL of namespace %d is not built in, see CONFIG_NVMEVIRT_ALL\n",
+				    ssd_type_names[nvmev_ns_ssd_type[i]], i);
+			return -EINVAL;
+		}
+		kv |= (nvmev_ns_ssd_type[i] == SSD_TYPE_KV);
+	}
+
+	/* KV commands may come with nsid 0, so the namespace can't be shared */
+	if (kv && nr_namespaces > 1) {
+		NVMEV_ERROR("KV namespace can't be mixed with others\n");
+		return -EINVAL;
+	}
+
+	if (hybrid)
+		static_branch_enable(&nvmev_hybrid_key);
+	else
+		static_branch_disable(&nvmev_hybrid_key);
+	if (kv)
+		static_branch_enable(&nvmev_kv_key);
+
+	NVMEV_INFO("Profile %s%s, %u namespace(s)\n", profile ? profile : "default",
+		   hybrid ? " (hybrid SLC/QLC)" : "", nr_namespaces);
+	return 0;
+}
+
 static void __print_perf_configs(void)
 {
 #ifdef CONFIG_NVMEV_VERBOSE
@@ -286,6 +501,53 @@ static int __get_nr_entries(int dbs_idx, int queue_size)
 	return diff;
 }
 
+#if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
+/* NAND model instance @part of namespace @nsid, NULL for FTLs without one */
+static struct ssd *__ns_ssd(int nsid, uint32_t part)
+{
+	struct nvmev_ns *ns = &nvmev_vdev->ns[nsid];
+
+	if (part >= ns->nr_parts)
+		return NULL;
+
+	if (SUPPORTED_SSD_TYPE(CONV) && NS_SSD_TYPE(nsid) == SSD_TYPE_CONV)
+		return ((struct conv_ftl *)ns->ftls)[part].ssd;
+	if (SUPPORTED_SSD_TYPE(ZNS) && NS_SSD_TYPE(nsid) == SSD_TYPE_ZNS)
+		return ((struct zns_ftl *)ns->ftls)[part].ssd;
+	return NULL;
+}
+#endif
+
+/* every partition gets the same profile, checked as a whole before any is changed */
+static int __set_latency_profile(const char *input)
+{
+	int ret = -ENODEV; /* no namespace with a NAND model */
+#if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
+	struct ssd_latency lat;
+	struct ssd *ssd;
+	uint32_t part;
+	int i;
+
+	for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+		ssd = __ns_ssd(i, 0);
+		if (!ssd)
+			continue;
+
+		ssd_get_latency(ssd, &lat);
+		ret = ssd_parse_latency(&lat, input);
+		if (ret)
+			return ret;
+
+		for (part = 0; (ssd = __ns_ssd(i, part)) != NULL; part++) {
+			ret = ssd_set_latency(ssd, &lat);
+			if (ret)
+				return ret;
+		}
+	}
+#endif
+	return ret;
+}
+
 static int __proc_file_read(struct seq_file *m, void *data)
 {
 	const char *filename = m->private;
@@ -325,6 +587,29 @@ static int __proc_file_read(struct seq_file *m, void *data)
 		}
 		seq_printf(m, "total: %u %u %u %llu\n", nr_in_flight, nr_dispatch, nr_dispatched,
 			   total_io);
+		if (nvmev_clocksource.virt)
+			seq_printf(m, "virtual time: %llu ns skipped\n",
+				   (u64)atomic64_read(&nvmev_clocksource.virt_offset));
+	} else if (strcmp(filename, "ftl_stat") == 0) {
+		int i;
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			if (SUPPORTED_SSD_TYPE(CONV) && NS_SSD_TYPE(i) == SSD_TYPE_CONV)
+				conv_print_stats(&nvmev_vdev->ns[i], m);
+		}
+	} else if (strcmp(filename, "latency_profile") == 0) {
+#if (SUPPORTED_SSD_TYPE(CONV) || SUPPORTED_SSD_TYPE(ZNS))
+		int i;
+
+		for (i = 0; i < nvmev_vdev->nr_ns; i++) {
+			struct ssd *ssd = __ns_ssd(i, 0);
+
+			if (!ssd)
+				continue;
+			seq_printf(m, "ns %d:\n", i);
+			ssd_print_latency(ssd, m);
+		}
+#endif
 	} else if (strcmp(filename, "debug") == 0) {
 		/* Left for later use */
 	}
@@ -337,22 +622,38 @@ static ssize_t __proc_file_write(struct file *file, const char __user *buf, size
 {
 	ssize_t count = len;
 	const char *filename = file->f_path.dentry->d_name.name;
-	char input[128];
+	char input[256];
 	unsigned int ret;
 	unsigned long long *old_stat;
 	struct nvmev_config *cfg = &nvmev_vdev->config;
 	size_t nr_copied;
 
-	nr_copied = copy_from_user(input, buf, min(len, sizeof(input)));
+	/* a whole profile doesn't fit in input[], take it as is up to a page */
+	if (!strcmp(filename, "latency_profile")) {
+		char *profile_input;
+		int err;
+
+		if (len >= PAGE_SIZE)
+			return -EINVAL;
+
+		profile_input = memdup_user_nul(buf, len);
+		if (IS_ERR(profile_input))
+			return PTR_ERR(profile_input);
+
+		err = __set_latency_profile(profile_input);
+		kfree(profile_input);
+		return err ? err : count;
+	}
+
+	nr_copied = copy_from_user(input, buf, min(len, sizeof(input) - 1));
+	input[min(len, sizeof(input) - 1) - nr_copied] = '\0';
 
 	if (!strcmp(filename, "read_times")) {
 		ret = sscanf(input, "%u %u %u", &cfg->read_delay, &cfg->read_time,
 			     &cfg->read_trailing);
-		//adjust_ftl_latency(0, cfg->read_time);
 	} else if (!strcmp(filename, "write_times")) {
 		ret = sscanf(input, "%u %u %u", &cfg->write_delay, &cfg->write_time,
 			     &cfg->write_trailing);
-		//adjust_ftl_latency(1, cfg->write_time);
 	} else if (!strcmp(filename, "io_units")) {
 		ret = sscanf(input, "%d %d", &cfg->nr_io_units, &cfg->io_unit_shift);
 		if (ret < 1)
@@ -431,6 +732,10 @@ void NVMEV_STORAGE_INIT(struct nvmev_dev *nvmev_vdev)
 		proc_create("io_units", 0664, nvmev_vdev->proc_root, &proc_file_fops);
 	nvmev_vdev->proc_stat = proc_create("stat", 0444, nvmev_vdev->proc_root, &proc_file_fops);
 	nvmev_vdev->proc_stat = proc_create("debug", 0444, nvmev_vdev->proc_root, &proc_file_fops);
+	nvmev_vdev->proc_ftl_stat =
+		proc_create("ftl_stat", 0444, nvmev_vdev->proc_root, &proc_file_fops);
+	nvmev_vdev->proc_latency_profile =
+		proc_create("latency_profile", 0664, nvmev_vdev->proc_root, &proc_file_fops);
 }
 
 void NVMEV_STORAGE_FINAL(struct nvmev_dev *nvmev_vdev)
@@ -440,6 +745,8 @@ void NVMEV_STORAGE_FINAL(struct nvmev_dev *nvmev_vdev)
 	remove_proc_entry("io_units", nvmev_vdev->proc_root);
 	remove_proc_entry("stat", nvmev_vdev->proc_root);
 	remove_proc_entry("debug", nvmev_vdev->proc_root);
+	remove_proc_entry("ftl_stat", nvmev_vdev->proc_root);
+	remove_proc_entry("latency_profile", nvmev_vdev->proc_root);
 
 	remove_proc_entry("nvmev", NULL);
 
@@ -460,8 +767,13 @@ static bool __load_configs(struct nvmev_config *config)
 		return false;
 	}
 
-#if (BASE_SSD == KV_PROTOTYPE)
-	memmap_size -= KV_MAPPING_TABLE_SIZE; // Reserve space for KV mapping table
+	if (__select_profile() < 0) {
+		return false;
+	}
+
+#if (SUPPORTED_SSD_TYPE(KV))
+	if (nvmev_kv())
+		memmap_size -= KV_MAPPING_TABLE_SIZE; // Reserve space for KV mapping table
 #endif
 
 	config->memmap_start = memmap_start;
@@ -500,7 +812,7 @@ void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 {
 	unsigned long long remaining_capacity = nvmev_vdev->config.storage_size;
 	void *ns_addr = nvmev_vdev->storage_mapped;
-	const int nr_ns = NR_NAMESPACES; // XXX: allow for dynamic nr_ns
+	const int nr_ns = nr_namespaces;
 	const unsigned int disp_no = nvmev_vdev->config.cpu_nr_dispatcher;
 	int i;
 	unsigned long long size;
@@ -513,13 +825,13 @@ void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 		else
 			size = min(NS_CAPACITY(i), remaining_capacity);
 
-		if (NS_SSD_TYPE(i) == SSD_TYPE_NVM)
+		if (SUPPORTED_SSD_TYPE(NVM) && NS_SSD_TYPE(i) == SSD_TYPE_NVM)
 			simple_init_namespace(&ns[i], i, size, ns_addr, disp_no);
-		else if (NS_SSD_TYPE(i) == SSD_TYPE_CONV)
+		else if (SUPPORTED_SSD_TYPE(CONV) && NS_SSD_TYPE(i) == SSD_TYPE_CONV)
 			conv_init_namespace(&ns[i], i, size, ns_addr, disp_no);
-		else if (NS_SSD_TYPE(i) == SSD_TYPE_ZNS)
+		else if (SUPPORTED_SSD_TYPE(ZNS) && NS_SSD_TYPE(i) == SSD_TYPE_ZNS)
 			zns_init_namespace(&ns[i], i, size, ns_addr, disp_no);
-		else if (NS_SSD_TYPE(i) == SSD_TYPE_KV)
+		else if (SUPPORTED_SSD_TYPE(KV) && NS_SSD_TYPE(i) == SSD_TYPE_KV)
 			kv_init_namespace(&ns[i], i, size, ns_addr, disp_no);
 		else
 			NVMEV_ASSERT(0);
@@ -538,17 +850,17 @@ void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 void NVMEV_NAMESPACE_FINAL(struct nvmev_dev *nvmev_vdev)
 {
 	struct nvmev_ns *ns = nvmev_vdev->ns;
-	const int nr_ns = NR_NAMESPACES; // XXX: allow for dynamic nvmev_vdev->nr_ns
+	const int nr_ns = nvmev_vdev->nr_ns;
 	int i;
 
 	for (i = 0; i < nr_ns; i++) {
-		if (NS_SSD_TYPE(i) == SSD_TYPE_NVM)
+		if (SUPPORTED_SSD_TYPE(NVM) && NS_SSD_TYPE(i) == SSD_TYPE_NVM)
 			simple_remove_namespace(&ns[i]);
-		else if (NS_SSD_TYPE(i) == SSD_TYPE_CONV)
+		else if (SUPPORTED_SSD_TYPE(CONV) && NS_SSD_TYPE(i) == SSD_TYPE_CONV)
 			conv_remove_namespace(&ns[i]);
-		else if (NS_SSD_TYPE(i) == SSD_TYPE_ZNS)
+		else if (SUPPORTED_SSD_TYPE(ZNS) && NS_SSD_TYPE(i) == SSD_TYPE_ZNS)
 			zns_remove_namespace(&ns[i]);
-		else if (NS_SSD_TYPE(i) == SSD_TYPE_KV)
+		else if (SUPPORTED_SSD_TYPE(KV) && NS_SSD_TYPE(i) == SSD_TYPE_KV)
 			kv_remove_namespace(&ns[i]);
 		else
 			NVMEV_ASSERT(0);
@@ -558,10 +870,50 @@ void NVMEV_NAMESPACE_FINAL(struct nvmev_dev *nvmev_vdev)
 	nvmev_vdev->ns = NULL;
 }
 
+/* calibrate the TSC against ktime once, fall back to ktime if it may drift */
+void nvmev_clock_init(bool virt)
+{
+	struct nvmev_clocksource *cs = &nvmev_clocksource;
+
+	cs->virt = virt;
+	atomic64_set(&cs->virt_offset, 0);
+	cs->sqs_drained = true;
+	atomic_set(&cs->nr_scanning, 0);
+	cs->use_tsc = false;
+#ifdef CONFIG_X86_TSC
+	if (tsc_khz && boot_cpu_has(X86_FEATURE_CONSTANT_TSC) &&
+	    boot_cpu_has(X86_FEATURE_NONSTOP_TSC) && !check_tsc_unstable()) {
+		clocks_calc_mult_shift(&cs->mult, &cs->shift, tsc_khz, NSEC_PER_MSEC, 600);
+		cs->tsc_base = rdtsc();
+		cs->ns_base = ktime_get_ns();
+		cs->use_tsc = true;
+	}
+#endif
+
+	NVMEV_INFO("Timing clock: %s%s\n", cs->use_tsc ? "invariant TSC" : "ktime",
+		   cs->virt ? ", virtual time" : "");
+}
+
+/* move virtual time forward to @target, it never goes back */
+void nvmev_clock_skip(uint64_t target)
+{
+	struct nvmev_clocksource *cs = &nvmev_clocksource;
+	s64 offset, gap;
+
+	do {
+		offset = atomic64_read(&cs->virt_offset);
+		gap = (s64)(target - (__nvmev_clock_real() + offset));
+		if (gap <= 0)
+			return;
+	} while (atomic64_cmpxchg(&cs->virt_offset, offset, offset + gap) != offset);
+}
+
 static int NVMeV_init(void)
 {
 	int ret = 0;
 	
+	nvmev_clock_init(virtual_time);
+
 	nvmev_vdev = VDEV_INIT();
 	if (!nvmev_vdev)
 		return -EINVAL;
@@ -100,7 +100,11 @@ struct nvme_id_ctrl {
 	__u8 mdts;
 	__le16 cntlid;
 	__le32 ver;
-	__u8 rsvd84[172];
+	__le32 rtd3r;
+	__le32 rtd3e;
+	__le32 oaes;
+	__le32 ctratt;
+	__u8 rsvd100[156];
 	__le16 oacs;
 	__u8 acl;
 	__u8 aerl;
@@ -112,7 +116,23 @@ struct nvme_id_ctrl {
 	__u8 apsta;
 	__le16 wctemp;
 	__le16 cctemp;
-	__u8 rsvd270[242];
+	__le16 mtfa;
+	__le32 hmpre;
+	__le32 hmmin;
+	__u8 tnvmcap[16];
+	__u8 unvmcap[16];
+	__le32 rpmbs;
+	__le16 edstt;
+	__u8 dsto;
+	__u8 fwug;
+	__le16 kas;
+	__le16 hctma;
+	__le16 mntmt;
+	__le16 mxtmt;
+	__le32 sanicap;
+	__le32 hmminds;
+	__le16 hmmaxd;
+	__u8 rsvd338[174];
 	__u8 sqes;
 	__u8 cqes;
 	__u8 rsvd514[2];
@@ -126,7 +146,7 @@ struct nvme_id_ctrl {
 	__u8 nvscc;
 	__u8 rsvd531;
 	__le16 acwu;
-	__u8 rsvd534[2];
+	__le16 ocfs;
 	__le32 sgls;
 	__u8 rsvd540[1508];
 	struct nvme_id_power_state psd[32];
@@ -137,7 +157,11 @@ enum {
 	NVME_CTRL_ONCS_COMPARE = 1 << 0,
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE = 1 << 1,
 	NVME_CTRL_ONCS_DSM = 1 << 2,
+	NVME_CTRL_ONCS_COPY = 1 << 8,
+	NVME_CTRL_OCFS_FORMAT0 = 1 << 0,
+	NVME_CTRL_OACS_FORMAT = 1 << 1,
 	NVME_CTRL_VWC_PRESENT = 1 << 0,
+	NVME_CTRL_ATTR_FDPS = 1 << 19,
 };
 
 struct nvme_lbaf {
@@ -166,9 +190,22 @@ struct nvme_id_ns {
 	__le16 nabsn;
 	__le16 nabo;
 	__le16 nabspf;
-	__u16 rsvd46;
+	__le16 noiob;
 	__le64 nvmcap[2];
-	__u8 rsvd64[40];
+	__le16 npwg;
+	__le16 npwa;
+	__le16 npdg;
+	__le16 npda;
+	__le16 nows;
+	__le16 mssrl;
+	__le32 mcl;
+	__u8 msrc;
+	__u8 rsvd81[11];
+	__le32 anagrpid;
+	__u8 rsvd96[3];
+	__u8 nsattr;
+	__le16 nvmsetid;
+	__le16 endgid;
 	__u8 nguid[16];
 	__u8 eui64[8];
 	struct nvme_lbaf lbaf[16];
@@ -191,6 +228,7 @@ struct nvme_lba_format_extension {
 
 enum {
 	NVME_NS_FEAT_THIN = 1 << 0,
+	NVME_NS_FEAT_IO_OPT = 1 << 4,
 	NVME_NS_FLBAS_LBA_MASK = 0xf,
 	NVME_NS_FLBAS_META_EXT = 0x10,
 	NVME_LBAF_RP_BEST = 0,
@@ -248,6 +286,72 @@ struct nvme_effects_log {
 	__u8 resv[2048];
 };
 
+/* Flexible Data Placement */
+enum {
+	NVME_FDP_RUHT_INITIALLY_ISOLATED = 1,
+	NVME_FDP_RUHT_PERSISTENTLY_ISOLATED = 2,
+	NVME_FDP_FDPA_VALID = 1 << 7,
+	NVME_FDP_EVENT_INVALID_PID = 0x03,
+	NVME_FDP_EVENT_MEDIA_REALLOC = 0x80,
+	NVME_FDP_EVENT_PIV = 1 << 0,
+	NVME_FDP_EVENT_NSIDV = 1 << 1,
+	NVME_FDP_EVENT_LV = 1 << 2,
+};
+
+struct nvme_fdp_ruh_desc {
+	__u8 ruht;
+	__u8 rsvd1[3];
+} __packed;
+
+struct nvme_fdp_config_desc {
+	__le16 dsze;
+	__u8 fdpa;
+	__u8 vss;
+	__le32 nrg;
+	__le16 nruh;
+	__le16 maxpids;
+	__le32 nnss;
+	__le64 runs;
+	__le32 erutl;
+	__u8 rsvd28[36];
+	struct nvme_fdp_ruh_desc ruhs[];
+} __packed;
+
+struct nvme_fdp_config_log {
+	__le16 numfdpc;
+	__u8 ver;
+	__u8 rsvd3;
+	__le32 sze;
+	__u8 rsvd8[8];
+	/* followed by numfdpc + 1 configuration descriptors */
+} __packed;
+
+struct nvme_fdp_stats_log {
+	__le64 hbmw[2]; /* host bytes with metadata written */
+	__le64 mbmw[2]; /* media bytes with metadata written */
+	__le64 mbe[2]; /* media bytes erased */
+	__u8 rsvd48[16];
+} __packed;
+
+struct nvme_fdp_event {
+	__u8 type;
+	__u8 fdpef;
+	__le16 pid;
+	__le64 timestamp;
+	__le32 nsid;
+	__u8 tse[16];
+	__le16 rgid;
+	__u8 ruhid;
+	__u8 rsvd35[5];
+	__u8 vs[24];
+} __packed;
+
+struct nvme_fdp_events_log {
+	__le32 nevents;
+	__u8 rsvd4[60];
+	struct nvme_fdp_event events[63];
+} __packed;
+
 enum {
 	NVME_SMART_CRIT_SPARE = 1 << 0,
 	NVME_SMART_CRIT_TEMPERATURE = 1 << 1,
@@ -311,6 +415,7 @@ struct nvme_reservation_status {
 	op(nvme_cmd_resv_report, 0x0e)		\
 	op(nvme_cmd_resv_acquire, 0x11)		\
 	op(nvme_cmd_resv_release, 0x15)		\
+	op(nvme_cmd_copy, 0x19)			\
 	op(nvme_cmd_zone_mgmt_send, 0x79)	\
 	op(nvme_cmd_zone_mgmt_recv, 0x7a)	\
 	op(nvme_cmd_zone_append, 0x7d)
@@ -359,6 +464,38 @@ struct nvme_rw_command {
 	__le16 appmask;
 };
 
+struct nvme_copy_command {
+	__u8 opcode;
+	__u8 flags;
+	__u16 command_id;
+	__le32 nsid;
+	__u64 rsvd2;
+	__le64 metadata;
+	__le64 prp1;
+	__le64 prp2;
+	__le64 sdlba;
+	__u8 nr_range; /* 0's based */
+	__u8 desc_fmt; /* bits 3:0, source range entries format */
+	__le16 control;
+	__le16 rsvd13;
+	__le16 dspec;
+	__le32 ilbrt;
+	__le16 lbat;
+	__le16 lbatm;
+};
+
+/* Source range entry, descriptor format 0 */
+struct nvme_copy_range {
+	__le64 rsvd0;
+	__le64 slba;
+	__le16 nlb; /* 0's based */
+	__le16 rsvd18;
+	__le32 rsvd20;
+	__le32 eilbrt;
+	__le16 elbat;
+	__le16 elbatm;
+};
+
 struct nvme_get_log_page_command {
 	__u8 opcode;
 	__u8 flags;
@@ -371,7 +508,7 @@ struct nvme_get_log_page_command {
 	__u8 lsp; /* upper 4 bits reserved */
 	__le16 numdl;
 	__le16 numdu;
-	__u16 rsvd11;
+	__le16 lsi;
 	union {
 		struct {
 			__le32 lpol;
@@ -387,6 +524,8 @@ struct nvme_get_log_page_command {
 enum {
 	NVME_RW_LR = 1 << 15,
 	NVME_RW_FUA = 1 << 14,
+	NVME_RW_DTYPE_MASK = 0xf << 4,
+	NVME_RW_DTYPE_DPLCMT = 2 << 4, /* data placement, DSPEC holds the placement id */
 //66f1
 	NVME_RW_APPEND				= 1 << 8,
 	NVME_RW_OVERWRITE			= 1 << 9,
@@ -491,6 +630,8 @@ enum {
 	NVME_FEAT_WRITE_ATOMIC = 0x0a,
 	NVME_FEAT_ASYNC_EVENT = 0x0b,
 	NVME_FEAT_AUTO_PST = 0x0c,
+	NVME_FEAT_HOST_MEM_BUF = 0x0d,
+	NVME_FEAT_FDP = 0x1d,
 	NVME_FEAT_SW_PROGRESS = 0x80,
 	NVME_FEAT_HOST_ID = 0x81,
 	NVME_FEAT_RESV_MASK = 0x82,
@@ -505,6 +646,9 @@ enum {
 	NVME_LOG_TELEMETRY_CTRL = 0x08,
 	NVME_LOG_ENDURANCE_GROUP = 0x09,
 	NVME_LOG_ANA = 0x0c,
+	NVME_LOG_FDP_CONFIGS = 0x20,
+	NVME_LOG_FDP_STATS = 0x22,
+	NVME_LOG_FDP_EVENTS = 0x23,
 	NVME_LOG_DISC = 0x70,
 	NVME_LOG_RESERVATION = 0x80,
 	NVME_FWACT_REPL = (0 << 3),
@@ -534,7 +678,22 @@ struct nvme_features {
 	__le64 prp2;
 	__le32 fid;
 	__le32 dword11;
-	__u32 rsvd12[4];
+	__le32 dword12;
+	__le32 dword13;
+	__le32 dword14;
+	__le32 dword15;
+};
+
+/* Host Memory Buffer: dword11 of set features, and one entry of the descriptor list */
+enum {
+	NVME_HOST_MEM_ENABLE = (1 << 0),
+	NVME_HOST_MEM_RETURN = (1 << 1),
+};
+
+struct nvme_host_mem_buf_desc {
+	__le64 addr;
+	__le32 size; /* in memory page size units */
+	__u32 rsvd;
 };
 
 struct nvme_create_cq {
@@ -611,6 +770,7 @@ struct nvme_command {
 	union {
 		struct nvme_common_command common;
 		struct nvme_rw_command rw;
+		struct nvme_copy_command copy;
 		struct nvme_get_log_page_command get_log_page;
 		struct nvme_identify identify;
 		struct nvme_features features;
@@ -5,7 +5,11 @@
 
 #include <linux/pci.h>
 #include <linux/msi.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+#include <linux/jump_label.h>
 #include <asm/apic.h>
+#include <asm/tsc.h>
 
 #include "nvme.h"
 
@@ -30,6 +34,8 @@
 
 #define NR_MAX_IO_QUEUE 72
 #define NR_MAX_PARALLEL_IO 16384
+#define NR_MAX_COPY_RANGES 128 /* one page of format 0 source range entries */
+#define MAX_COPY_RANGE_LBAS 0xFFFF
 
 #define PAGE_OFFSET_MASK (PAGE_SIZE - 1)
 #define PRP_PFN(x) ((unsigned long)((x) >> PAGE_SHIFT))
@@ -48,6 +54,9 @@
 
 #define LBA_TO_BYTE(lba) ((lba) << 9)
 #define BYTE_TO_LBA(byte) ((byte) >> 9)
+/* for namespaces whose LBA format can differ from 512B */
+#define NS_LBA_TO_BYTE(ns, lba) ((lba) << (ns)->lba_shift)
+#define NS_BYTE_TO_LBA(ns, byte) ((byte) >> (ns)->lba_shift)
 
 #define BITMASK32_ALL (0xFFFFFFFF)
 #define BITMASK64_ALL (0xFFFFFFFFFFFFFFFF)
@@ -177,12 +186,31 @@ struct nvmev_proc_info {
 	unsigned int io_seq_end; /* io req tail index */
 
 	unsigned long long proc_io_nsecs;
+	unsigned long long nsecs_next; /* earliest target still pending, for virtual time */
+	unsigned long long nsecs_enqueued; /* earliest target enqueued since the worker looked */
 
 	unsigned int id;
 	struct task_struct *nvmev_io_worker;
 	char thread_name[32];
 };
 
+/* host memory buffer handed over by set features */
+struct nvmev_hmb {
+	bool enabled;
+	uint32_t gen; /* bumped on every enable/disable */
+	uint64_t size; /* bytes */
+	uint32_t nr_descs;
+	struct nvme_host_mem_buf_desc *descs;
+};
+
+/* FDP host events, the newest overwrites the oldest */
+#define NR_FDP_EVENTS (63)
+struct nvmev_fdp_events {
+	uint32_t nr_events;
+	uint32_t next; /* slot of the next event */
+	struct nvme_fdp_event events[NR_FDP_EVENTS];
+};
+
 struct nvmev_dev {
 	struct pci_bus *virt_bus;
 	void *virtDev;
@@ -225,11 +253,16 @@ struct nvmev_dev {
 
 	unsigned int mdts;
 
+	struct nvmev_hmb hmb;
+	struct nvmev_fdp_events fdp_events;
+
 	struct proc_dir_entry *proc_root;
 	struct proc_dir_entry *proc_read_times;
 	struct proc_dir_entry *proc_write_times;
 	struct proc_dir_entry *proc_io_units;
 	struct proc_dir_entry *proc_stat;
+	struct proc_dir_entry *proc_ftl_stat;
+	struct proc_dir_entry *proc_latency_profile;
 
 	unsigned long long *io_unit_stat;
 };
@@ -252,6 +285,7 @@ struct nvmev_ns {
 	uint32_t csi;
 	uint64_t size;
 	void *mapped;
+	uint32_t lba_shift; /* log2 of the LBA data size */
 
 	/*conv ftl or zns or kv*/
 	uint32_t nr_parts; // partitions
@@ -266,13 +300,66 @@ struct nvmev_ns {
 	/*specific CSS io command processor*/
 	unsigned int (*perform_io_cmd)(struct nvmev_ns *ns, struct nvme_command *cmd,
 				       uint32_t *status);
+	/*switch to another LBA data size, NULL if only 512B is supported*/
+	void (*format)(struct nvmev_ns *ns, uint32_t lba_shift);
 };
 
 // VDEV Init, Final Function
 extern struct nvmev_dev *nvmev_vdev;
+
+/* FTL of each namespace, see NS_SSD_TYPE() */
+extern int nvmev_ns_ssd_type[NVMEV_MAX_NAMESPACES];
+
+/* a KV namespace takes every command, whatever nsid the host gives */
+DECLARE_STATIC_KEY_FALSE(nvmev_kv_key);
+#define nvmev_kv() static_branch_unlikely(&nvmev_kv_key)
 struct nvmev_dev *VDEV_INIT(void);
 void VDEV_FINALIZE(struct nvmev_dev *nvmev_vdev);
 
+/*
+ * Clock of the timing model, shared by the dispatcher, the IO workers and
+ * the FTLs. With an invariant TSC a reading is one rdtsc scaled to ns on the
+ * local CPU, otherwise it's ktime_get_ns(). Both count from boot.
+ *
+ * In virtual time mode the clock also jumps ahead whenever the device only
+ * waits for completions, see nvmev_clock_skip().
+ */
+struct nvmev_clocksource {
+	bool use_tsc;
+	u32 mult;
+	u32 shift;
+	u64 tsc_base;
+	u64 ns_base;
+
+	bool virt;
+	atomic64_t virt_offset; /* ns skipped so far */
+	bool sqs_drained; /* the dispatcher found every SQ head == tail */
+	atomic_t nr_scanning; /* IO workers walking their pending entries */
+};
+extern struct nvmev_clocksource nvmev_clocksource;
+void nvmev_clock_init(bool virt);
+void nvmev_clock_skip(uint64_t target);
+
+static inline uint64_t __nvmev_clock_real(void)
+{
+#ifdef CONFIG_X86_TSC
+	struct nvmev_clocksource *cs = &nvmev_clocksource;
+
+	if (likely(cs->use_tsc))
+		return cs->ns_base + mul_u64_u32_shr(rdtsc() - cs->tsc_base, cs->mult, cs->shift);
+#endif
+	return ktime_get_ns();
+}
+
+static inline uint64_t nvmev_clock(void)
+{
+	uint64_t now = __nvmev_clock_real();
+
+	if (unlikely(nvmev_clocksource.virt))
+		now += atomic64_read(&nvmev_clocksource.virt_offset);
+	return now;
+}
+
 // OPS_PCI
 void nvmev_proc_bars(void);
 bool NVMEV_PCI_INIT(struct nvmev_dev *dev);
@@ -287,5 +374,7 @@ void NVMEV_IO_PROC_INIT(struct nvmev_dev *nvmev_vdev);
 void NVMEV_IO_PROC_FINAL(struct nvmev_dev *nvmev_vdev);
 int nvmev_proc_io_sq(int qid, int new_db, int old_db);
 void nvmev_proc_io_cq(int qid, int new_db, int old_db);
+void nvmev_get_copy_range(struct nvme_copy_command *cmd, unsigned int idx,
+			  struct nvme_copy_range *range);
 
 #endif /* _LIB_NVMEV_H */
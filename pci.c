@@ -442,6 +442,9 @@ void VDEV_FINALIZE(struct nvmev_dev *nvmev_vdev)
 	if (nvmev_vdev->old_dbs)
 		kfree(nvmev_vdev->old_dbs);
 
+	if (nvmev_vdev->hmb.descs)
+		kfree(nvmev_vdev->hmb.descs);
+
 	if (nvmev_vdev->admin_q->nvme_cq)
 		kfree(nvmev_vdev->admin_q->nvme_cq);
 
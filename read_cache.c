@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+
+#include "nvmev.h"
+#include "read_cache.h"
+
+static inline struct hlist_head *__bucket(struct read_cache *rc, uint64_t key)
+{
+	return &rc->buckets[hash_64(key, rc->hash_bits)];
+}
+
+static struct read_cache_entry *__find(struct read_cache *rc, uint64_t key)
+{
+	struct read_cache_entry *e;
+
+	hlist_for_each_entry(e, __bucket(rc, key), hnode) {
+		if (e->key == key)
+			return e;
+	}
+	return NULL;
+}
+
+static void __evict(struct read_cache *rc, struct read_cache_entry *e)
+{
+	if (e->prefetched)
+		rc->prefetch_wasted++;
+
+	hlist_del_init(&e->hnode);
+	list_del_init(&e->lru);
+	e->valid = false;
+	e->referenced = false;
+	e->prefetched = false;
+	list_add(&e->lru, &rc->free_list);
+	rc->nr_used--;
+}
+
+/* second chance: skip and clear referenced entries until an unreferenced one shows up */
+static struct read_cache_entry *__clock_victim(struct read_cache *rc)
+{
+	struct read_cache_entry *e;
+
+	while (true) {
+		e = &rc->entries[rc->clock_hand];
+		rc->clock_hand = (rc->clock_hand + 1) % rc->nr_entries;
+
+		if (!e->valid)
+			continue;
+
+		if (!e->referenced)
+			return e;
+
+		e->referenced = false;
+	}
+}
+
+void read_cache_init(struct read_cache *rc, uint32_t nr_entries, int policy)
+{
+	uint32_t i;
+
+	rc->policy = policy;
+	rc->nr_entries = nr_entries;
+	rc->nr_used = 0;
+	rc->clock_hand = 0;
+	rc->hits = 0;
+	rc->misses = 0;
+	rc->invalidations = 0;
+	rc->prefetches = 0;
+	rc->prefetch_hits = 0;
+	rc->prefetch_wasted = 0;
+	INIT_LIST_HEAD(&rc->lru_list);
+	INIT_LIST_HEAD(&rc->free_list);
+
+	if (nr_entries == 0) {
+		rc->entries = NULL;
+		rc->buckets = NULL;
+		return;
+	}
+
+	rc->hash_bits = ilog2(roundup_pow_of_two(nr_entries));
+	rc->entries = vmalloc(sizeof(struct read_cache_entry) * nr_entries);
+	rc->buckets = vmalloc(sizeof(struct hlist_head) * (1UL << rc->hash_bits));
+	NVMEV_ASSERT(rc->entries && rc->buckets);
+
+	for (i = 0; i < (1U << rc->hash_bits); i++)
+		INIT_HLIST_HEAD(&rc->buckets[i]);
+
+	for (i = 0; i < nr_entries; i++) {
+		struct read_cache_entry *e = &rc->entries[i];
+
+		e->valid = false;
+		e->referenced = false;
+		e->prefetched = false;
+		INIT_HLIST_NODE(&e->hnode);
+		list_add_tail(&e->lru, &rc->free_list);
+	}
+
+	NVMEV_INFO("[%s] %u entries, policy %s\n", __func__, nr_entries,
+		   policy == READ_CACHE_CLOCK ? "clock" : "lru");
+}
+
+void read_cache_remove(struct read_cache *rc)
+{
+	if (rc->entries)
+		vfree(rc->entries);
+	if (rc->buckets)
+		vfree(rc->buckets);
+	rc->entries = NULL;
+	rc->buckets = NULL;
+	rc->nr_entries = 0;
+}
+
+/*
+ * Hit only if every requested mapping page of the flash page is cached. The
+ * data may still be on its way in if the entry was prefetched, see nsecs_ready.
+ */
+struct read_cache_entry *read_cache_lookup(struct read_cache *rc, uint64_t key, uint32_t pg_mask)
+{
+	struct read_cache_entry *e;
+
+	if (!read_cache_enabled(rc))
+		return NULL;
+
+	e = __find(rc, key);
+	if (!e || (e->pg_mask & pg_mask) != pg_mask) {
+		rc->misses++;
+		return NULL;
+	}
+
+	if (rc->policy == READ_CACHE_CLOCK)
+		e->referenced = true;
+	else
+		list_move(&e->lru, &rc->lru_list);
+
+	if (e->prefetched) {
+		e->prefetched = false;
+		rc->prefetch_hits++;
+	}
+
+	rc->hits++;
+	return e;
+}
+
+/* lookup without touching the replacement state or the counters */
+bool read_cache_contains(struct read_cache *rc, uint64_t key, uint32_t pg_mask)
+{
+	struct read_cache_entry *e;
+
+	if (!read_cache_enabled(rc))
+		return false;
+
+	e = __find(rc, key);
+	return e && (e->pg_mask & pg_mask) == pg_mask;
+}
+
+static struct read_cache_entry *__insert(struct read_cache *rc, uint64_t key, uint32_t pg_mask)
+{
+	struct read_cache_entry *e;
+
+	e = __find(rc, key);
+	if (e) {
+		e->pg_mask |= pg_mask;
+		return e;
+	}
+
+	if (list_empty(&rc->free_list)) {
+		if (rc->policy == READ_CACHE_CLOCK)
+			e = __clock_victim(rc);
+		else
+			e = list_last_entry(&rc->lru_list, struct read_cache_entry, lru);
+		__evict(rc, e);
+	}
+
+	e = list_first_entry(&rc->free_list, struct read_cache_entry, lru);
+	list_move(&e->lru, &rc->lru_list);
+	e->key = key;
+	e->pg_mask = pg_mask;
+	e->nsecs_ready = 0;
+	e->valid = true;
+	e->referenced = false;
+	e->prefetched = false;
+	hlist_add_head(&e->hnode, __bucket(rc, key));
+	rc->nr_used++;
+
+	return e;
+}
+
+void read_cache_insert(struct read_cache *rc, uint64_t key, uint32_t pg_mask)
+{
+	if (!read_cache_enabled(rc))
+		return;
+
+	__insert(rc, key, pg_mask);
+}
+
+/* insert a flash page read ahead of the host, usable once it's sensed and transferred */
+void read_cache_prefetch(struct read_cache *rc, uint64_t key, uint32_t pg_mask,
+			 uint64_t nsecs_ready)
+{
+	struct read_cache_entry *e;
+
+	if (!read_cache_enabled(rc))
+		return;
+
+	e = __insert(rc, key, pg_mask);
+	e->nsecs_ready = max(e->nsecs_ready, nsecs_ready);
+	e->prefetched = true;
+	rc->prefetches++;
+}
+
+void read_cache_invalidate(struct read_cache *rc, uint64_t key)
+{
+	struct read_cache_entry *e;
+
+	if (!read_cache_enabled(rc))
+		return;
+
+	e = __find(rc, key);
+	if (e) {
+		__evict(rc, e);
+		rc->invalidations++;
+	}
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef _NVMEVIRT_READ_CACHE_H
+#define _NVMEVIRT_READ_CACHE_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+/* Replacement policy of the controller read cache */
+enum {
+	READ_CACHE_LRU = 0,
+	READ_CACHE_CLOCK = 1,
+};
+
+struct read_cache_entry {
+	uint64_t key; /* flash page in the SSD */
+	uint32_t pg_mask; /* mapping pages of the flash page held in the cache */
+	uint64_t nsecs_ready; /* when the data is in DRAM, prefetches land in the background */
+	struct hlist_node hnode;
+	struct list_head lru;
+	bool valid;
+	bool referenced; /* CLOCK reference bit */
+	bool prefetched; /* brought in by read-ahead and not read by the host yet */
+};
+
+struct read_cache {
+	int policy;
+	uint32_t nr_entries;
+	uint32_t nr_used;
+	uint32_t hash_bits;
+
+	struct read_cache_entry *entries;
+	struct hlist_head *buckets;
+	struct list_head lru_list; /* most recently used first */
+	struct list_head free_list;
+	uint32_t clock_hand;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t invalidations;
+
+	uint64_t prefetches; /* flash pages read ahead */
+	uint64_t prefetch_hits; /* prefetched flash pages the host read */
+	uint64_t prefetch_wasted; /* prefetched flash pages evicted unread */
+};
+
+void read_cache_init(struct read_cache *rc, uint32_t nr_entries, int policy);
+void read_cache_remove(struct read_cache *rc);
+struct read_cache_entry *read_cache_lookup(struct read_cache *rc, uint64_t key, uint32_t pg_mask);
+bool read_cache_contains(struct read_cache *rc, uint64_t key, uint32_t pg_mask);
+void read_cache_insert(struct read_cache *rc, uint64_t key, uint32_t pg_mask);
+void read_cache_prefetch(struct read_cache *rc, uint64_t key, uint32_t pg_mask,
+			 uint64_t nsecs_ready);
+void read_cache_invalidate(struct read_cache *rc, uint64_t key);
+
+static inline bool read_cache_enabled(struct read_cache *rc)
+{
+	return rc->nr_entries > 0;
+}
+#endif
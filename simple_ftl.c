@@ -7,24 +7,24 @@
 
 static inline unsigned long long __get_wallclock(void)
 {
-	return cpu_clock(nvmev_vdev->config.cpu_nr_dispatcher);
+	return nvmev_clock();
 }
 
-static size_t __cmd_io_size(struct nvme_rw_command *cmd)
+static size_t __cmd_io_size(struct nvmev_ns *ns, struct nvme_rw_command *cmd)
 {
 	NVMEV_DEBUG("%d lba %llu length %d, %llx %llx\n", cmd->opcode, cmd->slba, cmd->length,
 		    cmd->prp1, cmd->prp2);
 
-	return (cmd->length + 1) << 9;
+	return NS_LBA_TO_BYTE(ns, cmd->length + 1);
 }
 
 /* Return the time to complete */
-static unsigned long long __schedule_io_units(int opcode, unsigned long lba, unsigned int length,
+static unsigned long long __schedule_io_units(int opcode, uint64_t offset, unsigned int length,
 					      unsigned long long nsecs_start)
 {
 	unsigned int io_unit_size = 1 << nvmev_vdev->config.io_unit_shift;
 	unsigned int io_unit =
-		(lba >> (nvmev_vdev->config.io_unit_shift - 9)) % nvmev_vdev->config.nr_io_units;
+		(offset >> nvmev_vdev->config.io_unit_shift) % nvmev_vdev->config.nr_io_units;
 	int nr_io_units = min(nvmev_vdev->config.nr_io_units, DIV_ROUND_UP(length, io_unit_size));
 
 	unsigned long long latest; /* Time of completion */
@@ -78,14 +78,14 @@ bool simple_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req,
 	struct nvme_command *cmd = req->cmd;
 
 	NVMEV_ASSERT(ns->csi == NVME_CSI_NVM);
-	BUG_ON(BASE_SSD != INTEL_OPTANE);
+	BUG_ON(NS_SSD_TYPE(ns->id) != SSD_TYPE_NVM);
 
 	switch (cmd->common.opcode) {
 	case nvme_cmd_write:
 	case nvme_cmd_read:
 		ret->nsecs_target = __schedule_io_units(
-			cmd->common.opcode, cmd->rw.slba,
-			__cmd_io_size((struct nvme_rw_command *)cmd), __get_wallclock());
+			cmd->common.opcode, NS_LBA_TO_BYTE(ns, cmd->rw.slba),
+			__cmd_io_size(ns, (struct nvme_rw_command *)cmd), __get_wallclock());
 		break;
 	case nvme_cmd_flush:
 		ret->nsecs_target = __schedule_flush(req);
@@ -99,6 +99,12 @@ bool simple_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req,
 	return true;
 }
 
+/* the I/O units are byte-addressed, only the LBA size changes */
+static void simple_format(struct nvmev_ns *ns, uint32_t lba_shift)
+{
+	ns->lba_shift = lba_shift;
+}
+
 void simple_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *mapped_addr,
 			   uint32_t cpu_nr_dispatcher)
 {
@@ -106,7 +112,9 @@ void simple_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void
 	ns->csi = NVME_CSI_NVM;
 	ns->size = size;
 	ns->mapped = mapped_addr;
+	ns->lba_shift = LBA_BITS;
 	ns->proc_io_cmd = simple_proc_nvme_io_cmd;
+	ns->format = simple_format;
 
 	return;
 }
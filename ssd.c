@@ -2,13 +2,17 @@
 
 #include <linux/ktime.h>
 #include <linux/sched/clock.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
 
 #include "nvmev.h"
 #include "ssd.h"
 
 static inline uint64_t __get_ioclock(struct ssd *ssd)
 {
-	return cpu_clock(ssd->cpu_nr_dispatcher);
+	return nvmev_clock();
 }
 
 void buffer_init(struct buffer *buf, size_t size)
@@ -16,6 +20,9 @@ void buffer_init(struct buffer *buf, size_t size)
 	spin_lock_init(&buf->lock);
 	buf->size = size;
 	buf->remaining = size;
+	buf->nr_slots = 0;
+	buf->slots = NULL;
+	buf->buckets = NULL;
 }
 
 uint32_t buffer_allocate(struct buffer *buf, size_t size)
@@ -52,6 +59,159 @@ void buffer_refill(struct buffer *buf)
 	spin_unlock(&buf->lock);
 }
 
+void buffer_init_cache(struct buffer *buf, uint32_t nr_slots)
+{
+	uint32_t i;
+
+	buf->nr_slots = nr_slots;
+	buf->nr_dirty = 0;
+	buf->absorbed = 0;
+	INIT_LIST_HEAD(&buf->free_list);
+	INIT_LIST_HEAD(&buf->dirty_list);
+	INIT_LIST_HEAD(&buf->clean_list);
+
+	if (nr_slots == 0) {
+		buf->slots = NULL;
+		buf->buckets = NULL;
+		return;
+	}
+
+	buf->hash_bits = ilog2(roundup_pow_of_two(nr_slots));
+	buf->slots = vmalloc(sizeof(struct wb_entry) * nr_slots);
+	buf->buckets = vmalloc(sizeof(struct hlist_head) * (1UL << buf->hash_bits));
+	NVMEV_ASSERT(buf->slots && buf->buckets);
+
+	for (i = 0; i < (1U << buf->hash_bits); i++)
+		INIT_HLIST_HEAD(&buf->buckets[i]);
+
+	for (i = 0; i < nr_slots; i++) {
+		struct wb_entry *e = &buf->slots[i];
+
+		e->dirty = false;
+		e->nsecs_clean = 0;
+		INIT_HLIST_NODE(&e->hnode);
+		list_add_tail(&e->list, &buf->free_list);
+	}
+}
+
+void buffer_remove_cache(struct buffer *buf)
+{
+	if (buf->slots)
+		vfree(buf->slots);
+	if (buf->buckets)
+		vfree(buf->buckets);
+	buf->slots = NULL;
+	buf->buckets = NULL;
+	buf->nr_slots = 0;
+}
+
+struct wb_entry *buffer_lookup(struct buffer *buf, uint64_t lpn)
+{
+	struct wb_entry *e;
+
+	if (buf->nr_slots == 0)
+		return NULL;
+
+	hlist_for_each_entry(e, &buf->buckets[hash_64(lpn, buf->hash_bits)], hnode) {
+		if (e->lpn == lpn)
+			return e;
+	}
+	return NULL;
+}
+
+/*
+ * Get a dirty slot holding @lpn. An overwrite of a cached page reuses its slot.
+ * Otherwise a free slot or the earliest cleaned one is taken, and @nsecs_avail
+ * tells when its previous data has left for the flash. Returns NULL when all
+ * slots are dirty and something has to be flushed first.
+ */
+struct wb_entry *buffer_get_slot(struct buffer *buf, uint64_t lpn, uint64_t *nsecs_avail)
+{
+	struct wb_entry *e = buffer_lookup(buf, lpn);
+
+	*nsecs_avail = 0;
+
+	if (e) {
+		if (e->dirty) {
+			buf->absorbed++;
+			return e;
+		}
+		list_move_tail(&e->list, &buf->dirty_list);
+		e->dirty = true;
+		buf->nr_dirty++;
+		return e;
+	}
+
+	if (!list_empty(&buf->free_list)) {
+		e = list_first_entry(&buf->free_list, struct wb_entry, list);
+	} else if (!list_empty(&buf->clean_list)) {
+		e = list_first_entry(&buf->clean_list, struct wb_entry, list);
+		hlist_del_init(&e->hnode);
+		*nsecs_avail = e->nsecs_clean;
+	} else {
+		return NULL;
+	}
+
+	e->lpn = lpn;
+	e->dirty = true;
+	e->sec_mask = 0;
+	hlist_add_head(&e->hnode, &buf->buckets[hash_64(lpn, buf->hash_bits)]);
+	list_move_tail(&e->list, &buf->dirty_list);
+	buf->nr_dirty++;
+
+	return e;
+}
+
+void buffer_mark_clean(struct buffer *buf, struct wb_entry *e, uint64_t nsecs_clean)
+{
+	NVMEV_ASSERT(e->dirty);
+
+	e->dirty = false;
+	e->nsecs_clean = nsecs_clean;
+	/* partial pages were merged with the old data on the way out */
+	e->sec_mask = U32_MAX;
+	list_move_tail(&e->list, &buf->clean_list);
+	buf->nr_dirty--;
+}
+
+/*
+ * Written back into a wordline that is still open: the slot stays taken until
+ * buffer_clean_pending() tells when the wordline is programmed.
+ */
+void buffer_mark_pending(struct buffer *buf, struct wb_entry *e, struct list_head *pending)
+{
+	NVMEV_ASSERT(e->dirty);
+
+	e->dirty = false;
+	e->sec_mask = U32_MAX;
+	list_move_tail(&e->list, pending);
+	buf->nr_dirty--;
+}
+
+void buffer_clean_pending(struct buffer *buf, struct list_head *pending, uint64_t nsecs_clean)
+{
+	struct wb_entry *e;
+
+	list_for_each_entry(e, pending, list)
+		e->nsecs_clean = nsecs_clean;
+	list_splice_tail_init(pending, &buf->clean_list);
+}
+
+/* forget a cached page whose contents were superseded behind the cache */
+void buffer_drop(struct buffer *buf, uint64_t lpn)
+{
+	struct wb_entry *e = buffer_lookup(buf, lpn);
+
+	if (!e)
+		return;
+
+	if (e->dirty)
+		buf->nr_dirty--;
+	e->dirty = false;
+	hlist_del_init(&e->hnode);
+	list_move(&e->list, &buf->free_list);
+}
+
 static void check_params(struct ssdparams *spp)
 {
 	/*
@@ -63,132 +223,138 @@ static void check_params(struct ssdparams *spp)
 	//ftl_assert(is_power_of_2(spp->nchs));
 }
 
-void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
+/* sector counts follow the LBA data size, the page and block geometry does not */
+void ssd_set_lba_size(struct ssdparams *spp, int secsz)
 {
-	uint64_t blk_size, total_size;
+	spp->secsz = secsz;
+	spp->secs_per_pg = spp->pgsz / secsz;
 
-	spp->secsz = 512;
-	spp->secs_per_pg = 8;
-	spp->pgsz = spp->secsz * spp->secs_per_pg;
+	spp->secs_per_blk = spp->secs_per_pg * spp->pgs_per_blk;
+	spp->secs_per_pl = spp->secs_per_blk * spp->blks_per_pl;
+	spp->secs_per_lun = spp->secs_per_pl * spp->pls_per_lun;
+	spp->secs_per_ch = spp->secs_per_lun * spp->luns_per_ch;
+	spp->tt_secs = spp->secs_per_ch * spp->nchs;
+	spp->secs_per_line = spp->pgs_per_line * spp->secs_per_pg;
+	spp->secs_per_lun_line = spp->pgs_per_lun_line * spp->secs_per_pg;
+}
+
+/* raw rate of one link direction in MiB/s, 8b/10b encoding up to Gen2, 128b/130b after */
+static uint64_t __pcie_link_bandwidth(int gen, int lanes)
+{
+	uint64_t bytes_per_sec;
 
-	spp->nchs = NAND_CHANNELS;
-	spp->pls_per_lun = PLNS_PER_LUN;
-	spp->luns_per_ch = LUNS_PER_NAND_CH;
-	spp->cell_mode = CELL_MODE;
+	if (gen <= 2)
+		bytes_per_sec = (2500000000ULL << (gen - 1)) / 10;
+	else
+		bytes_per_sec = (8000000000ULL << (gen - 3)) / 130 * 128 / 8;
 
-	/* Hybrid storage configuration */
-#if (BASE_SSD == HYBRID_SSD)
+	return bytes_per_sec * lanes / MB(1);
+}
+
+/* SLC/QLC split of the hybrid profile, see ssd_hybrid() */
+static void __init_hybrid_params(struct ssdparams *spp)
+{
 	spp->slc_ratio = HYBRID_SLC_RATIO;
 	spp->slc_channels = HYBRID_SLC_CHANNELS;
 	spp->qlc_channels = HYBRID_QLC_CHANNELS;
 	spp->slc_luns_per_ch = HYBRID_LUNS_PER_CH;
 	spp->qlc_luns_per_ch = HYBRID_LUNS_PER_CH;
-	
+
 	/* Hotness tracking parameters */
 	spp->hotness_table_size = HYBRID_HOTNESS_TABLE_SIZE;
 	spp->hot_threshold = HYBRID_HOT_THRESHOLD;
 	spp->cold_threshold = HYBRID_COLD_THRESHOLD;
 	spp->migration_interval = HYBRID_MIGRATION_INTERVAL;
 	spp->max_migrations_per_check = HYBRID_MAX_MIGRATIONS_PER_CHECK;
-	
+
 	/* SLC specific parameters */
 	spp->slc_pgs_per_blk = HYBRID_SLC_PGS_PER_BLK;
 	spp->slc_blks_per_pl = HYBRID_SLC_BLKS_PER_PL;
 	spp->slc_pgs_per_oneshotpg = HYBRID_SLC_PGS_PER_ONESHOTPG;
 	spp->slc_oneshotpgs_per_blk = HYBRID_SLC_ONESHOTPGS_PER_BLK;
-	
+
 	/* QLC specific parameters */
 	spp->qlc_pgs_per_blk = HYBRID_QLC_PGS_PER_BLK;
 	spp->qlc_blks_per_pl = HYBRID_QLC_BLKS_PER_PL;
 	spp->qlc_pgs_per_oneshotpg = HYBRID_QLC_PGS_PER_ONESHOTPG;
 	spp->qlc_oneshotpgs_per_blk = HYBRID_QLC_ONESHOTPGS_PER_BLK;
-	
+
 	/* Set simplified latency parameters */
 	spp->slc_read_latency = HYBRID_SLC_READ_LATENCY;
 	spp->slc_write_latency = HYBRID_SLC_WRITE_LATENCY;
 	spp->slc_erase_latency = HYBRID_SLC_ERASE_LATENCY;
-	
-	/* Set QLC latency parameters for 4 regions */
-	spp->qlc_q1_read_latency = HYBRID_QLC_Q1_READ_LATENCY;
-	spp->qlc_q2_read_latency = HYBRID_QLC_Q2_READ_LATENCY;
-	spp->qlc_q3_read_latency = HYBRID_QLC_Q3_READ_LATENCY;
-	spp->qlc_q4_read_latency = HYBRID_QLC_Q4_READ_LATENCY;
-	spp->qlc_write_latency = HYBRID_QLC_WRITE_LATENCY;
-	spp->qlc_erase_latency = HYBRID_QLC_ERASE_LATENCY;
-#endif
-
-	/* partitioning SSD by dividing channel*/
-	NVMEV_ASSERT((spp->nchs % nparts) == 0);
-	spp->nchs /= nparts;
-	capacity /= nparts;
-
-	if (BLKS_PER_PLN > 0) {
-		/* flashpgs_per_blk depends on capacity */
-		spp->blks_per_pl = BLKS_PER_PLN;
-		blk_size = DIV_ROUND_UP(capacity, spp->blks_per_pl * spp->pls_per_lun *
-							  spp->luns_per_ch * spp->nchs);
-	} else {
-		NVMEV_ASSERT(BLK_SIZE > 0);
-		blk_size = BLK_SIZE;
-		spp->blks_per_pl = DIV_ROUND_UP(capacity, blk_size * spp->pls_per_lun *
-								  spp->luns_per_ch * spp->nchs);
-	}
 
-	NVMEV_ASSERT((ONESHOT_PAGE_SIZE % spp->pgsz) == 0 && (FLASH_PAGE_SIZE % spp->pgsz) == 0);
-	NVMEV_ASSERT((ONESHOT_PAGE_SIZE % FLASH_PAGE_SIZE) == 0);
+	/* QLC blocks, a 4KB page is a whole flash page there */
+	spp->cell_mode = CELL_MODE_QLC;
+	spp->pg_rd_lat[CELL_TYPE_LSB] = HYBRID_QLC_LSB_READ_LATENCY;
+	spp->pg_rd_lat[CELL_TYPE_CSB] = HYBRID_QLC_CSB_READ_LATENCY;
+	spp->pg_rd_lat[CELL_TYPE_MSB] = HYBRID_QLC_MSB_READ_LATENCY;
+	spp->pg_rd_lat[CELL_TYPE_TSB] = HYBRID_QLC_TSB_READ_LATENCY;
+	memcpy(spp->pg_4kb_rd_lat, spp->pg_rd_lat, sizeof(spp->pg_rd_lat));
+	spp->pg_wr_lat = HYBRID_QLC_WRITE_LATENCY;
+	spp->blk_er_lat = HYBRID_QLC_ERASE_LATENCY;
+}
 
-	spp->pgs_per_oneshotpg = ONESHOT_PAGE_SIZE / (spp->pgsz);
-	spp->oneshotpgs_per_blk = DIV_ROUND_UP(blk_size, ONESHOT_PAGE_SIZE);
+static void __init_hybrid_geometry(struct ssdparams *spp, uint64_t capacity)
+{
+	uint64_t total_channels;
+	uint64_t slc_capacity;
+	uint64_t qlc_capacity;
+	uint64_t slc_capacity_per_ch;
+	uint64_t slc_capacity_per_lun;
+	uint64_t slc_pgs_per_lun;
+	uint64_t qlc_capacity_per_ch;
+	uint64_t qlc_capacity_per_lun;
+	uint64_t qlc_pgs_per_lun;
 
-#if (BASE_SSD == HYBRID_SSD)
 	/* Calculate hybrid storage parameters with proper channel allocation */
-	uint64_t total_channels = spp->slc_channels + spp->qlc_channels;
-	uint64_t slc_capacity = capacity * spp->slc_channels / total_channels;
-	uint64_t qlc_capacity = capacity * spp->qlc_channels / total_channels;
-	
+	total_channels = spp->slc_channels + spp->qlc_channels;
+	slc_capacity = capacity * spp->slc_channels / total_channels;
+	qlc_capacity = capacity * spp->qlc_channels / total_channels;
+
 	/* Calculate SLC parameters based on channel allocation */
 	/* SLC capacity per channel */
-	uint64_t slc_capacity_per_ch = slc_capacity / spp->slc_channels;
+	slc_capacity_per_ch = slc_capacity / spp->slc_channels;
 	/* SLC capacity per LUN */
-	uint64_t slc_capacity_per_lun = slc_capacity_per_ch / spp->slc_luns_per_ch;
+	slc_capacity_per_lun = slc_capacity_per_ch / spp->slc_luns_per_ch;
 	/* SLC pages per LUN */
-	uint64_t slc_pgs_per_lun = slc_capacity_per_lun / spp->pgsz;
-	
+	slc_pgs_per_lun = slc_capacity_per_lun / spp->pgsz;
+
 	spp->slc_tt_pgs = spp->slc_channels * spp->slc_luns_per_ch * slc_pgs_per_lun;
 	spp->slc_tt_blks = spp->slc_tt_pgs / spp->slc_pgs_per_blk;
 	spp->slc_tt_lines = spp->slc_tt_blks / spp->slc_blks_per_pl;
 	spp->slc_pgs_per_ch = slc_pgs_per_lun * spp->slc_luns_per_ch;
 	spp->slc_blks_per_ch = spp->slc_pgs_per_ch / spp->slc_pgs_per_blk;
-	
+
 	/* Calculate QLC parameters based on channel allocation */
 	/* QLC capacity per channel */
-	uint64_t qlc_capacity_per_ch = qlc_capacity / spp->qlc_channels;
+	qlc_capacity_per_ch = qlc_capacity / spp->qlc_channels;
 	/* QLC capacity per LUN */
-	uint64_t qlc_capacity_per_lun = qlc_capacity_per_ch / spp->qlc_luns_per_ch;
+	qlc_capacity_per_lun = qlc_capacity_per_ch / spp->qlc_luns_per_ch;
 	/* QLC pages per LUN */
-	uint64_t qlc_pgs_per_lun = qlc_capacity_per_lun / spp->pgsz;
-	
+	qlc_pgs_per_lun = qlc_capacity_per_lun / spp->pgsz;
+
 	spp->qlc_tt_pgs = spp->qlc_channels * spp->qlc_luns_per_ch * qlc_pgs_per_lun;
 	spp->qlc_tt_blks = spp->qlc_tt_pgs / spp->qlc_pgs_per_blk;
 	spp->qlc_tt_lines = spp->qlc_tt_blks / spp->qlc_blks_per_pl;
 	spp->qlc_pgs_per_ch = qlc_pgs_per_lun * spp->qlc_luns_per_ch;
 	spp->qlc_blks_per_ch = spp->qlc_pgs_per_ch / spp->qlc_pgs_per_blk;
-	
+
 	/* Update total pages to reflect actual hybrid allocation */
 	spp->tt_pgs = spp->slc_tt_pgs + spp->qlc_tt_pgs;
-	
+
 	/* Set PPA ranges for SLC and QLC */
 	spp->slc_start_ppa = 0;
 	spp->slc_end_ppa = spp->slc_tt_pgs;
 	spp->qlc_start_ppa = spp->slc_tt_pgs;
 	spp->qlc_end_ppa = spp->tt_pgs;
-	
+
 	/* Set LPN ranges for SLC and QLC */
 	spp->slc_start_lpn = 0;
 	spp->slc_end_lpn = spp->slc_tt_pgs;
 	spp->qlc_start_lpn = spp->slc_tt_pgs;
 	spp->qlc_end_lpn = spp->tt_pgs;
-	
+
 	/* Print capacity information for debugging */
 	NVMEV_INFO("Hybrid SSD Capacity Allocation:\n");
 	NVMEV_INFO("  Total Capacity: %llu MB\n", capacity / (1024 * 1024));
@@ -200,42 +366,130 @@ void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
 	NVMEV_INFO("  QLC Total Pages: %llu\n", spp->qlc_tt_pgs);
 	NVMEV_INFO("  SLC Pages per Block: %d, QLC Pages per Block: %d\n", 
 		   spp->slc_pgs_per_blk, spp->qlc_pgs_per_blk);
-#endif
+}
+
+/* model of BASE_SSD, used when no profile is picked at load time */
+static const struct nand_profile nand_profile_default = {
+	.cell_mode = CELL_MODE,
+	.nchs = NAND_CHANNELS,
+	.luns_per_ch = LUNS_PER_NAND_CH,
+	.pls_per_lun = PLNS_PER_LUN,
+	.flashpg_size = FLASH_PAGE_SIZE,
+	.oneshotpg_size = ONESHOT_PAGE_SIZE,
+	.blks_per_pl = BLKS_PER_PLN,
+	.blk_size = BLK_SIZE,
+	.ch_bandwidth = NAND_CHANNEL_BANDWIDTH,
+	.write_buffer_size = GLOBAL_WB_SIZE,
+
+	.pg_4kb_rd_lat = {
+		[CELL_TYPE_LSB] = NAND_4KB_READ_LATENCY_LSB,
+		[CELL_TYPE_CSB] = NAND_4KB_READ_LATENCY_CSB,
+		[CELL_TYPE_MSB] = NAND_4KB_READ_LATENCY_MSB,
+		[CELL_TYPE_TSB] = NAND_4KB_READ_LATENCY_TSB,
+	},
+	.pg_rd_lat = {
+		[CELL_TYPE_LSB] = NAND_READ_LATENCY_LSB,
+		[CELL_TYPE_CSB] = NAND_READ_LATENCY_CSB,
+		[CELL_TYPE_MSB] = NAND_READ_LATENCY_MSB,
+		[CELL_TYPE_TSB] = NAND_READ_LATENCY_TSB,
+	},
+	.pg_wr_lat = NAND_PROG_LATENCY,
+	.blk_er_lat = NAND_ERASE_LATENCY,
+	.max_ch_xfer_size = MAX_CH_XFER_SIZE,
+	.fw_4kb_rd_lat = FW_4KB_READ_LATENCY,
+	.fw_rd_lat = FW_READ_LATENCY,
+	.fw_wbuf_lat0 = FW_WBUF_LATENCY0,
+	.fw_wbuf_lat1 = FW_WBUF_LATENCY1,
+	.fw_ch_xfer_lat = FW_CH_XFER_LATENCY,
+};
+
+void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
+{
+	const struct nand_profile *np = nvmev_nand_profile ? nvmev_nand_profile :
+							      &nand_profile_default;
+	uint64_t blk_size, total_size;
+
+	spp->pgsz = KB(4);
+
+	spp->nchs = np->nchs;
+	spp->pls_per_lun = np->pls_per_lun;
+	spp->luns_per_ch = np->luns_per_ch;
+	spp->cell_mode = np->cell_mode;
+
+	memcpy(spp->pg_4kb_rd_lat, np->pg_4kb_rd_lat, sizeof(spp->pg_4kb_rd_lat));
+	memcpy(spp->pg_rd_lat, np->pg_rd_lat, sizeof(spp->pg_rd_lat));
+	spp->pg_wr_lat = np->pg_wr_lat;
+	spp->blk_er_lat = np->blk_er_lat;
+
+	/* Hybrid storage configuration */
+	if (ssd_hybrid())
+		__init_hybrid_params(spp);
+
+	/* partitioning SSD by dividing channel*/
+	NVMEV_ASSERT((spp->nchs % nparts) == 0);
+	spp->nchs /= nparts;
+	capacity /= nparts;
+
+	if (np->blks_per_pl > 0) {
+		/* flashpgs_per_blk depends on capacity */
+		spp->blks_per_pl = np->blks_per_pl;
+		blk_size = DIV_ROUND_UP(capacity, spp->blks_per_pl * spp->pls_per_lun *
+							  spp->luns_per_ch * spp->nchs);
+	} else {
+		NVMEV_ASSERT(np->blk_size > 0);
+		blk_size = np->blk_size;
+		spp->blks_per_pl = DIV_ROUND_UP(capacity, blk_size * spp->pls_per_lun *
+								  spp->luns_per_ch * spp->nchs);
+	}
 
-	spp->pgs_per_flashpg = FLASH_PAGE_SIZE / (spp->pgsz);
+	NVMEV_ASSERT((np->oneshotpg_size % spp->pgsz) == 0 && (np->flashpg_size % spp->pgsz) == 0);
+	NVMEV_ASSERT((np->oneshotpg_size % np->flashpg_size) == 0);
+	NVMEV_ASSERT(np->flashpg_size <= NAND_MAX_FLASHPG_SIZE &&
+		     np->oneshotpg_size <= NAND_MAX_ONESHOTPG_SIZE);
+
+	spp->pgs_per_oneshotpg = np->oneshotpg_size / (spp->pgsz);
+	spp->oneshotpgs_per_blk = DIV_ROUND_UP(blk_size, np->oneshotpg_size);
+
+	if (ssd_hybrid())
+		__init_hybrid_geometry(spp, capacity);
+
+	spp->pgs_per_flashpg = np->flashpg_size / (spp->pgsz);
+	spp->flashpgs_per_blk = (np->oneshotpg_size / np->flashpg_size) * spp->oneshotpgs_per_blk;
 	spp->pgs_per_blk = spp->pgs_per_oneshotpg * spp->oneshotpgs_per_blk;
 
 	spp->write_unit_size = WRITE_UNIT_SIZE;
 
-	spp->pg_4kb_rd_lat[CELL_TYPE_LSB] = NAND_4KB_READ_LATENCY_LSB;
-	spp->pg_4kb_rd_lat[CELL_TYPE_MSB] = NAND_4KB_READ_LATENCY_MSB;
-	spp->pg_4kb_rd_lat[CELL_TYPE_CSB] = NAND_4KB_READ_LATENCY_CSB;
-	spp->pg_rd_lat[CELL_TYPE_LSB] = NAND_READ_LATENCY_LSB;
-	spp->pg_rd_lat[CELL_TYPE_MSB] = NAND_READ_LATENCY_MSB;
-	spp->pg_rd_lat[CELL_TYPE_CSB] = NAND_READ_LATENCY_CSB;
-	spp->pg_wr_lat = NAND_PROG_LATENCY;
-	spp->blk_er_lat = NAND_ERASE_LATENCY;
-	spp->max_ch_xfer_size = MAX_CH_XFER_SIZE;
-
-	spp->fw_4kb_rd_lat = FW_4KB_READ_LATENCY;
-	spp->fw_rd_lat = FW_READ_LATENCY;
-	spp->fw_ch_xfer_lat = FW_CH_XFER_LATENCY;
-	spp->fw_wbuf_lat0 = FW_WBUF_LATENCY0;
-	spp->fw_wbuf_lat1 = FW_WBUF_LATENCY1;
-
-	spp->ch_bandwidth = NAND_CHANNEL_BANDWIDTH;
-	spp->pcie_bandwidth = PCIE_BANDWIDTH;
-
-	spp->write_buffer_size = GLOBAL_WB_SIZE;
+	spp->max_ch_xfer_size = np->max_ch_xfer_size;
+
+	spp->suspend_lat = NAND_SUSPEND_LATENCY;
+	spp->resume_lat = NAND_RESUME_LATENCY;
+	spp->max_suspends = NAND_MAX_SUSPENDS;
+
+	spp->cache_read = NAND_CACHE_READ;
+	spp->cache_program = NAND_CACHE_PROGRAM;
+	spp->cache_busy_lat = NAND_CACHE_BUSY_LATENCY;
+
+	spp->nand_sched = NAND_SCHED_POLICY;
+	spp->nand_sched_qdepth = NAND_SCHED_QDEPTH;
+	spp->nand_sched_max_bypass = NAND_SCHED_MAX_BYPASS;
+	spp->nand_sched_deadline = NAND_SCHED_GC_DEADLINE;
+
+	spp->fw_4kb_rd_lat = np->fw_4kb_rd_lat;
+	spp->fw_rd_lat = np->fw_rd_lat;
+	spp->fw_ch_xfer_lat = np->fw_ch_xfer_lat;
+	spp->fw_wbuf_lat0 = np->fw_wbuf_lat0;
+	spp->fw_wbuf_lat1 = np->fw_wbuf_lat1;
+
+	spp->ch_bandwidth = np->ch_bandwidth;
+	spp->pcie_bandwidth = __pcie_link_bandwidth(PCIE_GEN, PCIE_LANES);
+	spp->pcie_mps = PCIE_MPS;
+	spp->pcie_mrrs = PCIE_MRRS;
+	spp->pcie_tlp_overhead = PCIE_TLP_OVERHEAD;
+
+	spp->write_buffer_size = np->write_buffer_size;
 	spp->write_early_completion = WRITE_EARLY_COMPLETION;
 
 	/* calculated values */
-	spp->secs_per_blk = spp->secs_per_pg * spp->pgs_per_blk;
-	spp->secs_per_pl = spp->secs_per_blk * spp->blks_per_pl;
-	spp->secs_per_lun = spp->secs_per_pl * spp->pls_per_lun;
-	spp->secs_per_ch = spp->secs_per_lun * spp->luns_per_ch;
-	spp->tt_secs = spp->secs_per_ch * spp->nchs;
-
 	spp->pgs_per_pl = spp->pgs_per_blk * spp->blks_per_pl;
 	spp->pgs_per_lun = spp->pgs_per_pl * spp->pls_per_lun;
 	spp->pgs_per_ch = spp->pgs_per_lun * spp->luns_per_ch;
@@ -251,19 +505,18 @@ void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
 	spp->tt_luns = spp->luns_per_ch * spp->nchs;
 
 	/* line is special, put it at the end */
-	spp->blks_per_line = spp->tt_luns; /* TODO: to fix under multiplanes */
+	/* a line (superblock) takes the same block of every plane in every LUN */
+	spp->blks_per_line = spp->tt_luns * spp->pls_per_lun;
 	spp->pgs_per_line = spp->blks_per_line * spp->pgs_per_blk;
-	spp->secs_per_line = spp->pgs_per_line * spp->secs_per_pg;
-	spp->tt_lines = spp->blks_per_lun;
-	/* TODO: to fix under multiplanes */ // lun size is super-block(line) size
+	spp->tt_lines = spp->blks_per_pl;
 	
 	//66f1 die line option
 	spp->blks_per_lun_line = spp->pls_per_lun;
 	spp->pgs_per_lun_line = spp->blks_per_lun_line * spp->pgs_per_blk;
-	spp->secs_per_lun_line = spp->pgs_per_lun_line * spp->secs_per_pg;
 	spp->tt_lun_lines = spp->blks_per_lun_line;
 	//66f1
 
+	ssd_set_lba_size(spp, 512);
 
 	check_params(spp);
 
@@ -281,7 +534,8 @@ void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
 static void ssd_init_nand_page(struct nand_page *pg, struct ssdparams *spp)
 {
 	int i;
-	pg->nsecs = spp->secs_per_pg;
+	/* 512B codewords, whatever the LBA format of the namespace */
+	pg->nsecs = spp->pgsz >> 9;
 	pg->sec = kmalloc(sizeof(nand_sec_status_t) * pg->nsecs, GFP_KERNEL);
 	for (i = 0; i < pg->nsecs; i++) {
 		pg->sec[i] = SEC_FREE;
@@ -326,6 +580,7 @@ static void ssd_init_nand_plane(struct nand_plane *pl, struct ssdparams *spp)
 	for (i = 0; i < pl->nblks; i++) {
 		ssd_init_nand_blk(&pl->blk[i], spp);
 	}
+	pl->next_pln_avail_time = 0;
 }
 
 static void ssd_remove_nand_plane(struct nand_plane *pl)
@@ -338,16 +593,41 @@ static void ssd_remove_nand_plane(struct nand_plane *pl)
 	kfree(pl->blk);
 }
 
-static void ssd_init_nand_lun(struct nand_lun *lun, struct ssdparams *spp)
+static int ssd_init_nand_lun(struct nand_lun *lun, struct ssdparams *spp)
 {
 	int i;
+
+	lun->q = NULL;
+	if (spp->nand_sched != NAND_SCHED_FCFS) {
+		lun->q = kmalloc(sizeof(struct nand_qcmd) * spp->nand_sched_qdepth, GFP_KERNEL);
+		if (!lun->q)
+			return -ENOMEM;
+	}
+	lun->q_len = 0;
+	lun->q_tail_time = 0;
+
 	lun->npls = spp->pls_per_lun;
 	lun->pl = kmalloc(sizeof(struct nand_plane) * lun->npls, GFP_KERNEL);
 	for (i = 0; i < lun->npls; i++) {
 		ssd_init_nand_plane(&lun->pl[i], spp);
 	}
 	lun->next_lun_avail_time = 0;
+	spin_lock_init(&lun->lock);
 	lun->busy = false;
+
+	lun->mp_cmd = NAND_NOP;
+	lun->mp_planes = 0;
+	lun->mp_pg = 0;
+	lun->mp_nand_stime = 0;
+	lun->mp_nand_etime = 0;
+	lun->mp_resume_time = 0;
+	lun->mp_nsuspends = 0;
+	lun->nr_suspends = 0;
+
+	lun->cache_cmd = NAND_NOP;
+	lun->cache_next_stime = 0;
+
+	return 0;
 }
 
 static void ssd_remove_nand_lun(struct nand_lun *lun)
@@ -357,16 +637,23 @@ static void ssd_remove_nand_lun(struct nand_lun *lun)
 	for (i = 0; i < lun->npls; i++)
 		ssd_remove_nand_plane(&lun->pl[i]);
 
+	kfree(lun->q);
 	kfree(lun->pl);
 }
 
-static void ssd_init_ch(struct ssd_channel *ch, struct ssdparams *spp)
+static int ssd_init_ch(struct ssd_channel *ch, struct ssdparams *spp)
 {
-	int i;
+	int i, ret;
 	ch->nluns = spp->luns_per_ch;
 	ch->lun = kmalloc(sizeof(struct nand_lun) * ch->nluns, GFP_KERNEL);
 	for (i = 0; i < ch->nluns; i++) {
-		ssd_init_nand_lun(&ch->lun[i], spp);
+		ret = ssd_init_nand_lun(&ch->lun[i], spp);
+		if (ret) {
+			while (--i >= 0)
+				ssd_remove_nand_lun(&ch->lun[i]);
+			kfree(ch->lun);
+			return ret;
+		}
 	}
 
 	ch->perf_model = kmalloc(sizeof(struct channel_model), GFP_KERNEL);
@@ -374,6 +661,8 @@ static void ssd_init_ch(struct ssd_channel *ch, struct ssdparams *spp)
 
 	/* Add firmware overhead */
 	ch->perf_model->xfer_lat += (spp->fw_ch_xfer_lat * UNIT_XFER_SIZE / KB(4));
+
+	return 0;
 }
 
 static void ssd_remove_ch(struct ssd_channel *ch)
@@ -390,25 +679,113 @@ static void ssd_remove_ch(struct ssd_channel *ch)
 
 static void ssd_init_pcie(struct ssd_pcie *pcie, struct ssdparams *spp)
 {
-	pcie->perf_model = kmalloc(sizeof(struct channel_model), GFP_KERNEL);
-	chmodel_init(pcie->perf_model, spp->pcie_bandwidth);
+	pcie->h2d = kmalloc(sizeof(struct channel_model), GFP_KERNEL);
+	chmodel_init(pcie->h2d, spp->pcie_bandwidth);
+	pcie->d2h = kmalloc(sizeof(struct channel_model), GFP_KERNEL);
+	chmodel_init(pcie->d2h, spp->pcie_bandwidth);
+
+	pcie->mps = spp->pcie_mps;
+	pcie->mrrs = spp->pcie_mrrs;
+	pcie->tlp_overhead = spp->pcie_tlp_overhead;
 }
 
-static void ssd_remove_pcie(struct ssd_pcie *pcie)
+void ssd_remove_pcie(struct ssd_pcie *pcie)
 {
-	kfree(pcie->perf_model);
+	kfree(pcie->h2d);
+	kfree(pcie->d2h);
 }
 
-void ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher)
+#define LAT_FIELD(f) { #f, offsetof(struct ssd_latency, f) }
+#define LAT_CELL_FIELD(f, bit, i) { #f "_" #bit, offsetof(struct ssd_latency, f[i]) }
+
+static const struct {
+	const char *name;
+	size_t offs;
+} ssd_latency_fields[] = {
+	LAT_CELL_FIELD(pg_rd_lat, lsb, CELL_TYPE_LSB),
+	LAT_CELL_FIELD(pg_rd_lat, csb, CELL_TYPE_CSB),
+	LAT_CELL_FIELD(pg_rd_lat, msb, CELL_TYPE_MSB),
+	LAT_CELL_FIELD(pg_rd_lat, tsb, CELL_TYPE_TSB),
+	LAT_CELL_FIELD(pg_4kb_rd_lat, lsb, CELL_TYPE_LSB),
+	LAT_CELL_FIELD(pg_4kb_rd_lat, csb, CELL_TYPE_CSB),
+	LAT_CELL_FIELD(pg_4kb_rd_lat, msb, CELL_TYPE_MSB),
+	LAT_CELL_FIELD(pg_4kb_rd_lat, tsb, CELL_TYPE_TSB),
+	LAT_FIELD(pg_wr_lat),
+	LAT_FIELD(blk_er_lat),
+	/* SLC blocks of the hybrid profile */
+	LAT_FIELD(slc_read_latency),
+	LAT_FIELD(slc_pg_wr_lat),
+	LAT_FIELD(slc_blk_er_lat),
+	LAT_FIELD(suspend_lat),
+	LAT_FIELD(resume_lat),
+	LAT_FIELD(cache_busy_lat),
+	LAT_FIELD(fw_4kb_rd_lat),
+	LAT_FIELD(fw_rd_lat),
+	LAT_FIELD(fw_wbuf_lat0),
+	LAT_FIELD(fw_wbuf_lat1),
+	LAT_FIELD(fw_ch_xfer_lat),
+	LAT_FIELD(ch_bandwidth),
+	LAT_FIELD(pcie_bandwidth),
+};
+
+static DEFINE_MUTEX(ssd_latency_lock);
+
+static int ssd_init_latency(struct ssd *ssd, struct ssdparams *spp)
 {
-	uint32_t i;
+	struct ssd_latency *lat = kzalloc(sizeof(*lat), GFP_KERNEL);
+	int i;
+
+	if (!lat)
+		return -ENOMEM;
+
+	for (i = 0; i < MAX_CELL_TYPES; i++) {
+		lat->pg_rd_lat[i] = spp->pg_rd_lat[i];
+		lat->pg_4kb_rd_lat[i] = spp->pg_4kb_rd_lat[i];
+	}
+	lat->pg_wr_lat = spp->pg_wr_lat;
+	lat->blk_er_lat = spp->blk_er_lat;
+	lat->slc_read_latency = spp->slc_read_latency;
+	lat->slc_pg_wr_lat = spp->slc_write_latency;
+	lat->slc_blk_er_lat = spp->slc_erase_latency;
+
+	lat->suspend_lat = spp->suspend_lat;
+	lat->resume_lat = spp->resume_lat;
+	lat->cache_busy_lat = spp->cache_busy_lat;
+
+	lat->fw_4kb_rd_lat = spp->fw_4kb_rd_lat;
+	lat->fw_rd_lat = spp->fw_rd_lat;
+	lat->fw_wbuf_lat0 = spp->fw_wbuf_lat0;
+	lat->fw_wbuf_lat1 = spp->fw_wbuf_lat1;
+	lat->fw_ch_xfer_lat = spp->fw_ch_xfer_lat;
+
+	lat->ch_bandwidth = spp->ch_bandwidth;
+	lat->pcie_bandwidth = spp->pcie_bandwidth;
+
+	RCU_INIT_POINTER(ssd->lat, lat);
+	return 0;
+}
+
+int ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher)
+{
+	int i, ret;
 	/* copy spp */
 	ssd->sp = *spp;
 
+	ret = ssd_init_latency(ssd, spp);
+	if (ret)
+		return ret;
+
 	/* initialize conv_ftl internal layout architecture */
 	ssd->ch = kmalloc(sizeof(struct ssd_channel) * spp->nchs, GFP_KERNEL); // 40 * 8 = 320
 	for (i = 0; i < spp->nchs; i++) {
-		ssd_init_ch(&(ssd->ch[i]), spp);
+		ret = ssd_init_ch(&(ssd->ch[i]), spp);
+		if (ret) {
+			while (--i >= 0)
+				ssd_remove_ch(&(ssd->ch[i]));
+			kfree(ssd->ch);
+			kfree(rcu_dereference_protected(ssd->lat, true));
+			return ret;
+		}
 	}
 
 	/* Set CPU number to use same cpuclock as io.c */
@@ -420,16 +797,17 @@ void ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher
 	ssd->write_buffer = kmalloc(sizeof(struct buffer), GFP_KERNEL);
 	buffer_init(ssd->write_buffer, spp->write_buffer_size);
 
-	return;
+	return 0;
 }
 
 void ssd_remove(struct ssd *ssd)
 {
 	uint32_t i;
 
+	kfree(rcu_dereference_protected(ssd->lat, true));
 	kfree(ssd->write_buffer);
 	if (ssd->pcie) {
-		kfree(ssd->pcie->perf_model);
+		ssd_remove_pcie(ssd->pcie);
 		kfree(ssd->pcie);
 	}
 
@@ -440,10 +818,30 @@ void ssd_remove(struct ssd *ssd)
 	kfree(ssd->ch);
 }
 
-uint64_t ssd_advance_pcie(struct ssd *ssd, uint64_t request_time, uint64_t length)
+/* bytes on the wire to move @length bytes in TLPs of at most @payload bytes each */
+static inline uint64_t __pcie_wire_bytes(struct ssd_pcie *pcie, uint64_t length, uint32_t payload)
+{
+	return length + DIV_ROUND_UP(length, payload) * pcie->tlp_overhead;
+}
+
+/*
+ * Each direction of the link is a channel of its own. Data goes out in TLPs
+ * of at most MPS bytes. To pull data from the host the device first sends
+ * read requests of at most MRRS bytes each, header-only TLPs in the other
+ * direction.
+ */
+uint64_t ssd_advance_pcie(struct ssd *ssd, uint64_t request_time, uint64_t length, int dir)
 {
-	struct channel_model *perf_model = ssd->pcie->perf_model;
-	return chmodel_request(perf_model, request_time, length);
+	struct ssd_pcie *pcie = ssd->pcie;
+	uint64_t nsecs_req;
+
+	if (dir == PCIE_D2H)
+		return chmodel_request(pcie->d2h, request_time,
+				       __pcie_wire_bytes(pcie, length, pcie->mps));
+
+	nsecs_req = chmodel_request(pcie->d2h, request_time,
+				    DIV_ROUND_UP(length, pcie->mrrs) * pcie->tlp_overhead);
+	return chmodel_request(pcie->h2d, nsecs_req, __pcie_wire_bytes(pcie, length, pcie->mps));
 }
 
 /* Write buffer Performance Model
@@ -456,94 +854,254 @@ uint64_t ssd_advance_pcie(struct ssd *ssd, uint64_t request_time, uint64_t lengt
 uint64_t ssd_advance_write_buffer(struct ssd *ssd, uint64_t request_time, uint64_t length)
 {
 	uint64_t nsecs_latest = request_time;
-	struct ssdparams *spp = &ssd->sp;
+	struct ssd_latency *lat;
 
-	nsecs_latest += spp->fw_wbuf_lat0;
-	nsecs_latest += spp->fw_wbuf_lat1 * DIV_ROUND_UP(length, KB(4));
+	rcu_read_lock();
+	lat = rcu_dereference(ssd->lat);
+	nsecs_latest += lat->fw_wbuf_lat0;
+	nsecs_latest += lat->fw_wbuf_lat1 * DIV_ROUND_UP(length, KB(4));
+	rcu_read_unlock();
 
-	nsecs_latest = ssd_advance_pcie(ssd, nsecs_latest, length);
+	nsecs_latest = ssd_advance_pcie(ssd, nsecs_latest, length, PCIE_H2D);
 
 	return nsecs_latest;
 }
 
-uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
+/*
+ * Push the LUN busy time out to @time unless someone got it further already.
+ * Lock free so that NOPs and idle-time peeks don't have to take lun->lock.
+ */
+static inline uint64_t __lun_reserve(struct nand_lun *lun, uint64_t time)
+{
+	uint64_t old = READ_ONCE(lun->next_lun_avail_time);
+
+	while (old < time) {
+		uint64_t cur = cmpxchg64(&lun->next_lun_avail_time, old, time);
+
+		if (cur == old)
+			return time;
+		old = cur;
+	}
+
+	return old;
+}
+
+/*
+ * Planes of a LUN share one command sequencer, so commands issued to different
+ * planes at the same page offset are merged into a single multi-plane operation
+ * as long as the operation has not started on the array yet.
+ */
+static bool __join_multiplane(struct nand_lun *lun, struct ppa *ppa, int c, uint32_t pg,
+			      uint64_t cmd_stime)
+{
+	if (lun->npls == 1 || lun->mp_cmd != c || lun->mp_pg != pg)
+		return false;
+
+	if (lun->mp_planes & (1U << ppa->g.pl))
+		return false;
+
+	return cmd_stime <= lun->mp_nand_stime;
+}
+
+static void __start_multiplane(struct nand_lun *lun, struct ppa *ppa, int c, uint32_t pg,
+			       uint64_t nand_stime, uint64_t nand_etime)
+{
+	lun->mp_cmd = c;
+	lun->mp_planes = 1U << ppa->g.pl;
+	lun->mp_pg = pg;
+	lun->mp_nand_stime = nand_stime;
+	lun->mp_nand_etime = nand_etime;
+	lun->mp_resume_time = 0;
+	lun->mp_nsuspends = 0;
+}
+
+static void __update_multiplane_planes(struct nand_lun *lun, uint64_t nand_etime)
+{
+	int i;
+
+	for (i = 0; i < lun->npls; i++) {
+		if (lun->mp_planes & (1U << i))
+			lun->pl[i].next_pln_avail_time = nand_etime;
+	}
+}
+
+enum {
+	SUSPEND_NONE,
+	SUSPEND_NEW,
+	SUSPEND_QUEUED,
+};
+
+/*
+ * A read to a LUN busy with a program/erase array operation suspends it, up to
+ * max_suspends times per operation. Reads arriving while it is already
+ * suspended are served in the same window without another suspend.
+ */
+static int __suspend_mode(struct ssdparams *spp, struct nand_lun *lun, uint64_t cmd_stime)
+{
+	if (lun->mp_cmd != NAND_WRITE && lun->mp_cmd != NAND_ERASE)
+		return SUSPEND_NONE;
+
+	if (cmd_stime >= lun->mp_nand_etime)
+		return SUSPEND_NONE;
+
+	if (cmd_stime < lun->mp_resume_time)
+		return SUSPEND_QUEUED;
+
+	/* data is still being loaded, the array operation has not begun */
+	if (cmd_stime < lun->mp_nand_stime)
+		return SUSPEND_NONE;
+
+	if (lun->mp_nsuspends >= spp->max_suspends)
+		return SUSPEND_NONE;
+
+	return SUSPEND_NEW;
+}
+
+/*
+ * Push the suspended operation out by the time the LUN spent on reads. The
+ * completion time already returned for it is not revised.
+ */
+static void __resume_after_read(struct ssd *ssd, struct nand_lun *lun, uint64_t cmd_stime,
+				uint64_t read_etime, bool new_suspend)
+{
+	uint64_t resume_time = read_etime + ssd_lat(ssd, resume_lat);
+
+	if (new_suspend) {
+		/* the array makes no progress while it suspends either */
+		uint64_t remaining = lun->mp_nand_etime - cmd_stime + ssd_lat(ssd, suspend_lat);
+
+		lun->mp_nand_etime = resume_time + remaining;
+		lun->mp_nsuspends++;
+		lun->nr_suspends++;
+	} else if (resume_time > lun->mp_resume_time) {
+		lun->mp_nand_etime += resume_time - lun->mp_resume_time;
+	} else {
+		return;
+	}
+
+	lun->mp_resume_time = resume_time;
+	__update_multiplane_planes(lun, lun->mp_nand_etime);
+	__lun_reserve(lun, lun->mp_nand_etime);
+}
+
+/* program data over the channel, a copyback program finds it in the page register */
+static inline uint64_t __xfer_in(struct ssd_channel *ch, uint64_t stime, uint64_t len)
+{
+	return len ? chmodel_request(ch->perf_model, stime, len) : stime;
+}
+
+/*
+ * Array time of a read, program or erase at @ppa. Reads depend on the bit of
+ * the cell the page is in, a oneshot program writes all bits of a wordline.
+ */
+static uint64_t __nand_latency(struct ssd *ssd, struct ppa *ppa, int c, uint64_t xfer_size)
+{
+	struct ssd_latency *lat;
+	uint64_t nand_lat = 0;
+	bool slc = ssd_hybrid() && get_storage_type(ssd, ppa) == STORAGE_TYPE_SLC;
+	uint32_t cell;
+
+	rcu_read_lock();
+	lat = rcu_dereference(ssd->lat);
+
+	switch (c) {
+	case NAND_READ:
+		if (slc) {
+			nand_lat = lat->slc_read_latency;
+			break;
+		}
+		cell = get_cell(ssd, ppa);
+		nand_lat = (xfer_size == KB(4)) ? lat->pg_4kb_rd_lat[cell] : lat->pg_rd_lat[cell];
+		break;
+
+	case NAND_WRITE:
+		nand_lat = slc ? lat->slc_pg_wr_lat : lat->pg_wr_lat;
+		break;
+
+	case NAND_ERASE:
+		nand_lat = slc ? lat->slc_blk_er_lat : lat->blk_er_lat;
+		break;
+	}
+	rcu_read_unlock();
+
+	return nand_lat;
+}
+
+/* book the die and channel for @ncmd, called with lun->lock held */
+static uint64_t __book_nand(struct ssd *ssd, struct nand_cmd *ncmd, uint64_t cmd_stime)
 {
 	int c = ncmd->cmd;
-	uint64_t cmd_stime = (ncmd->stime == 0) ? __get_ioclock(ssd) : ncmd->stime;
 	uint64_t nand_stime, nand_etime;
 	uint64_t chnl_stime, chnl_etime;
 	uint64_t remaining, xfer_size, completed_time;
-	struct ssdparams *spp;
-	struct nand_lun *lun;
-	struct ssd_channel *ch;
+	uint64_t nand_lat;
+	struct ssdparams *spp = &ssd->sp;
 	struct ppa *ppa = ncmd->ppa;
-	uint32_t cell;
-	uint32_t storage_type;
-	NVMEV_DEBUG(
-		"SSD: %p, Enter stime: %lld, ch %d lun %d blk %d page %d command %d ppa 0x%llx\n",
-		ssd, ncmd->stime, ppa->g.ch, ppa->g.lun, ppa->g.blk, ppa->g.pg, c, ppa->ppa);
-
-	if (ppa->ppa == UNMAPPED_PPA) {
-		NVMEV_ERROR("Error ppa 0x%llx\n", ppa->ppa);
-		return cmd_stime;
-	}
-
-	spp = &ssd->sp;
-	lun = get_lun(ssd, ppa);
-	ch = get_ch(ssd, ppa);
-#if (BASE_SSD == HYBRID_SSD)
-	storage_type = get_storage_type(ssd, ppa);
-#else
-	storage_type = STORAGE_TYPE_SLC; /* Default for non-hybrid */
-#endif
-	
+	struct nand_lun *lun = get_lun(ssd, ppa);
+	struct nand_plane *pl = get_pl(ssd, ppa);
+	struct ssd_channel *ch = get_ch(ssd, ppa);
+	uint32_t mp_pg;
+	int suspend = SUSPEND_NONE;
+	bool cached = false;
+
+	nand_lat = __nand_latency(ssd, ppa, c, ncmd->xfer_size);
 	remaining = ncmd->xfer_size;
 
 	switch (c) {
 	case NAND_READ:
-		/* read: perform NAND cmd first */
-		nand_stime = max(lun->next_lun_avail_time, cmd_stime);
-
-#if (BASE_SSD == HYBRID_SSD)
-		if (storage_type == STORAGE_TYPE_SLC) {
-			/* SLC read latency */
-			nand_etime = nand_stime + spp->slc_read_latency;
-		} else { /* QLC */
-			uint32_t qlc_region = get_qlc_region(ssd, ppa);
-			
-			/* QLC read latency based on region */
-			switch (qlc_region) {
-			case 0: /* Q1 */
-				nand_etime = nand_stime + spp->qlc_q1_read_latency;
-				break;
-			case 1: /* Q2 */
-				nand_etime = nand_stime + spp->qlc_q2_read_latency;
-				break;
-			case 2: /* Q3 */
-				nand_etime = nand_stime + spp->qlc_q3_read_latency;
-				break;
-			case 3: /* Q4 */
-				nand_etime = nand_stime + spp->qlc_q4_read_latency;
-				break;
-			default:
-				nand_etime = nand_stime + spp->qlc_q1_read_latency; /* fallback to Q1 */
-				break;
-			}
+		/* read: perform NAND cmd first, sharing tR with a pending multi-plane read */
+		mp_pg = ppa->g.pg / spp->pgs_per_flashpg;
+		suspend = __suspend_mode(spp, lun, cmd_stime);
+		if (suspend == SUSPEND_NEW) {
+			/* read: suspend the in-flight program/erase and run in between */
+			nand_stime = cmd_stime + ssd_lat(ssd, suspend_lat);
+			nand_etime = nand_stime + nand_lat;
+		} else if (suspend == SUSPEND_QUEUED) {
+			/* read: the op is already suspended, run after the earlier reads */
+			nand_stime = max(cmd_stime, lun->mp_resume_time - ssd_lat(ssd, resume_lat));
+			nand_etime = nand_stime + nand_lat;
+		} else if (__join_multiplane(lun, ppa, c, mp_pg, cmd_stime)) {
+			nand_stime = lun->mp_nand_stime;
+			nand_etime = max(lun->mp_nand_etime, nand_stime + nand_lat);
+			lun->mp_planes |= 1U << ppa->g.pl;
+			lun->mp_nand_etime = nand_etime;
+		} else if (spp->cache_read && lun->cache_cmd == NAND_READ && ncmd->xfer_size &&
+			   cmd_stime < READ_ONCE(lun->next_lun_avail_time)) {
+			/* cache read: sense while the previous page is still going out */
+			nand_stime = max(lun->cache_next_stime, cmd_stime);
+			nand_etime = nand_stime + nand_lat;
+			__start_multiplane(lun, ppa, c, mp_pg, nand_stime, nand_etime);
+			cached = true;
+		} else {
+			nand_stime = max(READ_ONCE(lun->next_lun_avail_time), cmd_stime);
+			nand_etime = nand_stime + nand_lat;
+			__start_multiplane(lun, ppa, c, mp_pg, nand_stime, nand_etime);
 		}
-#else
-		/* Default latency for non-hybrid SSDs */
-		nand_etime = nand_stime + spp->slc_read_latency;
-#endif
 
-		/* read: then data transfer through channel */
+		/* read: then data transfer through channel, none for a copyback read */
 		chnl_stime = nand_etime;
+		if (cached) {
+			/* the page moves to the cache register once the previous one is out */
+			chnl_stime = max(nand_etime, READ_ONCE(lun->next_lun_avail_time)) +
+				     ssd_lat(ssd, cache_busy_lat);
+		}
+		chnl_etime = chnl_stime;
+		completed_time = chnl_stime;
+
+		/* the page register takes the next sense once it handed this page over */
+		if (suspend != SUSPEND_NONE || !ncmd->xfer_size) {
+			lun->cache_cmd = NAND_NOP;
+		} else {
+			lun->cache_cmd = NAND_READ;
+			lun->cache_next_stime = max(lun->cache_next_stime, chnl_stime);
+		}
 
 		while (remaining) {
 			xfer_size = min(remaining, (uint64_t)spp->max_ch_xfer_size);
 			chnl_etime = chmodel_request(ch->perf_model, chnl_stime, xfer_size);
 
 			if (ncmd->interleave_pci_dma) { /* overlap pci transfer with nand ch transfer*/
-				completed_time = ssd_advance_pcie(ssd, chnl_etime, xfer_size);
+				completed_time = ssd_advance_pcie(ssd, chnl_etime, xfer_size, PCIE_D2H);
 			} else {
 				completed_time = chnl_etime;
 			}
@@ -552,58 +1110,234 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 			chnl_stime = chnl_etime;
 		}
 
-		lun->next_lun_avail_time = chnl_etime;
+		pl->next_pln_avail_time = chnl_etime;
+		if (suspend != SUSPEND_NONE)
+			__resume_after_read(ssd, lun, cmd_stime, chnl_etime, suspend == SUSPEND_NEW);
+		__lun_reserve(lun, chnl_etime);
 		break;
 
 	case NAND_WRITE:
-		/* write: transfer data through channel first */
-		chnl_stime = max(lun->next_lun_avail_time, cmd_stime);
-
-		chnl_etime = chmodel_request(ch->perf_model, chnl_stime, ncmd->xfer_size);
-
-		/* write: then do NAND program */
-		nand_stime = chnl_etime;
-#if (BASE_SSD == HYBRID_SSD)
-		if (storage_type == STORAGE_TYPE_SLC) {
-			nand_etime = nand_stime + spp->slc_pg_wr_lat;
-		} else { /* QLC */
-			nand_etime = nand_stime + spp->qlc_pg_wr_lat;
+		mp_pg = ppa->g.pg / spp->pgs_per_oneshotpg;
+		if (__join_multiplane(lun, ppa, c, mp_pg, cmd_stime)) {
+			/*
+			 * write: load this plane's page register while the group waits,
+			 * then program every plane of the group with a single tPROG.
+			 * Planes that joined earlier keep the completion time already
+			 * returned to their caller.
+			 */
+			chnl_stime = max(pl->next_pln_avail_time, cmd_stime);
+			chnl_etime = __xfer_in(ch, chnl_stime, ncmd->xfer_size);
+
+			nand_stime = max(lun->mp_nand_stime, chnl_etime);
+			nand_etime = max(lun->mp_nand_etime, nand_stime + nand_lat);
+			lun->mp_planes |= 1U << ppa->g.pl;
+			lun->mp_nand_stime = nand_stime;
+			lun->mp_nand_etime = nand_etime;
+		} else if (spp->cache_program && lun->cache_cmd == NAND_WRITE && ncmd->xfer_size &&
+			   cmd_stime < READ_ONCE(lun->next_lun_avail_time)) {
+			/* cache program: load the cache register while the previous page programs */
+			chnl_stime = max(lun->cache_next_stime, cmd_stime);
+			chnl_etime = __xfer_in(ch, chnl_stime, ncmd->xfer_size);
+
+			/* then move it to the page register once the array is done */
+			nand_stime = max(chnl_etime, READ_ONCE(lun->next_lun_avail_time)) +
+				     ssd_lat(ssd, cache_busy_lat);
+			nand_etime = nand_stime + nand_lat;
+			__start_multiplane(lun, ppa, c, mp_pg, nand_stime, nand_etime);
+		} else {
+			/* write: transfer data through channel first */
+			chnl_stime = max(READ_ONCE(lun->next_lun_avail_time), cmd_stime);
+			chnl_etime = __xfer_in(ch, chnl_stime, ncmd->xfer_size);
+
+			/* write: then do NAND program */
+			nand_stime = chnl_etime;
+			nand_etime = nand_stime + nand_lat;
+			__start_multiplane(lun, ppa, c, mp_pg, nand_stime, nand_etime);
 		}
-#else
-		nand_etime = nand_stime + spp->pg_wr_lat;
-#endif
-		lun->next_lun_avail_time = nand_etime;
+
+		/* the cache register is free again once the program started */
+		lun->cache_cmd = NAND_WRITE;
+		lun->cache_next_stime = nand_stime;
+
+		__update_multiplane_planes(lun, nand_etime);
+		__lun_reserve(lun, nand_etime);
 		completed_time = nand_etime;
 		break;
 
 	case NAND_ERASE:
-		/* erase: only need to advance NAND status */
-		nand_stime = max(lun->next_lun_avail_time, cmd_stime);
-#if (BASE_SSD == HYBRID_SSD)
-		if (storage_type == STORAGE_TYPE_SLC) {
-			nand_etime = nand_stime + spp->slc_blk_er_lat;
-		} else { /* QLC */
-			nand_etime = nand_stime + spp->qlc_blk_er_lat;
+		/* erase: only need to advance NAND status, planes erase together */
+		if (__join_multiplane(lun, ppa, c, 0, cmd_stime)) {
+			nand_stime = lun->mp_nand_stime;
+			nand_etime = max(lun->mp_nand_etime, nand_stime + nand_lat);
+			lun->mp_planes |= 1U << ppa->g.pl;
+			lun->mp_nand_etime = nand_etime;
+		} else {
+			nand_stime = max(READ_ONCE(lun->next_lun_avail_time), cmd_stime);
+			nand_etime = nand_stime + nand_lat;
+			__start_multiplane(lun, ppa, c, 0, nand_stime, nand_etime);
 		}
-#else
-		nand_etime = nand_stime + spp->blk_er_lat;
-#endif
-		lun->next_lun_avail_time = nand_etime;
+		lun->cache_cmd = NAND_NOP;
+
+		__update_multiplane_planes(lun, nand_etime);
+		__lun_reserve(lun, nand_etime);
 		completed_time = nand_etime;
 		break;
 
-	case NAND_NOP:
-		/* no operation: just return last completed time of lun */
-		nand_stime = max(lun->next_lun_avail_time, cmd_stime);
-		lun->next_lun_avail_time = nand_stime;
-		completed_time = nand_stime;
+	default:
+		NVMEV_ERROR("Unsupported NAND command: 0x%x\n", c);
+		completed_time = 0;
 		break;
+	}
+
+	return completed_time;
+}
+
+/*
+ * Die queues. With a scheduling policy set, GC commands are not booked as
+ * they're issued but wait in a per-die queue and are dispatched when the die
+ * gets to them, the way firmware runs its own background work. Host commands
+ * are booked right away and the policy decides whether they go in front of
+ * the queued GC commands. A queued command is told the completion time it
+ * has in queue order. If host reads pass it later on, the completion time
+ * already returned for it is not revised.
+ */
+static uint64_t __sched_dispatch(struct ssd *ssd, struct nand_lun *lun, int i)
+{
+	struct nand_qcmd q = lun->q[i];
+
+	lun->q_len--;
+	memmove(&lun->q[i], &lun->q[i + 1], sizeof(lun->q[0]) * (lun->q_len - i));
+
+	q.ncmd.ppa = &q.ppa;
+	return __book_nand(ssd, &q.ncmd, q.ncmd.stime);
+}
 
+/* run the queued commands the die would have started by @now, they aren't preempted */
+static void __sched_catch_up(struct ssd *ssd, struct nand_lun *lun, uint64_t now)
+{
+	while (lun->q_len && max(lun->q[0].ncmd.stime, READ_ONCE(lun->next_lun_avail_time)) <= now)
+		__sched_dispatch(ssd, lun, 0);
+}
+
+/* whether a host command issued at @now may go ahead of the oldest queued command */
+static bool __sched_may_pass(struct ssdparams *spp, struct nand_qcmd *q, int c, uint64_t now)
+{
+	/* programs and erases are not latency critical, they stay in order */
+	if (c != NAND_READ)
+		return false;
+
+	switch (spp->nand_sched) {
+	case NAND_SCHED_FAIR:
+		return q->nbypassed < spp->nand_sched_max_bypass;
+	case NAND_SCHED_DEADLINE:
+		return now < q->deadline;
 	default:
-		NVMEV_ERROR("Unsupported NAND command: 0x%x\n", c);
-		return 0;
+		return true;
+	}
+}
+
+static uint64_t __sched_host(struct ssd *ssd, struct nand_lun *lun, struct nand_cmd *ncmd,
+			     uint64_t cmd_stime)
+{
+	struct ssdparams *spp = &ssd->sp;
+	struct ppa *ppa = ncmd->ppa;
+	uint32_t planes = 1U << ppa->g.pl;
+	int i;
+
+	__sched_catch_up(ssd, lun, cmd_stime);
+
+	while (lun->q_len && !__sched_may_pass(spp, &lun->q[0], ncmd->cmd, cmd_stime))
+		__sched_dispatch(ssd, lun, 0);
+
+	/* queued reads of the same wordline on other planes are sensed along with this one */
+	for (i = 0; ncmd->cmd == NAND_READ && i < lun->q_len;) {
+		struct nand_qcmd *q = &lun->q[i];
+
+		if (q->ncmd.cmd == NAND_READ && q->ncmd.stime <= cmd_stime &&
+		    !(planes & (1U << q->ppa.g.pl)) &&
+		    q->ppa.g.pg / spp->pgs_per_flashpg == ppa->g.pg / spp->pgs_per_flashpg) {
+			planes |= 1U << q->ppa.g.pl;
+			q->ncmd.stime = cmd_stime;
+			__sched_dispatch(ssd, lun, i);
+			continue;
+		}
+		i++;
+	}
+
+	for (i = 0; i < lun->q_len; i++)
+		lun->q[i].nbypassed++;
+
+	return __book_nand(ssd, ncmd, cmd_stime);
+}
+
+static uint64_t __sched_queue(struct ssd *ssd, struct nand_lun *lun, struct nand_cmd *ncmd,
+			      uint64_t cmd_stime)
+{
+	struct ssdparams *spp = &ssd->sp;
+	struct channel_model *chm = get_ch(ssd, ncmd->ppa)->perf_model;
+	struct nand_qcmd *q;
+	uint64_t stime;
+
+	__sched_catch_up(ssd, lun, cmd_stime);
+
+	/* nothing ahead of it, the die takes it right away */
+	if (!lun->q_len && READ_ONCE(lun->next_lun_avail_time) <= cmd_stime)
+		return __book_nand(ssd, ncmd, cmd_stime);
+
+	if (lun->q_len == spp->nand_sched_qdepth)
+		__sched_dispatch(ssd, lun, 0);
+
+	stime = max(cmd_stime, READ_ONCE(lun->next_lun_avail_time));
+	if (lun->q_len)
+		stime = max(stime, lun->q_tail_time);
+
+	q = &lun->q[lun->q_len++];
+	q->ncmd = *ncmd;
+	q->ncmd.stime = cmd_stime;
+	q->ppa = *ncmd->ppa;
+	q->deadline = cmd_stime + spp->nand_sched_deadline;
+	q->nbypassed = 0;
+
+	lun->q_tail_time = stime + __nand_latency(ssd, ncmd->ppa, ncmd->cmd, ncmd->xfer_size) +
+			   chm->xfer_lat * DIV_ROUND_UP(ncmd->xfer_size, UNIT_XFER_SIZE);
+	return lun->q_tail_time;
+}
+
+uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
+{
+	uint64_t cmd_stime = (ncmd->stime == 0) ? __get_ioclock(ssd) : ncmd->stime;
+	uint64_t completed_time;
+	struct nand_lun *lun;
+	struct ppa *ppa = ncmd->ppa;
+	NVMEV_DEBUG(
+		"SSD: %p, Enter stime: %lld, ch %d lun %d pl %d blk %d page %d command %d ppa 0x%llx\n",
+		ssd, ncmd->stime, ppa->g.ch, ppa->g.lun, ppa->g.pl, ppa->g.blk, ppa->g.pg, ncmd->cmd,
+		ppa->ppa);
+
+	if (ppa->ppa == UNMAPPED_PPA) {
+		NVMEV_ERROR("Error ppa 0x%llx\n", ppa->ppa);
+		return cmd_stime;
 	}
 
+	lun = get_lun(ssd, ppa);
+	if (ncmd->cmd == NAND_NOP) {
+		/* no operation: just return last completed time of lun */
+		return __lun_reserve(lun, cmd_stime);
+	}
+
+	/*
+	 * Submitters may run the FTL in parallel. A LUN is driven by one of them
+	 * at a time, the channels and PCIe link serialise on their own locks.
+	 */
+	spin_lock(&lun->lock);
+	if (ssd->sp.nand_sched == NAND_SCHED_FCFS)
+		completed_time = __book_nand(ssd, ncmd, cmd_stime);
+	else if (ncmd->type == GC_IO)
+		completed_time = __sched_queue(ssd, lun, ncmd, cmd_stime);
+	else
+		completed_time = __sched_host(ssd, lun, ncmd, cmd_stime);
+	spin_unlock(&lun->lock);
+
 	return completed_time;
 }
 
@@ -618,40 +1352,110 @@ uint64_t ssd_next_idle_time(struct ssd *ssd)
 
 		for (j = 0; j < spp->luns_per_ch; j++) {
 			struct nand_lun *lun = &ch->lun[j];
-			latest = max(latest, lun->next_lun_avail_time);
+			latest = max(latest, READ_ONCE(lun->next_lun_avail_time));
+			latest = max(latest, READ_ONCE(lun->q_tail_time));
 		}
 	}
 
 	return latest;
 }
 
-void adjust_ftl_latency(int target, int lat)
+void ssd_get_latency(struct ssd *ssd, struct ssd_latency *lat)
 {
-/* TODO ..*/
-#if 0
-    struct ssdparams *spp;
-    int i;
+	rcu_read_lock();
+	*lat = *rcu_dereference(ssd->lat);
+	rcu_read_unlock();
+}
+
+/* apply "name=value" pairs separated by blanks to @lat, nothing is applied on an error */
+int ssd_parse_latency(struct ssd_latency *lat, const char *buf)
+{
+	struct ssd_latency new = *lat;
+	char *str, *cur, *tok;
+	int i, ret = 0;
+
+	str = kstrdup(buf, GFP_KERNEL);
+	if (!str)
+		return -ENOMEM;
 
-    for (i = 0; i < SSD_PARTITIONS; i++) {
-        spp = &(g_conv_ftls[i].sp);
-        NVMEV_INFO("Before latency: %d %d %d, change to %d\n", spp->pg_rd_lat, spp->pg_wr_lat, spp->blk_er_lat, lat);
-        switch (target) {
-            case NAND_READ:
-                spp->pg_rd_lat = lat;
-                break;
+	cur = str;
+	while ((tok = strsep(&cur, " \t\n")) != NULL) {
+		char *val = strchr(tok, '=');
 
-            case NAND_WRITE:
-                spp->pg_wr_lat = lat;
-                break;
+		if (*tok == '\0')
+			continue;
 
-            case NAND_ERASE:
-                spp->blk_er_lat = lat;
-                break;
+		if (!val) {
+			ret = -EINVAL;
+			break;
+		}
+		*val++ = '\0';
+
+		for (i = 0; i < ARRAY_SIZE(ssd_latency_fields); i++) {
+			if (!strcmp(tok, ssd_latency_fields[i].name))
+				break;
+		}
+
+		if (i == ARRAY_SIZE(ssd_latency_fields) ||
+		    kstrtou64(val, 0, (uint64_t *)((char *)&new + ssd_latency_fields[i].offs))) {
+			ret = -EINVAL;
+			break;
+		}
+	}
+	kfree(str);
+
+	if (ret) {
+		NVMEV_ERROR("Invalid latency profile \"%s\"\n", buf);
+		return ret;
+	}
+
+	if (!new.ch_bandwidth || !new.pcie_bandwidth) {
+		NVMEV_ERROR("Need non-zero channel and PCIe bandwidth\n");
+		return -EINVAL;
+	}
+
+	*lat = new;
+	return 0;
+}
+
+/*
+ * Swap in a copy of @lat. Commands already booked keep their times, the
+ * ones after see the new profile as a whole.
+ */
+int ssd_set_latency(struct ssd *ssd, const struct ssd_latency *lat)
+{
+	struct ssd_latency *new, *old;
+	uint32_t ch_xfer_lat;
+	uint32_t i;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	*new = *lat;
+
+	mutex_lock(&ssd_latency_lock);
+	old = rcu_dereference_protected(ssd->lat, lockdep_is_held(&ssd_latency_lock));
+	rcu_assign_pointer(ssd->lat, new);
+
+	ch_xfer_lat = BANDWIDTH_TO_TX_TIME(new->ch_bandwidth) +
+		      new->fw_ch_xfer_lat * UNIT_XFER_SIZE / KB(4);
+	for (i = 0; i < ssd->sp.nchs; i++)
+		chmodel_set_xfer_lat(ssd->ch[i].perf_model, ch_xfer_lat);
+	chmodel_set_xfer_lat(ssd->pcie->h2d, BANDWIDTH_TO_TX_TIME(new->pcie_bandwidth));
+	chmodel_set_xfer_lat(ssd->pcie->d2h, BANDWIDTH_TO_TX_TIME(new->pcie_bandwidth));
+	mutex_unlock(&ssd_latency_lock);
+
+	kfree_rcu(old, rcu);
+	return 0;
+}
+
+void ssd_print_latency(struct ssd *ssd, struct seq_file *m)
+{
+	struct ssd_latency lat;
+	int i;
 
-            default:
-                NVMEV_ERROR("Unsupported NAND command\n");
-        }
-        NVMEV_INFO("After latency: %d %d %d\n", spp->pg_rd_lat, spp->pg_wr_lat, spp->blk_er_lat);
-    }
-#endif
+	ssd_get_latency(ssd, &lat);
+	for (i = 0; i < ARRAY_SIZE(ssd_latency_fields); i++)
+		seq_printf(m, "%s=%llu\n", ssd_latency_fields[i].name,
+			   *(uint64_t *)((char *)&lat + ssd_latency_fields[i].offs));
 }
@@ -4,6 +4,8 @@
 #define _NVMEVIRT_SSD_H
 
 #include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/jump_label.h>
 #include "pqueue/pqueue.h"
 #include "ssd_config.h"
 #include "channel_model.h"
@@ -37,6 +39,14 @@ enum {
 	GC_IO = 1,
 };
 
+/* how a die orders queued GC commands against host commands */
+enum {
+	NAND_SCHED_FCFS = 0, /* no die queues, commands are booked as issued */
+	NAND_SCHED_READ_FIRST = 1, /* host reads always pass queued GC commands */
+	NAND_SCHED_FAIR = 2, /* ... up to nand_sched_max_bypass times per command */
+	NAND_SCHED_DEADLINE = 3, /* ... until a GC command waited nand_sched_deadline */
+};
+
 enum {
 	SEC_FREE = 0,
 	SEC_INVALID = 1,
@@ -50,6 +60,48 @@ enum {
 /* Storage type for hybrid SSD */
 enum { STORAGE_TYPE_SLC = 0, STORAGE_TYPE_QLC = 1, MAX_STORAGE_TYPES };
 
+/* Bit of the cell a page is stored in, MLC has LSB and MSB only */
+enum { CELL_TYPE_LSB = 0, CELL_TYPE_CSB = 1, CELL_TYPE_MSB = 2, CELL_TYPE_TSB = 3, MAX_CELL_TYPES };
+
+/* Hybrid SLC/QLC profile, picked by the profile module param */
+#if (BASE_SSD == HYBRID_SSD)
+DECLARE_STATIC_KEY_TRUE(nvmev_hybrid_key);
+#define ssd_hybrid() static_branch_likely(&nvmev_hybrid_key)
+#else
+DECLARE_STATIC_KEY_FALSE(nvmev_hybrid_key);
+#define ssd_hybrid() static_branch_unlikely(&nvmev_hybrid_key)
+#endif
+
+/* NAND geometry and timing of a device profile, see the profile module param */
+struct nand_profile {
+	int cell_mode;
+	int nchs; /* # of channels in the SSD */
+	int luns_per_ch; /* # of LUNs per channel */
+	int pls_per_lun; /* # of planes per LUN (Die) */
+	int flashpg_size; /* bytes, at most NAND_MAX_FLASHPG_SIZE */
+	int oneshotpg_size; /* bytes, at most NAND_MAX_ONESHOTPG_SIZE */
+	int blks_per_pl; /* 0 to size blocks by blk_size instead */
+	uint64_t blk_size; /* bytes, used when blks_per_pl is 0 */
+	uint64_t zone_size; /* bytes, ZNS only */
+	int dies_per_zone; /* ZNS only */
+	uint64_t ch_bandwidth; /* MiB/s */
+	unsigned long long write_buffer_size; /* bytes */
+
+	int pg_4kb_rd_lat[MAX_CELL_TYPES]; /* ns */
+	int pg_rd_lat[MAX_CELL_TYPES]; /* ns */
+	int pg_wr_lat; /* ns */
+	int blk_er_lat; /* ns */
+	int max_ch_xfer_size; /* bytes */
+	int fw_4kb_rd_lat; /* ns */
+	int fw_rd_lat; /* ns */
+	int fw_wbuf_lat0; /* ns */
+	int fw_wbuf_lat1; /* ns */
+	int fw_ch_xfer_lat; /* ns */
+};
+
+/* profile picked at load time, NULL keeps the ssd_config.h model of BASE_SSD */
+extern const struct nand_profile *nvmev_nand_profile;
+
 /* Page access type for hotness tracking */
 enum { ACCESS_READ = 0, ACCESS_WRITE = 1, ACCESS_UPDATE = 2 };
 
@@ -109,9 +161,30 @@ struct nand_plane {
 struct nand_lun {
 	struct nand_plane *pl;
 	int npls;
-	uint64_t next_lun_avail_time;
+	uint64_t next_lun_avail_time; /* only moves forward, see __lun_reserve() */
+	spinlock_t lock; /* plane and multi-plane state below */
 	bool busy;
 	uint64_t gc_endtime;
+
+	/* multi-plane operation group last issued to this LUN */
+	int mp_cmd;
+	uint32_t mp_planes; /* bitmap of planes in the group */
+	uint32_t mp_pg; /* oneshot/flash page offset shared by the group */
+	uint64_t mp_nand_stime;
+	uint64_t mp_nand_etime;
+	uint64_t mp_resume_time; /* when a suspended program/erase resumes */
+	int mp_nsuspends;
+
+	uint64_t nr_suspends; /* # of program/erase suspends for reads */
+
+	/* cache register, see NAND_CACHE_READ and NAND_CACHE_PROGRAM */
+	int cache_cmd; /* NAND_READ or NAND_WRITE the next command can pipeline behind */
+	uint64_t cache_next_stime; /* when the next sense or data-in of that kind may start */
+
+	/* GC commands waiting for the die, oldest first, see ssd_advance_nand() */
+	struct nand_qcmd *q;
+	int q_len;
+	uint64_t q_tail_time; /* expected completion of the last queued command */
 };
 
 struct ssd_channel {
@@ -121,8 +194,18 @@ struct ssd_channel {
 	struct channel_model *perf_model;
 };
 
+/* direction of a PCIe transfer, the link is full duplex */
+enum {
+	PCIE_H2D = 0, /* host to device: write data, HMB reads */
+	PCIE_D2H = 1, /* device to host: read data, HMB writes */
+};
+
 struct ssd_pcie {
-	struct channel_model *perf_model;
+	struct channel_model *h2d;
+	struct channel_model *d2h;
+	uint32_t mps;
+	uint32_t mrrs;
+	uint32_t tlp_overhead;
 };
 
 struct nand_cmd {
@@ -134,10 +217,44 @@ struct nand_cmd {
 	struct ppa *ppa;
 };
 
+/* a command in a die queue */
+struct nand_qcmd {
+	struct nand_cmd ncmd;
+	struct ppa ppa;
+	uint64_t deadline;
+	int nbypassed; /* host reads that went ahead of it */
+};
+
+/* a mapping page held in the write-back cache */
+struct wb_entry {
+	uint64_t lpn;
+	uint64_t nsecs_clean; /* when the program of this data completes */
+	struct hlist_node hnode;
+	struct list_head list; /* on the free, dirty, clean or a pending list */
+	bool dirty;
+	uint32_t ruh; /* FDP reclaim unit handle the data is written back through */
+	uint32_t sec_mask; /* sectors of the page held, all ones once the page is complete */
+};
+
 struct buffer {
 	size_t size;
 	size_t remaining;
 	spinlock_t lock;
+
+	/*
+	 * LPN-indexed write-back cache, unused when nr_slots is 0. It is only
+	 * touched by the dispatcher of the owning namespace, so it is not locked.
+	 */
+	uint32_t nr_slots;
+	uint32_t nr_dirty;
+	uint32_t hash_bits;
+	struct wb_entry *slots;
+	struct hlist_head *buckets;
+	struct list_head free_list;
+	struct list_head dirty_list; /* oldest dirty first */
+	struct list_head clean_list; /* earliest cleaned first */
+
+	uint64_t absorbed; /* overwrites of data still dirty in the cache */
 };
 
 /*
@@ -199,13 +316,25 @@ struct ssdparams {
 	int slc_write_latency; /* SLC write latency in nanoseconds */
 	int slc_erase_latency; /* SLC erase latency in nanoseconds */
 	
-	/* QLC latency parameters for 4 regions (Q1, Q2, Q3, Q4) */
-	int qlc_q1_read_latency;  /* Q1 region read latency */
-	int qlc_q2_read_latency;  /* Q2 region read latency */
-	int qlc_q3_read_latency;  /* Q3 region read latency */
-	int qlc_q4_read_latency;  /* Q4 region read latency */
-	int qlc_write_latency;    /* QLC write latency (for migration) */
-	int qlc_erase_latency;    /* QLC erase latency */
+	/* cell_mode blocks, QLC ones in the hybrid profile, see get_cell() */
+	int pg_4kb_rd_lat[MAX_CELL_TYPES]; /* 4KB read latency by bit of the cell in nanoseconds */
+	int pg_rd_lat[MAX_CELL_TYPES]; /* Flash page read latency by bit of the cell in nanoseconds */
+	int pg_wr_lat; /* Oneshot page program latency in nanoseconds */
+	int blk_er_lat; /* Block erase latency in nanoseconds */
+	int max_ch_xfer_size; /* Largest channel transfer in bytes */
+
+	int suspend_lat; /* Program/erase suspend latency in nanoseconds */
+	int resume_lat; /* Program/erase resume latency in nanoseconds */
+	int max_suspends; /* Max # of suspends of one program/erase */
+
+	int cache_read; /* Pipeline back-to-back reads of a die through the cache register */
+	int cache_program; /* Pipeline back-to-back programs of a die through the cache register */
+	int cache_busy_lat; /* Cache to page register move in nanoseconds */
+
+	int nand_sched; /* NAND_SCHED_* policy of the die queues */
+	int nand_sched_qdepth; /* Max # of GC commands queued per die */
+	int nand_sched_max_bypass; /* Host reads that may pass a queued GC command */
+	uint64_t nand_sched_deadline; /* Time a GC command may be passed for in nanoseconds */
 
 	int fw_4kb_rd_lat; /* Firmware overhead of 4KB read of read in nanoseconds */
 	int fw_rd_lat; /* Firmware overhead of read of read in nanoseconds */
@@ -214,7 +343,10 @@ struct ssdparams {
 	int fw_ch_xfer_lat; /* Firmware overhead of nand channel data transfer(4KB) in nanoseconds */
 
 	uint64_t ch_bandwidth; /*NAND CH Maximum bandwidth in MiB/s*/
-	uint64_t pcie_bandwidth; /*PCIE Maximum bandwidth in MiB/s*/
+	uint64_t pcie_bandwidth; /*PCIE Maximum bandwidth of one direction in MiB/s*/
+	uint32_t pcie_mps; /* Max TLP payload in bytes */
+	uint32_t pcie_mrrs; /* Max read request size in bytes */
+	uint32_t pcie_tlp_overhead; /* Wire bytes a TLP adds to its payload */
 
 	/* below are all calculated values */
 	unsigned long secs_per_blk; /* # of sectors per block */
@@ -262,17 +394,65 @@ struct ssdparams {
 	unsigned long qlc_pgs_per_ch; /* # of pages per channel in QLC */
 	unsigned long qlc_blks_per_ch; /* # of blocks per channel in QLC */
 
+	/* PPA and LPN ranges of SLC and QLC, end exclusive */
+	unsigned long slc_start_ppa, slc_end_ppa;
+	unsigned long qlc_start_ppa, qlc_end_ppa;
+	unsigned long slc_start_lpn, slc_end_lpn;
+	unsigned long qlc_start_lpn, qlc_end_lpn;
+
 	unsigned long long write_buffer_size;
 };
 
+/*
+ * Timings that can be changed while the device runs, through
+ * /proc/nvmev/latency_profile. Starts out from ssdparams. A change swaps in
+ * a whole new profile, so readers never see a half-updated one. All values
+ * are in nanoseconds, bandwidths in MiB/s.
+ */
+struct ssd_latency {
+	uint64_t pg_rd_lat[MAX_CELL_TYPES];
+	uint64_t pg_4kb_rd_lat[MAX_CELL_TYPES];
+	uint64_t pg_wr_lat;
+	uint64_t blk_er_lat;
+	uint64_t slc_read_latency;
+	uint64_t slc_pg_wr_lat;
+	uint64_t slc_blk_er_lat;
+
+	uint64_t suspend_lat;
+	uint64_t resume_lat;
+	uint64_t cache_busy_lat;
+
+	uint64_t fw_4kb_rd_lat;
+	uint64_t fw_rd_lat;
+	uint64_t fw_wbuf_lat0;
+	uint64_t fw_wbuf_lat1;
+	uint64_t fw_ch_xfer_lat;
+
+	uint64_t ch_bandwidth;
+	uint64_t pcie_bandwidth;
+
+	struct rcu_head rcu;
+};
+
 struct ssd {
 	struct ssdparams sp;
 	struct ssd_channel *ch;
 	struct ssd_pcie *pcie;
 	struct buffer *write_buffer;
 	unsigned int cpu_nr_dispatcher;
+	struct ssd_latency __rcu *lat;
 };
 
+/* read one field of the live latency profile */
+#define ssd_lat(ssd, field)                                  \
+	({                                                   \
+		uint64_t __lat;                              \
+		rcu_read_lock();                             \
+		__lat = rcu_dereference((ssd)->lat)->field; \
+		rcu_read_unlock();                           \
+		__lat;                                       \
+	})
+
 static inline struct ssd_channel *get_ch(struct ssd *ssd, struct ppa *ppa)
 {
 	return &(ssd->ch[ppa->g.ch]);
@@ -307,16 +487,15 @@ static inline uint32_t get_storage_type(struct ssd *ssd, struct ppa *ppa)
 {
 	struct ssdparams *spp = &ssd->sp;
 	
-	#if (BASE_SSD == HYBRID_SSD)
-	/* Check if PPA is in SLC or QLC range */
-	if (ppa->ppa < spp->slc_tt_pgs) {
+	if (!ssd_hybrid())
+		return STORAGE_TYPE_SLC; /* Default to SLC for non-hybrid */
+
+	/* SLC blocks are on the first slc_channels channels */
+	if (ppa->g.ch < spp->slc_channels) {
 		return STORAGE_TYPE_SLC;
 	} else {
 		return STORAGE_TYPE_QLC;
 	}
-	#else
-	return STORAGE_TYPE_SLC; /* Default to SLC for non-hybrid */
-	#endif
 }
 
 /* Get storage type from LPN */
@@ -324,60 +503,69 @@ static inline uint32_t get_storage_type_from_lpn(struct ssd *ssd, uint64_t lpn)
 {
 	struct ssdparams *spp = &ssd->sp;
 	
-	#if (BASE_SSD == HYBRID_SSD)
+	if (!ssd_hybrid())
+		return STORAGE_TYPE_SLC; /* Default to SLC for non-hybrid */
+
 	/* Check if LPN is in SLC or QLC range */
 	if (lpn < spp->slc_tt_pgs) {
 		return STORAGE_TYPE_SLC;
 	} else {
 		return STORAGE_TYPE_QLC;
 	}
-	#else
-	return STORAGE_TYPE_SLC; /* Default to SLC for non-hybrid */
-	#endif
 }
 
-/* Get QLC region (Q1, Q2, Q3, Q4) based on page number */
-static inline uint32_t get_qlc_region(struct ssd *ssd, struct ppa *ppa)
+/*
+ * Bit of the cell the page at @ppa is in. The 4KB pages of a wordline fill
+ * its bits in order, LSB first, so the latency follows from the page offset.
+ */
+static inline uint32_t get_cell(struct ssd *ssd, struct ppa *ppa)
 {
 	struct ssdparams *spp = &ssd->sp;
-	uint64_t qlc_page_offset;
+	uint32_t bits = spp->cell_mode, pgs_per_wl, bit;
 
-	#if (BASE_SSD == HYBRID_SSD)
-	/* Calculate offset within QLC region */
-	qlc_page_offset = ppa->ppa - spp->slc_tt_pgs;
+	if (get_storage_type(ssd, ppa) == STORAGE_TYPE_SLC && ssd_hybrid())
+		return CELL_TYPE_LSB;
 
-	/* Divide QLC region into 4 equal parts */
-	uint64_t region_size = spp->qlc_tt_pgs / 4;
+	pgs_per_wl = ssd_hybrid() ? spp->qlc_pgs_per_oneshotpg : spp->pgs_per_oneshotpg;
+	if (bits <= CELL_MODE_SLC || pgs_per_wl < bits)
+		return CELL_TYPE_LSB;
 
-	if (qlc_page_offset < region_size) {
-		return 0;  /* Q1 */
-	} else if (qlc_page_offset < region_size * 2) {
-		return 1;  /* Q2 */
-	} else if (qlc_page_offset < region_size * 3) {
-		return 2;  /* Q3 */
-	} else {
-		return 3;  /* Q4 */
-	}
-	#else
-	return 0;  /* Default to Q1 for non-hybrid */
-	#endif
+	bit = (ppa->g.pg % pgs_per_wl) / (pgs_per_wl / bits);
+	if (bits == CELL_MODE_MLC && bit == 1)
+		return CELL_TYPE_MSB;
+
+	return min_t(uint32_t, bit, CELL_TYPE_TSB);
 }
 
 void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts);
-void ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher);
+void ssd_set_lba_size(struct ssdparams *spp, int secsz);
+int ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher);
 void ssd_remove(struct ssd *ssd);
 
 uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd);
-uint64_t ssd_advance_pcie(struct ssd *ssd, uint64_t request_time, uint64_t length);
+void ssd_remove_pcie(struct ssd_pcie *pcie);
+uint64_t ssd_advance_pcie(struct ssd *ssd, uint64_t request_time, uint64_t length, int dir);
 uint64_t ssd_advance_write_buffer(struct ssd *ssd, uint64_t request_time, uint64_t length);
 uint64_t ssd_next_idle_time(struct ssd *ssd);
 
+void ssd_get_latency(struct ssd *ssd, struct ssd_latency *lat);
+int ssd_parse_latency(struct ssd_latency *lat, const char *buf);
+int ssd_set_latency(struct ssd *ssd, const struct ssd_latency *lat);
+void ssd_print_latency(struct ssd *ssd, struct seq_file *m);
+
 void buffer_init(struct buffer *buf, size_t size);
 uint32_t buffer_allocate(struct buffer *buf, size_t size);
 bool buffer_release(struct buffer *buf, size_t size);
 void buffer_refill(struct buffer *buf);
+void buffer_init_cache(struct buffer *buf, uint32_t nr_slots);
+void buffer_remove_cache(struct buffer *buf);
+struct wb_entry *buffer_lookup(struct buffer *buf, uint64_t lpn);
+struct wb_entry *buffer_get_slot(struct buffer *buf, uint64_t lpn, uint64_t *nsecs_avail);
+void buffer_mark_clean(struct buffer *buf, struct wb_entry *e, uint64_t nsecs_clean);
+void buffer_mark_pending(struct buffer *buf, struct wb_entry *e, struct list_head *pending);
+void buffer_clean_pending(struct buffer *buf, struct list_head *pending, uint64_t nsecs_clean);
+void buffer_drop(struct buffer *buf, uint64_t lpn);
 
-void adjust_ftl_latency(int target, int lat);
 
 /* Hotness tracking structure */
 struct page_hotness {
@@ -43,16 +43,83 @@
 #define HYBRID_SLC_WRITE_LATENCY (80000)  /* ns - 80μs */
 #define HYBRID_SLC_ERASE_LATENCY (0)  /* ns */
 
-/* QLC Latency Parameters - Four regions (Q1, Q2, Q3, Q4) */
-#define HYBRID_QLC_Q1_READ_LATENCY (75000)   /* ns - Q1 region: 75μs */
-#define HYBRID_QLC_Q2_READ_LATENCY (95000)   /* ns - Q2 region: 95μs */
-#define HYBRID_QLC_Q3_READ_LATENCY (130000)  /* ns - Q3 region: 130μs */
-#define HYBRID_QLC_Q4_READ_LATENCY (205000)  /* ns - Q4 region: 205μs */
+/* QLC read latency by the bit of the cell a page is in */
+#define HYBRID_QLC_LSB_READ_LATENCY (75000)   /* ns - 75μs */
+#define HYBRID_QLC_CSB_READ_LATENCY (95000)   /* ns - 95μs */
+#define HYBRID_QLC_MSB_READ_LATENCY (130000)  /* ns - 130μs */
+#define HYBRID_QLC_TSB_READ_LATENCY (205000)  /* ns - 205μs */
 
 /* QLC write latency - only used for migration, not for performance testing */
 #define HYBRID_QLC_WRITE_LATENCY (561000)  /* ns */
 #define HYBRID_QLC_ERASE_LATENCY (0)  /* ns */
 
+/* Program/erase suspend: reads preempt an in-flight program or erase */
+#define NAND_SUSPEND_LATENCY (20000)  /* ns - time to suspend a program/erase */
+#define NAND_RESUME_LATENCY (10000)  /* ns - time to resume the suspended op */
+#define NAND_MAX_SUSPENDS (0)  /* suspends allowed per program/erase, 0 disables */
+
+/* Cache read/program: the cache register lets back-to-back ops on a die overlap */
+#define NAND_CACHE_READ (0)  /* sense the next page while the previous one goes out */
+#define NAND_CACHE_PROGRAM (0)  /* load the next page while the previous one programs */
+#define NAND_CACHE_BUSY_LATENCY (3000)  /* ns - move a page between cache and page register */
+
+/* Per-die queues for GC commands, host reads may be scheduled ahead of them */
+#define NAND_SCHED_POLICY NAND_SCHED_FCFS  /* NAND_SCHED_FCFS disables, see ssd.h */
+#define NAND_SCHED_QDEPTH (64)  /* GC commands queued per die */
+#define NAND_SCHED_MAX_BYPASS (16)  /* NAND_SCHED_FAIR: host reads passing one GC command */
+#define NAND_SCHED_GC_DEADLINE (2000000)  /* ns - NAND_SCHED_DEADLINE: GC command is due */
+
+/* GC relocates pages that stay on the same plane with on-die copyback */
+#define GC_COPYBACK (0)
+
+/* Wear leveling */
+#define WL_ERASE_CNT_THRESHOLD (64)  /* static WL once erase count spread exceeds this, 0 disables */
+#define WL_CHECK_INTERVAL (16)  /* check the spread every N line erases */
+
+/* Controller DRAM read cache for flash pages */
+#define READ_CACHE_SIZE (0)  /* bytes, 0 disables */
+#define READ_CACHE_POLICY READ_CACHE_LRU  /* READ_CACHE_LRU or READ_CACHE_CLOCK */
+
+/* Sequential read-ahead into the read cache, only with READ_CACHE_SIZE set */
+#define READ_AHEAD_DEPTH (0)  /* mapping pages kept prefetched ahead of a stream, 0 disables */
+#define READ_AHEAD_HISTORY (8)  /* read commands remembered to detect streams */
+#define READ_AHEAD_TRIGGER (2)  /* back-to-back sequential reads before prefetching starts */
+
+/* Demand-paged mapping table (DFTL) */
+#define DFTL_CMT_SIZE (0)  /* bytes of cached translation pages, 0 keeps the whole map resident */
+#define DFTL_MAP_ENTRY_SIZE (4)  /* bytes of one mapping entry in a translation page */
+
+/* PCIe link, each direction runs at the raw rate of GEN x LANES */
+#define PCIE_GEN (3)  /* 1 to 5 */
+#define PCIE_LANES (4)
+#define PCIE_MPS (256)  /* bytes - max payload of a TLP */
+#define PCIE_MRRS (512)  /* bytes - max read request size */
+#define PCIE_TLP_OVERHEAD (24)  /* bytes - header, sequence number, LCRC and framing of a TLP */
+
+/* Host Memory Buffer for the mapping cache, demand pages the map when enabled */
+#define HMB_PREFERRED_SIZE (0)  /* bytes requested from the host, 0 disables HMB */
+#define HMB_MIN_SIZE (MB(16))  /* bytes, smaller buffers are rejected */
+#define HMB_MAX_DESCS (256)  /* descriptors the host may hand over, a 4KiB list */
+
+/* Flexible Data Placement: one reclaim group, a reclaim unit is a line */
+#define FDP_NR_RUHS (0)  /* reclaim unit handles, 0 disables FDP */
+#define FDP_ENDGID (1)  /* endurance group the FDP configuration belongs to */
+
+/* Device-side hot/cold separation of user writes, see the hotcold_separation param */
+#define HOTCOLD_SKETCH_WIDTH (1 << 16)  /* counters per row of the write frequency sketch */
+#define HOTCOLD_HOT_THRESHOLD (2)  /* writes in the decay window that make an LPN hot */
+#define HOTCOLD_DECAY_INTERVAL (1 << 18)  /* host writes between halvings of the sketch */
+
+/* Write-back cache watermarks, in percent of the write buffer */
+#define WB_HIGH_WATERMARK (75)  /* start flushing dirty pages */
+#define WB_LOW_WATERMARK (50)  /* stop flushing dirty pages */
+
+/* LBA data size of conventional namespaces, format NVM can switch it at runtime */
+#define LBA_BITS (9)  /* 9 (512B) or 12 (4KiB) */
+
+/* Writes smaller than a mapping page read-modify-write the old flash page */
+#define SUBPAGE_MERGE (1)  /* defer the old page read to write-back, so adjacent small writes can fill the page */
+
 /* Hybrid Storage Capacity Parameters */
 #define HYBRID_SLC_PGS_PER_BLK (256)  /* SLC pages per block */
 #define HYBRID_SLC_BLKS_PER_PL (8192)  /* SLC blocks per plane */
@@ -75,6 +142,17 @@
 #define NS_SSD_TYPE_1 NS_SSD_TYPE_0
 #define NS_CAPACITY_1 (0)
 
+/* no NAND behind the simple FTL, the latencies only fill in ssdparams */
+#define NAND_4KB_READ_LATENCY_LSB (0)
+#define NAND_4KB_READ_LATENCY_MSB (0)
+#define NAND_4KB_READ_LATENCY_CSB (0)
+#define NAND_READ_LATENCY_LSB (0)
+#define NAND_READ_LATENCY_MSB (0)
+#define NAND_READ_LATENCY_CSB (0)
+#define NAND_PROG_LATENCY (0)
+#define NAND_ERASE_LATENCY (0)
+#define MAX_CH_XFER_SIZE KB(16)
+
 #elif (BASE_SSD == SAMSUNG_970PRO)
 #define NR_NAMESPACES 1
 
@@ -83,6 +161,16 @@
 #define NS_SSD_TYPE_1 NS_SSD_TYPE_0
 #define NS_CAPACITY_1 (0)
 
+#define NAND_4KB_READ_LATENCY_LSB (35760 - 6000)
+#define NAND_4KB_READ_LATENCY_MSB (35760 + 6000)
+#define NAND_4KB_READ_LATENCY_CSB (35760)
+#define NAND_READ_LATENCY_LSB (36013 - 6000)
+#define NAND_READ_LATENCY_MSB (36013 + 6000)
+#define NAND_READ_LATENCY_CSB (36013)
+#define NAND_PROG_LATENCY (185000)
+#define NAND_ERASE_LATENCY (0)
+#define MAX_CH_XFER_SIZE KB(16) /* to overlap with pcie transfer */
+
 #elif (BASE_SSD == ZNS_PROTOTYPE)
 #define NR_NAMESPACES 1
 
@@ -91,6 +179,16 @@
 #define NS_SSD_TYPE_1 NS_SSD_TYPE_0
 #define NS_CAPACITY_1 (0)
 
+#define NAND_4KB_READ_LATENCY_LSB (25485)
+#define NAND_4KB_READ_LATENCY_MSB (25485)
+#define NAND_4KB_READ_LATENCY_CSB (25485)
+#define NAND_READ_LATENCY_LSB (40950)
+#define NAND_READ_LATENCY_MSB (40950)
+#define NAND_READ_LATENCY_CSB (40950)
+#define NAND_PROG_LATENCY (1913640)
+#define NAND_ERASE_LATENCY (0)
+#define MAX_CH_XFER_SIZE (FLASH_PAGE_SIZE) /* to overlap with pcie transfer */
+
 #elif (BASE_SSD == KV_PROTOTYPE)
 #define NR_NAMESPACES 1
 
@@ -99,6 +197,16 @@
 #define NS_SSD_TYPE_1 NS_SSD_TYPE_0
 #define NS_CAPACITY_1 (0)
 
+#define NAND_4KB_READ_LATENCY_LSB (35760 - 6000)
+#define NAND_4KB_READ_LATENCY_MSB (35760 + 6000)
+#define NAND_4KB_READ_LATENCY_CSB (35760)
+#define NAND_READ_LATENCY_LSB (36013 - 6000)
+#define NAND_READ_LATENCY_MSB (36013 + 6000)
+#define NAND_READ_LATENCY_CSB (36013)
+#define NAND_PROG_LATENCY (185000)
+#define NAND_ERASE_LATENCY (0)
+#define MAX_CH_XFER_SIZE KB(16) /* to overlap with pcie transfer */
+
 #elif (BASE_SSD == WD_ZN540)
 #define NR_NAMESPACES 1
 
@@ -107,6 +215,16 @@
 #define NS_SSD_TYPE_1 NS_SSD_TYPE_0
 #define NS_CAPACITY_1 (0)
 
+#define NAND_4KB_READ_LATENCY_LSB (35760 - 6000)
+#define NAND_4KB_READ_LATENCY_MSB (35760 + 6000)
+#define NAND_4KB_READ_LATENCY_CSB (35760)
+#define NAND_READ_LATENCY_LSB (36013 - 6000)
+#define NAND_READ_LATENCY_MSB (36013 + 6000)
+#define NAND_READ_LATENCY_CSB (36013)
+#define NAND_PROG_LATENCY (185000 + 5000)
+#define NAND_ERASE_LATENCY (0)
+#define MAX_CH_XFER_SIZE (FLASH_PAGE_SIZE) /* to overlap with pcie transfer */
+
 #elif (BASE_SSD == HYBRID_SSD)
 #define NR_NAMESPACES 1
 
@@ -115,10 +233,48 @@
 #define NS_SSD_TYPE_1 NS_SSD_TYPE_0
 #define NS_CAPACITY_1 (0)
 
+/* QLC array, SLC blocks take the HYBRID_SLC_* latencies */
+#define NAND_4KB_READ_LATENCY_LSB HYBRID_QLC_LSB_READ_LATENCY
+#define NAND_4KB_READ_LATENCY_CSB HYBRID_QLC_CSB_READ_LATENCY
+#define NAND_4KB_READ_LATENCY_MSB HYBRID_QLC_MSB_READ_LATENCY
+#define NAND_4KB_READ_LATENCY_TSB HYBRID_QLC_TSB_READ_LATENCY
+#define NAND_READ_LATENCY_LSB HYBRID_QLC_LSB_READ_LATENCY
+#define NAND_READ_LATENCY_CSB HYBRID_QLC_CSB_READ_LATENCY
+#define NAND_READ_LATENCY_MSB HYBRID_QLC_MSB_READ_LATENCY
+#define NAND_READ_LATENCY_TSB HYBRID_QLC_TSB_READ_LATENCY
+#define NAND_PROG_LATENCY HYBRID_QLC_WRITE_LATENCY
+#define NAND_ERASE_LATENCY HYBRID_QLC_ERASE_LATENCY
+#define MAX_CH_XFER_SIZE KB(16) /* to overlap with pcie transfer */
+
 #else
 #error "Must select one of INTEL_OPTANE, SAMSUNG_970PRO, ZNS_PROTOTYPE, KV_PROTOTYPE, WD_ZN540, or HYBRID_SSD"
 #endif
 
+/*
+ * The NS_SSD_TYPE_x above are the defaults, the ns_types and profile module
+ * params override them at load time. With NVMEV_ALL_FTLS every FTL is linked in.
+ */
+#ifndef NVMEV_ALL_FTLS
+#define NVMEV_ALL_FTLS 0
+#endif
+
+#define NVMEV_MAX_NAMESPACES 2
+
+/* Bounds of the page sizes a profile picked at load time may use */
+#define NAND_MAX_FLASHPG_SIZE (FLASH_PAGE_SIZE > KB(64) ? FLASH_PAGE_SIZE : KB(64))
+#define NAND_MAX_ONESHOTPG_SIZE (ONESHOT_PAGE_SIZE > KB(192) ? ONESHOT_PAGE_SIZE : KB(192))
+
+/* Top bit of QLC cells, models without QLC read it like the MSB */
+#ifndef NAND_READ_LATENCY_TSB
+#define NAND_READ_LATENCY_TSB NAND_READ_LATENCY_MSB
+#define NAND_4KB_READ_LATENCY_TSB NAND_4KB_READ_LATENCY_MSB
+#endif
+
+#define NS_CAPACITY(ns) (ns == 0 ? NS_CAPACITY_0 : NS_CAPACITY_1)
+#define NS_SSD_TYPE(ns) (nvmev_ns_ssd_type[ns])
+#define SUPPORTED_SSD_TYPE(type) \
+	(NVMEV_ALL_FTLS || NS_SSD_TYPE_0 == SSD_TYPE_##type || NS_SSD_TYPE_1 == SSD_TYPE_##type)
+
 /* Allocator type */
 enum {
 	ALLOCATOR_TYPE_BITMAP,
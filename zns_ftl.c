@@ -79,9 +79,14 @@ static void __init_resource(struct zns_ftl *zns_ftl)
 
 static void zns_init_params(struct znsparams *zpp, struct ssdparams *spp, uint64_t capacity)
 {
-	zpp->zone_size = ZONE_SIZE;
-	zpp->nr_zones = capacity / ZONE_SIZE;
-	zpp->dies_per_zone = DIES_PER_ZONE;
+	if (nvmev_nand_profile) {
+		zpp->zone_size = nvmev_nand_profile->zone_size;
+		zpp->dies_per_zone = nvmev_nand_profile->dies_per_zone;
+	} else {
+		zpp->zone_size = ZONE_SIZE;
+		zpp->dies_per_zone = DIES_PER_ZONE;
+	}
+	zpp->nr_zones = capacity / zpp->zone_size;
 	zpp->nr_active_zones = zpp->nr_zones; // max
 	zpp->nr_open_zones = zpp->nr_zones; // max
 	zpp->nr_zrwa_zones = MAX_ZRWA_ZONES;
@@ -121,13 +126,15 @@ void zns_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *m
 
 	struct ssdparams spp;
 	struct znsparams zpp;
+	int ret;
 
 	const uint32_t nr_parts = 1; /* Not support multi partitions for zns*/
 	NVMEV_ASSERT(nr_parts == 1);
 
 	ssd = kmalloc(sizeof(struct ssd), GFP_KERNEL);
 	ssd_init_params(&spp, size, nr_parts);
-	ssd_init(ssd, &spp, cpu_nr_dispatcher);
+	ret = ssd_init(ssd, &spp, cpu_nr_dispatcher);
+	NVMEV_ASSERT(ret == 0);
 
 	zns_ftl = kmalloc(sizeof(struct zns_ftl) * nr_parts, GFP_KERNEL);
 	zns_init_params(&zpp, &spp, size);
@@ -139,6 +146,9 @@ void zns_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *m
 	ns->ftls = (void *)zns_ftl;
 	ns->size = size;
 	ns->mapped = mapped_addr;
+	/* zone geometry is kept in 512B LBAs */
+	ns->lba_shift = 9;
+	ns->format = NULL;
 	/*register io command handler*/
 	ns->proc_io_cmd = zns_proc_nvme_io_cmd;
 	return;
@@ -163,7 +173,7 @@ static void zns_flush(struct nvmev_ns *ns, struct nvmev_request *req, struct nvm
 	uint32_t i;
 	struct zns_ftl *zns_ftl = (struct zns_ftl *)ns->ftls;
 
-	start = local_clock();
+	start = nvmev_clock();
 	latest = start;
 	for (i = 0; i < ns->nr_parts; i++) {
 		latest = max(latest, ssd_next_idle_time(zns_ftl[i].ssd));
@@ -196,6 +206,10 @@ bool zns_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct
 	case nvme_cmd_flush:
 		zns_flush(ns, req, ret);
 		break;
+	case nvme_cmd_copy:
+		if (!zns_copy(ns, req, ret))
+			return false;
+		break;
 	case nvme_cmd_zone_mgmt_send:
 		zns_zmgmt_send(ns, req, ret);
 		break;
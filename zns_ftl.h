@@ -140,5 +140,6 @@ void zns_zmgmt_recv(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev
 void zns_zmgmt_send(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 bool zns_write(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
+bool zns_copy(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 bool zns_proc_nvme_io_cmd(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 #endif
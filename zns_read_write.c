@@ -432,9 +432,9 @@ bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resul
 	// get delay from nand model
 	nsecs_latest = nsecs_start;
 	if (LBA_TO_BYTE(nr_lba) <= KB(4))
-		nsecs_latest += spp->fw_4kb_rd_lat;
+		nsecs_latest += ssd_lat(zns_ftl->ssd, fw_4kb_rd_lat);
 	else
-		nsecs_latest += spp->fw_rd_lat;
+		nsecs_latest += ssd_lat(zns_ftl->ssd, fw_rd_lat);
 
 	swr.type = USER_IO;
 	swr.cmd = NAND_READ;
@@ -452,7 +452,8 @@ bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resul
 	}
 
 	if (swr.interleave_pci_dma == false) {
-		nsecs_completed = ssd_advance_pcie(zns_ftl->ssd, nsecs_latest, nr_lba * spp->secsz);
+		nsecs_completed = ssd_advance_pcie(zns_ftl->ssd, nsecs_latest, nr_lba * spp->secsz,
+						   PCIE_D2H);
 		nsecs_latest = (nsecs_completed > nsecs_latest) ? nsecs_completed : nsecs_latest;
 	}
 
@@ -460,3 +461,170 @@ bool zns_read(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_resul
 	ret->nsecs_target = nsecs_latest;
 	return true;
 }
+
+/*
+ * Simple Copy into a zone: the destination must start at the zone write pointer.
+ * Source data is read from NAND into the controller DRAM and programmed at the
+ * destination zone without any PCIe transfer.
+ */
+bool zns_copy(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret)
+{
+	struct zns_ftl *zns_ftl = (struct zns_ftl *)ns->ftls;
+	struct zone_descriptor *zone_descs = zns_ftl->zone_descs;
+	struct ssdparams *spp = &zns_ftl->ssd->sp;
+	struct nvme_copy_command *cmd = &(req->cmd->copy);
+	struct nvme_copy_range range;
+
+	uint64_t sdlba = cmd->sdlba;
+	uint64_t nr_lba = 0;
+	uint64_t tt_lbas = zone_to_slba(zns_ftl, zns_ftl->zp.nr_zones);
+	uint64_t slpn, elpn, lpn, zone_elpn;
+	uint32_t zid;
+	enum zone_state state;
+
+	uint64_t nsecs_start = req->nsecs_start;
+	uint64_t nsecs_completed = nsecs_start;
+	uint64_t nsecs_read_completed = nsecs_start + ssd_lat(zns_ftl->ssd, fw_rd_lat);
+	uint64_t nsecs_latest = nsecs_start;
+	uint32_t status = NVME_SC_SUCCESS;
+
+	struct ppa ppa;
+	struct nand_cmd scp;
+	uint64_t pgs = 0, pg_off;
+	uint32_t i;
+
+	if ((cmd->desc_fmt & 0xf) != 0 || cmd->nr_range >= NR_MAX_COPY_RANGES) {
+		status = NVME_SC_INVALID_FIELD;
+		goto out;
+	}
+
+	for (i = 0; i <= cmd->nr_range; i++) {
+		nvmev_get_copy_range(cmd, i, &range);
+		if (range.slba >= tt_lbas || range.slba + range.nlb >= tt_lbas) {
+			status = NVME_SC_LBA_RANGE;
+			goto out;
+		}
+		nr_lba += range.nlb + 1;
+	}
+
+	if (sdlba >= tt_lbas) {
+		status = NVME_SC_LBA_RANGE;
+		goto out;
+	}
+
+	zid = lba_to_zone(zns_ftl, sdlba);
+	state = zone_descs[zid].state;
+
+	NVMEV_ZNS_DEBUG("%s sdlba 0x%llx nr_lba 0x%llx zone_id %d state %d\n", __FUNCTION__,
+			sdlba, nr_lba, zid, state);
+
+	if (zone_descs[zid].zrwav) {
+		status = NVME_SC_ZNS_INVALID_ZONE_OPERATION;
+		goto out;
+	}
+
+	if ((LBA_TO_BYTE(nr_lba) % spp->write_unit_size) != 0) {
+		status = NVME_SC_ZNS_INVALID_WRITE;
+		goto out;
+	}
+
+	if (__check_boundary_error(zns_ftl, sdlba, nr_lba) == false) {
+		status = NVME_SC_ZNS_ERR_BOUNDARY;
+		goto out;
+	}
+
+	if (sdlba != zone_descs[zid].wp) {
+		NVMEV_ERROR("%s WP error sdlba 0x%llx nr_lba 0x%llx zone_id %d wp %llx state %d\n",
+			    __FUNCTION__, sdlba, nr_lba, zid, zone_descs[zid].wp, state);
+		status = NVME_SC_ZNS_INVALID_WRITE;
+		goto out;
+	}
+
+	switch (state) {
+	case ZONE_STATE_EMPTY: {
+		if (is_zone_resource_full(zns_ftl, ACTIVE_ZONE)) {
+			status = NVME_SC_ZNS_NO_ACTIVE_ZONE;
+			goto out;
+		}
+		if (is_zone_resource_full(zns_ftl, OPEN_ZONE)) {
+			status = NVME_SC_ZNS_NO_OPEN_ZONE;
+			goto out;
+		}
+		acquire_zone_resource(zns_ftl, ACTIVE_ZONE);
+		// go through
+	}
+	case ZONE_STATE_CLOSED: {
+		if (acquire_zone_resource(zns_ftl, OPEN_ZONE) == false) {
+			status = NVME_SC_ZNS_NO_OPEN_ZONE;
+			goto out;
+		}
+
+		change_zone_state(zns_ftl, zid, ZONE_STATE_OPENED_IMPL);
+		break;
+	}
+	case ZONE_STATE_OPENED_IMPL:
+	case ZONE_STATE_OPENED_EXPL: {
+		break;
+	}
+	case ZONE_STATE_FULL:
+		status = NVME_SC_ZNS_ERR_FULL;
+		goto out;
+	case ZONE_STATE_READ_ONLY:
+		status = NVME_SC_ZNS_ERR_READ_ONLY;
+		goto out;
+	case ZONE_STATE_OFFLINE:
+		status = NVME_SC_ZNS_ERR_OFFLINE;
+		goto out;
+	}
+
+	/* read the source ranges into the controller DRAM */
+	scp.type = USER_IO;
+	scp.cmd = NAND_READ;
+	scp.stime = nsecs_read_completed;
+	scp.interleave_pci_dma = false;
+
+	for (i = 0; i <= cmd->nr_range; i++) {
+		nvmev_get_copy_range(cmd, i, &range);
+		slpn = lba_to_lpn(zns_ftl, range.slba);
+		elpn = lba_to_lpn(zns_ftl, range.slba + range.nlb);
+
+		for (lpn = slpn; lpn <= elpn; lpn += pgs) {
+			ppa = __lpn_to_ppa(zns_ftl, lpn);
+			pg_off = ppa.g.pg % spp->pgs_per_flashpg;
+			pgs = min(elpn - lpn + 1, (uint64_t)(spp->pgs_per_flashpg - pg_off));
+			scp.xfer_size = pgs * spp->pgsz;
+			scp.ppa = &ppa;
+			nsecs_completed = ssd_advance_nand(zns_ftl->ssd, &scp);
+			nsecs_read_completed = max(nsecs_completed, nsecs_read_completed);
+		}
+	}
+
+	__increase_write_ptr(zns_ftl, zid, nr_lba);
+
+	/* program the destination zone in oneshot pages */
+	nsecs_latest = nsecs_read_completed;
+	slpn = lba_to_lpn(zns_ftl, sdlba);
+	elpn = lba_to_lpn(zns_ftl, sdlba + nr_lba - 1);
+	zone_elpn = zone_to_elpn(zns_ftl, zid);
+
+	scp.cmd = NAND_WRITE;
+	scp.stime = nsecs_read_completed;
+	scp.xfer_size = spp->pgs_per_oneshotpg * spp->pgsz;
+
+	for (lpn = slpn; lpn <= elpn; lpn += pgs) {
+		ppa = __lpn_to_ppa(zns_ftl, lpn);
+		pg_off = ppa.g.pg % spp->pgs_per_oneshotpg;
+		pgs = min(elpn - lpn + 1, (uint64_t)(spp->pgs_per_oneshotpg - pg_off));
+
+		if (((pg_off + pgs) == spp->pgs_per_oneshotpg) || ((lpn + pgs - 1) == zone_elpn)) {
+			scp.ppa = &ppa;
+			nsecs_completed = ssd_advance_nand(zns_ftl->ssd, &scp);
+			nsecs_latest = max(nsecs_completed, nsecs_latest);
+		}
+	}
+
+out:
+	ret->status = status;
+	ret->nsecs_target = nsecs_latest;
+	return true;
+}